@@ -0,0 +1,177 @@
+// Runs one chunk workload against every BlobStore and prints the throughput of each,
+// so a vault's chunk storage can be picked from measured numbers.
+//
+//   BlobStoreBench [--chunks N] [--chunk-size BYTES] [--dir PATH]
+//
+// Payloads are random (stored chunks are compressed and/or encrypted, so they do not
+// compress further). Reads follow the writes on a warm page cache.
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QPair>
+#include <QRandomGenerator>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <algorithm>
+#include <random>
+#include <utility>
+#include "DatabaseManager.h"
+
+namespace {
+    constexpr int CHUNKS_PER_FILE = 16;
+    constexpr int CHUNKS_PER_TRANSACTION = 256; // as ImportPipeline's batches
+
+    struct Result { double writeMBps = 0; double sequentialMBps = 0; double randomMBps = 0; qint64 diskBytes = 0; };
+
+    double megabytesPerSecond(qint64 bytes, qint64 nsecs) {
+        return nsecs > 0 ? (bytes / 1048576.0) / (nsecs / 1e9) : 0.0;
+    }
+
+    // The vault file, its WAL and any pack files
+    qint64 diskUsage(const QString &directory) {
+        qint64 total = 0;
+        QDirIterator it(directory, QDir::Files, QDirIterator::Subdirectories);
+        while (it.hasNext()) {
+            total += QFileInfo(it.next()).size();
+        }
+        return total;
+    }
+
+    bool run(BlobStore::Kind kind, const QString &directory, int chunkCount, int chunkSize, Result &result) {
+        DatabaseManager &db = DatabaseManager::instance();
+        if (!db.initializeDatabase(directory + "/bench.svfs")) {
+            return false;
+        }
+        User user;
+        if (!db.setBlobStore(kind) || !db.createUser("bench", "bench") || !db.authenticateUser("bench", "bench", user)) {
+            db.closeDatabase();
+            return false;
+        }
+
+        // One random pool; each chunk is a window into it with its index stamped in front
+        QByteArray pool(chunkSize + 4096, Qt::Uninitialized);
+        QRandomGenerator generator(42);
+        generator.fillRange(reinterpret_cast<quint32*>(pool.data()), pool.size() / int(sizeof(quint32)));
+
+        QList<int> fileIds;
+        qint64 writeNs = 0;
+        QElapsedTimer timer;
+        for (int first = 0; first < chunkCount; first += CHUNKS_PER_TRANSACTION) {
+            const int last = qMin(chunkCount, first + CHUNKS_PER_TRANSACTION);
+            QList<FileChunk> batch;
+            for (int i = first; i < last; ++i) {
+                FileChunk chunk{i % CHUNKS_PER_FILE, qint64(i % CHUNKS_PER_FILE) * chunkSize, chunkSize, pool.mid(i % 4096, chunkSize), QByteArray()};
+                std::copy_n(reinterpret_cast<const char*>(&i), sizeof(i), chunk.data.data());
+                chunk.hash = QCryptographicHash::hash(chunk.data, QCryptographicHash::Sha256);
+                batch.append(chunk);
+            }
+
+            timer.start();
+            bool ok = db.beginTransaction();
+            for (int i = first; ok && i < last; ++i) {
+                if (i % CHUNKS_PER_FILE == 0) {
+                    FileRecord record{};
+                    record.filename = QString("file-%1").arg(i / CHUNKS_PER_FILE);
+                    record.path = "/";
+                    record.userId = user.id;
+                    record.isChunked = true;
+                    ok = db.createFile(record);
+                    fileIds.append(record.id);
+                }
+                ok = ok && db.writeFileChunk(fileIds.last(), batch.at(i - first));
+                if (ok && (i % CHUNKS_PER_FILE == CHUNKS_PER_FILE - 1 || i == chunkCount - 1)) {
+                    const qint64 size = qint64(i % CHUNKS_PER_FILE + 1) * chunkSize;
+                    ok = db.finishChunkedFile(fileIds.last(), size, QByteArray(), false, false);
+                }
+            }
+            if (!ok) {
+                db.rollbackTransaction();
+                db.closeDatabase();
+                return false;
+            }
+            ok = db.commitTransaction();
+            writeNs += timer.nsecsElapsed();
+            if (!ok) {
+                db.closeDatabase();
+                return false;
+            }
+        }
+        const qint64 totalBytes = qint64(chunkCount) * chunkSize;
+        result.writeMBps = megabytesPerSecond(totalBytes, writeNs);
+
+        // Every chunk once in file order, then once more in random order
+        QList<QPair<int, int>> order;
+        for (int i = 0; i < chunkCount; ++i) {
+            order.append(qMakePair(fileIds.at(i / CHUNKS_PER_FILE), i % CHUNKS_PER_FILE));
+        }
+        for (int pass = 0; pass < 2; ++pass) {
+            if (pass == 1) {
+                std::shuffle(order.begin(), order.end(), std::mt19937(7));
+            }
+            qint64 readBytes = 0;
+            timer.start();
+            for (const auto &entry : std::as_const(order)) {
+                QList<FileChunk> chunks;
+                if (!db.readFileChunks(entry.first, entry.second, 1, chunks) || chunks.isEmpty()) {
+                    db.closeDatabase();
+                    return false;
+                }
+                readBytes += chunks.first().data.size();
+            }
+            const double rate = megabytesPerSecond(readBytes, timer.nsecsElapsed());
+            (pass == 0 ? result.sequentialMBps : result.randomMBps) = rate;
+        }
+
+        db.closeDatabase();
+        result.diskBytes = diskUsage(directory);
+        return true;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Chunk storage benchmark: the same workload against every BlobStore");
+    parser.addHelpOption();
+    QCommandLineOption chunksOption("chunks", "Number of chunks to write and read.", "N", "4096");
+    QCommandLineOption chunkSizeOption("chunk-size", "Bytes per chunk.", "BYTES", "65536");
+    QCommandLineOption dirOption("dir", "Directory for the benchmark vaults (default: a temporary one).", "PATH");
+    parser.addOptions({chunksOption, chunkSizeOption, dirOption});
+    parser.process(app);
+
+    const int chunkCount = qMax(1, parser.value(chunksOption).toInt());
+    const int chunkSize = qMax(64, parser.value(chunkSizeOption).toInt());
+    QTemporaryDir temporary((parser.isSet(dirOption) ? parser.value(dirOption) : QDir::tempPath()) + "/svfs-bench-XXXXXX");
+    if (!temporary.isValid()) {
+        qCritical() << "Cannot create the benchmark directory";
+        return 1;
+    }
+
+    QTextStream out(stdout);
+    out << QString("%1 chunks of %2 bytes (%3 MiB)\n\n")
+           .arg(chunkCount).arg(chunkSize).arg(qint64(chunkCount) * chunkSize / 1048576.0, 0, 'f', 1);
+    out << QString("%1 %2 %3 %4 %5\n").arg("store", -12).arg("write MB/s", 12).arg("seq MB/s", 12)
+           .arg("random MB/s", 12).arg("on disk MiB", 12);
+
+    int failures = 0;
+    for (BlobStore::Kind kind : {BlobStore::Inline, BlobStore::Incremental, BlobStore::Pack}) {
+        const QString name = BlobStore::kindName(kind);
+        const QString directory = temporary.path() + "/" + name;
+        QDir().mkpath(directory);
+        Result result;
+        if (!run(kind, directory, chunkCount, chunkSize, result)) {
+            out << QString("%1 %2\n").arg(name, -12).arg("unavailable or failed (see log)");
+            ++failures;
+            continue;
+        }
+        out << QString("%1 %2 %3 %4 %5\n").arg(name, -12)
+               .arg(result.writeMBps, 12, 'f', 1).arg(result.sequentialMBps, 12, 'f', 1)
+               .arg(result.randomMBps, 12, 'f', 1).arg(result.diskBytes / 1048576.0, 12, 'f', 1);
+        out.flush();
+    }
+    return failures == 3 ? 1 : 0;
+}
@@ -0,0 +1,40 @@
+// Canonical location for BatchWriter
+#ifndef BATCHWRITER_H
+#define BATCHWRITER_H
+
+#include <QObject>
+#include <QTimer>
+#include <functional>
+#include "DatabaseManager.h"
+
+// Group commit for bulk writes: every write runs at once inside a shared transaction,
+// which is committed after maxRows rows or maxDelayMs since the batch opened, whichever
+// comes first, or on flush(). One journal sync then covers the whole group.
+// Each write runs in its own savepoint: a write that fails undoes only its own rows and
+// the rest of the batch still commits; a failed commit drops the whole batch (flush(), flushed()).
+// While a batch is open, any other DatabaseManager write on this thread joins it and shares
+// its fate, so a batch should not stay open across event-loop turns where other code writes:
+// flush() before returning to the loop (ImportPipeline does after every drain).
+class BatchWriter : public QObject {
+    Q_OBJECT
+public:
+    static constexpr int DEFAULT_MAX_ROWS = 512;
+    static constexpr int DEFAULT_MAX_DELAY_MS = 250;
+    explicit BatchWriter(QObject *parent = nullptr, int maxRows = DEFAULT_MAX_ROWS, int maxDelayMs = DEFAULT_MAX_DELAY_MS);
+    ~BatchWriter() override; // flushes
+    bool createFile(FileRecord &file); // file.id is valid at once, the row is durable after the flush
+    bool updateFile(const FileRecord &file);
+    bool deleteFile(int fileId); // unreferenced chunks are collected once per batch
+    // Any other DatabaseManager writes, counted as rows towards maxRows; rolled back if work() fails
+    bool write(const std::function<bool()> &work, int rows = 1);
+    bool flush(); // commits now; true if nothing was pending
+    int pendingRows() const { return m_pendingRows; }
+signals:
+    void flushed(int rows, bool committed);
+private:
+    bool open();
+    int m_maxRows; QTimer m_timer;
+    bool m_open = false; int m_pendingRows = 0; bool m_collectChunks = false;
+};
+
+#endif // BATCHWRITER_H
@@ -0,0 +1,55 @@
+// Canonical location for BlobStore
+#ifndef BLOBSTORE_H
+#define BLOBSTORE_H
+
+#include <QString>
+#include <QByteArray>
+#include <memory>
+
+class PackStore;
+
+// Where chunk_store payloads live. DatabaseManager owns one store of each kind and routes
+// new payloads to the vault's choice (vault_settings 'chunk_storage'); reads go to the
+// store that holds the row, so switching stores never strands existing content.
+//   Inline:      the data column, bound and fetched as a whole through QSqlQuery
+//   Incremental: the data column, written into a zeroblob and read with sqlite3_blob_*
+//                (needs HAVE_SQLITE3; otherwise unavailable)
+//   Pack:        append-only pack files next to the vault (PackStore), data left empty
+// Implementations run on the calling thread's connection and inside its transaction.
+class BlobStore {
+public:
+    enum Kind { Inline, Incremental, Pack };
+    virtual ~BlobStore() = default;
+    virtual Kind kind() const = 0;
+    virtual bool isAvailable() const { return true; }
+    // New chunk_store row (ref_count 1) holding data
+    virtual bool insert(const QByteArray &hash, qint64 plainSize, const QByteArray &data) = 0;
+    // Payload of a chunk_store row this kind of store holds; maxBytes >= 0 stops early
+    virtual bool read(qint64 chunkId, QByteArray &data, qint64 maxBytes = -1) = 0;
+
+    static std::unique_ptr<BlobStore> create(Kind kind, PackStore &packs);
+    static QString kindName(Kind kind); // as stored in vault_settings
+    static bool kindFromName(const QString &name, Kind &kind);
+};
+
+// Incremental I/O on one BLOB cell through the calling thread's connection (sqlite3_blob_*):
+// reads at any offset touch only the pages they cover, and writes go into space reserved
+// beforehand with zeroblob(N); the size is fixed while open. Needs HAVE_SQLITE3.
+// A handle expires when its row changes; keep it open only for the I/O at hand.
+class BlobStream {
+public:
+    BlobStream() = default;
+    ~BlobStream(); // closes
+    static bool isAvailable();
+    bool open(const char *table, const char *column, qint64 rowId, bool writable);
+    void close();
+    bool isOpen() const { return m_blob != nullptr; }
+    qint64 size() const;
+    bool read(qint64 offset, qint64 length, QByteArray &data); // clamped to the end of the value
+    bool write(qint64 offset, const QByteArray &data);
+private:
+    BlobStream(const BlobStream&) = delete; BlobStream& operator=(const BlobStream&) = delete;
+    void *m_blob = nullptr; // sqlite3_blob
+};
+
+#endif // BLOBSTORE_H
@@ -0,0 +1,70 @@
+// Canonical location for BoundedQueue
+#ifndef BOUNDEDQUEUE_H
+#define BOUNDEDQUEUE_H
+
+#include <QMutex>
+#include <QWaitCondition>
+#include <QQueue>
+
+// Blocking FIFO with a fixed capacity, the link between pipeline stages. A full queue
+// stalls the producer, so a fast stage cannot run ahead of a slow one and pile up memory.
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(int capacity) : m_capacity(qMax(1, capacity)) {}
+
+    // Waits while full; false once the queue is closed (the item is dropped)
+    bool push(T item) {
+        QMutexLocker locker(&m_mutex);
+        while (!m_closed && m_items.size() >= m_capacity) {
+            m_notFull.wait(&m_mutex);
+        }
+        if (m_closed) {
+            return false;
+        }
+        m_items.enqueue(std::move(item));
+        m_notEmpty.wakeOne();
+        return true;
+    }
+
+    // Waits while empty; false once the queue is closed and drained
+    bool pop(T &item) {
+        QMutexLocker locker(&m_mutex);
+        while (!m_closed && m_items.isEmpty()) {
+            m_notEmpty.wait(&m_mutex);
+        }
+        return takeLocked(item);
+    }
+
+    bool tryPop(T &item) {
+        QMutexLocker locker(&m_mutex);
+        return takeLocked(item);
+    }
+
+    // Wakes every waiter; consumers still get what is queued, producers are refused
+    void close() {
+        QMutexLocker locker(&m_mutex);
+        m_closed = true;
+        m_notEmpty.wakeAll();
+        m_notFull.wakeAll();
+    }
+
+private:
+    bool takeLocked(T &item) {
+        if (m_items.isEmpty()) {
+            return false;
+        }
+        item = m_items.dequeue();
+        m_notFull.wakeOne();
+        return true;
+    }
+
+    QMutex m_mutex;
+    QWaitCondition m_notEmpty;
+    QWaitCondition m_notFull;
+    QQueue<T> m_items;
+    int m_capacity;
+    bool m_closed = false;
+};
+
+#endif // BOUNDEDQUEUE_H
@@ -8,9 +8,20 @@
 class CompressionManager {
 public:
     enum CompressionAlgorithm { ZLIB, GZIP, LZ4, ZSTD };
+    // Header of a compressFramed() blob; originalSize is the exact decompressed size
+    struct FrameInfo { CompressionAlgorithm algorithm = ZLIB; int level = 0; qint64 originalSize = 0; };
+    static constexpr int FRAME_HEADER_SIZE = 16;
     static CompressionManager& instance();
     QByteArray compress(const QByteArray &data, CompressionAlgorithm algorithm = ZLIB, int level = 6);
     QByteArray decompress(const QByteArray &compressedData, CompressionAlgorithm algorithm = ZLIB);
+    // Self-describing variant: frame header + compress() payload, decodable without knowing the algorithm
+    QByteArray compressFramed(const QByteArray &data, CompressionAlgorithm algorithm = ZLIB, int level = 6);
+    // Decodes into a buffer allocated once at the recorded size. Unframed (legacy) data is decoded as
+    // legacyAlgorithm unless it starts with an LZ4/ZSTD magic number.
+    bool decompressFramed(const QByteArray &data, QByteArray &decompressed, CompressionAlgorithm legacyAlgorithm = ZLIB);
+    bool readFrameHeader(const QByteArray &data, FrameInfo &info) const;
+    // What compress() actually uses: GZIP and codecs not built in fall back to ZLIB
+    CompressionAlgorithm resolveAlgorithm(CompressionAlgorithm algorithm) const;
     bool compressFile(const QString &inputPath, const QString &outputPath, CompressionAlgorithm algorithm = ZLIB, int level = 6);
     bool decompressFile(const QString &inputPath, const QString &outputPath, CompressionAlgorithm algorithm = ZLIB);
     double getCompressionRatio(const QByteArray &original, const QByteArray &compressed);
@@ -0,0 +1,46 @@
+// Canonical location for CompressionStream
+#ifndef COMPRESSIONSTREAM_H
+#define COMPRESSIONSTREAM_H
+
+#include <QByteArray>
+#include "CompressionManager.h"
+
+struct ZSTD_CCtx_s; struct ZSTD_DCtx_s; struct LZ4F_cctx_s; struct LZ4F_dctx_s; struct z_stream_s;
+
+// Incremental compressor/decompressor: push input as it arrives, take output as it is produced.
+// The format is the one CompressionManager::compress()/decompress() use for the same algorithm.
+// ZSTD and LZ4 contexts are borrowed from a per-thread cache and handed back when the stream ends.
+class CompressionStream {
+public:
+    enum Direction { Compress, Decompress };
+    CompressionStream(Direction direction, CompressionManager::CompressionAlgorithm algorithm, int level = 6);
+    ~CompressionStream();
+    // Total input size when compressing, if known; recorded in the frame header. Call before push().
+    // finish() fails if a different number of bytes was pushed.
+    void setSizeHint(qint64 size);
+    bool push(const char *data, qint64 size);
+    bool push(const QByteArray &data) { return push(data.constData(), data.size()); }
+    bool finish(); // compress: ends the frame; decompress: fails unless a complete frame was read
+    QByteArray takeOutput(); // everything produced since the last call
+    bool hasError() const { return m_failed; }
+    bool isFinished() const { return m_finished; }
+    // One-shot decode of a complete compress() payload straight into out, on the same per-thread
+    // contexts. Returns the decoded size, -1 on error or if it would not fit.
+    static qint64 decompressInto(CompressionManager::CompressionAlgorithm algorithm, const char *data, qint64 size, char *out, qint64 capacity);
+private:
+    CompressionStream(const CompressionStream&) = delete;
+    CompressionStream& operator=(const CompressionStream&) = delete;
+    Direction m_direction; CompressionManager::CompressionAlgorithm m_algorithm; int m_level; qint64 m_sizeHint = -1; qint64 m_pushed = 0;
+    QByteArray m_output; bool m_started = false; bool m_failed = false; bool m_finished = false; bool m_frameComplete = false;
+    ZSTD_CCtx_s *m_zstdCompress = nullptr; ZSTD_DCtx_s *m_zstdDecompress = nullptr;
+    LZ4F_cctx_s *m_lz4Compress = nullptr; LZ4F_dctx_s *m_lz4Decompress = nullptr;
+    z_stream_s *m_zlib = nullptr; int m_zlibHeaderBytes = 0; // qCompress()-style 4-byte size prefix still to skip
+    QByteArray m_pending; // whole input, only without zlib where qCompress()/qUncompress() do the work
+    bool start();
+    bool compressData(const char *data, qint64 size, bool end);
+    bool decompressData(const char *data, qint64 size);
+    void releaseContexts();
+    char* outputSpace(qint64 bytes); // grows m_output, caller trims the unused tail
+};
+
+#endif // COMPRESSIONSTREAM_H
@@ -0,0 +1,33 @@
+// Canonical location for ContentChunker
+#ifndef CONTENTCHUNKER_H
+#define CONTENTCHUNKER_H
+
+#include <QByteArray>
+#include <QIODevice>
+
+// Splits a stream into content-defined chunks (gear rolling hash, FastCDC style).
+// Boundaries follow the data, so an insert near the start of a file only changes
+// the chunks around the edit and every other chunk still deduplicates.
+class ContentChunker {
+public:
+    static constexpr int MIN_CHUNK_SIZE = 256 * 1024;
+    static constexpr int AVG_CHUNK_SIZE = 1024 * 1024;
+    static constexpr int MAX_CHUNK_SIZE = 4 * 1024 * 1024;
+
+    explicit ContentChunker(QIODevice &source);
+    bool next(QByteArray &chunk); // false at end of stream or on read error
+    bool hasError() const { return m_error; }
+    // Length of the chunk starting at data. Only final once available >= MAX_CHUNK_SIZE
+    // or the data ends, which lets push-style writers chunk exactly like next()
+    static qsizetype findBoundary(const uchar *data, qsizetype available);
+private:
+    bool fill();
+
+    QIODevice &m_source;
+    QByteArray m_buffer;
+    qsizetype m_pos = 0;
+    bool m_eof = false;
+    bool m_error = false;
+};
+
+#endif // CONTENTCHUNKER_H
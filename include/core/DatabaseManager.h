@@ -7,15 +7,39 @@
 #include <QList>
 #include <QByteArray>
 #include <QString>
+#include <QVariant>
+#include <QMutex>
+#include <atomic>
+#include <memory>
+#include "PackStore.h"
+#include "BlobStore.h"
+
+class QThread;
+class QSqlQuery;
 
 struct User {
     int id; QString username; QByteArray passwordHash; QByteArray salt; QDateTime createdAt; QDateTime lastLogin; bool isActive;
 };
 struct FileRecord {
-    int id; QString filename; QString path; QByteArray content; QByteArray encryptedContent; QString mimeType; qint64 size; QDateTime createdAt; QDateTime modifiedAt; int userId; bool isEncrypted; bool isCompressed; QByteArray checksum;
+    int id; QString filename; QString path; QByteArray content; QByteArray encryptedContent; QString mimeType; qint64 size; QDateTime createdAt; QDateTime modifiedAt; int userId; bool isEncrypted; bool isCompressed; QByteArray checksum; bool isChunked = false; int dirId = 0; // 0: root, -1: unresolved
+};
+// Metadata-only view of a files row: everything a listing needs, no content blobs
+struct FileMeta {
+    int id; QString filename; QString path; QString mimeType; qint64 size; qint64 storedSize; QDateTime createdAt; QDateTime modifiedAt; int userId; bool isEncrypted; bool isCompressed; QByteArray checksum; bool isChunked; int dirId = 0;
 };
+// One independently processed (compressed/encrypted) slice of a chunked file.
+// hash is the keyed content hash identifying the shared row in chunk_store.
+struct FileChunk {
+    int index; qint64 plainOffset; qint64 plainSize; QByteArray data; QByteArray hash;
+};
+// path is the parent's path (kept for display); parentId is authoritative, 0 is the root
 struct DirectoryRecord {
-    int id; QString name; QString path; int parentId; int userId; QDateTime createdAt; QDateTime modifiedAt;
+    int id = 0; QString name; QString path; int parentId = 0; int userId; QDateTime createdAt; QDateTime modifiedAt;
+};
+// Maintained per-user totals (user_stats); storedBytes is after compression/encryption,
+// inline* covers the files whose content sits in the files row instead of chunks
+struct UserStats {
+    int fileCount = 0; int directoryCount = 0; qint64 logicalBytes = 0; qint64 storedBytes = 0; int inlineFileCount = 0; qint64 inlineBytes = 0;
 };
 
 class DatabaseManager {
@@ -29,23 +53,119 @@ public:
     bool authenticateUser(const QString &username, const QString &password, User &user);
     bool updateUserLastLogin(int userId);
     bool changePassword(int userId, const QString &newPassword);
-    bool createFile(const FileRecord &file);
+    bool createFile(FileRecord &file); // sets file.id on success
     bool updateFile(const FileRecord &file);
-    bool deleteFile(int fileId);
+    bool deleteFile(int fileId, bool collectChunks = true); // false: leave GC to a later collectUnreferencedChunks()
+    bool moveFile(int fileId, int dirId, const QString &filename); // rename and/or move, metadata only
+    // New rows sharing the source's stored content (chunk references are counted, not copied)
+    bool copyFile(int fileId, int dirId, const QString &filename, int &newFileId);
     bool getFile(int fileId, FileRecord &file);
-    QList<FileRecord> getFilesInDirectory(const QString &path, int userId);
-    QList<FileRecord> searchFiles(const QString &query, int userId);
-    bool createDirectory(const DirectoryRecord &dir);
-    bool deleteDirectory(int dirId);
+    QList<FileRecord> getFilesInDirectory(int dirId, int userId);
+    static constexpr int DEFAULT_SEARCH_LIMIT = 500;
+    // Substring search on filename and path, best matches first, at most limit rows
+    QList<FileRecord> searchFiles(const QString &query, int userId, int limit = DEFAULT_SEARCH_LIMIT);
+    // Metadata-only listing/search; content is fetched lazily with getFileBlob()
+    bool getFileMeta(int fileId, FileMeta &meta);
+    QList<FileMeta> getFileMetaInDirectory(int dirId, int userId);
+    QList<FileMeta> searchFileMeta(const QString &query, int userId, int limit = DEFAULT_SEARCH_LIMIT);
+    bool getFileBlob(int fileId, QByteArray &blob);
+    // Part of a single-blob row's stored bytes, clamped to its end; with BlobStream only the
+    // pages covering the range are read, so large legacy rows stream in bounded memory
+    bool getFileBlobRange(int fileId, qint64 offset, qint64 length, QByteArray &data);
+    // First maxBytes of the stored bytes (inline blob, or chunk 0 of a chunked file)
+    bool getFileBlobPrefix(int fileId, int maxBytes, QByteArray &prefix);
+    // Chunked content (files.is_chunked = 1): rows in file_chunks ordered by chunk_index,
+    // each referencing a deduplicated, reference-counted row in chunk_store
+    bool hasChunk(const QByteArray &hash);
+    bool writeFileChunk(int fileId, const FileChunk &chunk); // chunk.data may be empty if hasChunk(chunk.hash)
+    bool readFileChunks(int fileId, int firstIndex, int count, QList<FileChunk> &chunks);
+    bool readFileChunkLayout(int fileId, QList<FileChunk> &chunks); // index/offset/size only, no data
+    int getFileChunkCount(int fileId);
+    bool deleteFileChunks(int fileId, int fromIndex = 0); // drops references; see collectUnreferencedChunks()
+    int collectUnreferencedChunks(int limit = -1); // returns number of chunks removed, -1 on error
+    // Chunk payload storage (see BlobStore). The choice is per vault and applies to new
+    // payloads; existing ones stay readable whichever store wrote them.
+    bool setBlobStore(BlobStore::Kind kind);
+    BlobStore::Kind blobStoreKind() const { return m_blobStore->kind(); }
+    bool isBlobStoreAvailable(BlobStore::Kind kind);
+    qint64 compactPacks(); // rewrites mostly-dead packs; returns bytes reclaimed, -1 on error or inside a transaction
+    QString vaultSetting(const QString &key, const QString &defaultValue = QString());
+    bool setVaultSetting(const QString &key, const QString &value);
+    bool finishChunkedFile(int fileId, qint64 size, const QByteArray &checksum, bool isEncrypted, bool isCompressed);
+    // Small files keep their processed content in the files row; chunks must be gone already
+    bool setInlineContent(int fileId, const QByteArray &stored, qint64 size, const QByteArray &checksum, bool isEncrypted, bool isCompressed);
+    // Per vault: content up to this many bytes is stored inline (0: always chunked)
+    static constexpr qint64 DEFAULT_INLINE_THRESHOLD = 4096;
+    qint64 inlineThreshold() const { return m_inlineThreshold; }
+    bool setInlineThreshold(qint64 bytes);
+    // The outermost call opens the transaction, nested ones a savepoint: rolling back an
+    // inner scope undoes only its own writes and the outer one can still commit
+    bool beginTransaction();
+    bool commitTransaction();
+    void rollbackTransaction();
+    // Hierarchy: files.dir_id and directories.parent_id, with directory_tree as the closure
+    bool createDirectory(DirectoryRecord &dir); // sets dir.id on success
+    bool deleteDirectory(int dirId); // with all folders and files below it; chunk GC is left to the caller
     bool getDirectory(int dirId, DirectoryRecord &dir);
-    QList<DirectoryRecord> getDirectoriesInPath(const QString &path, int userId);
+    // Rename and/or move a whole subtree in one transaction; content is never touched
+    bool moveDirectory(int dirId, int parentId, const QString &name);
+    bool copyDirectory(int dirId, int parentId, const QString &name, int &newDirId); // set-based, whole subtree
+    bool isNameTaken(int userId, int dirId, const QString &name); // a file or folder of that name in dirId
+    bool findDirectory(int userId, const QString &path, int &dirId); // "/" is 0
+    QList<DirectoryRecord> getSubdirectories(int parentId, int userId);
+    bool getSubtreeStats(int dirId, int userId, UserStats &stats); // everything below dirId
+    bool getUserStats(int userId, UserStats &stats); // one row read, no scans
+    bool recomputeUserStats(); // repair: rebuilds every user's row from the tables
     qint64 getTotalStorageUsed(int userId);
     int getFileCount(int userId);
     int getDirectoryCount(int userId);
     void closeDatabase();
 private:
     DatabaseManager() = default; ~DatabaseManager() = default; DatabaseManager(const DatabaseManager&) = delete; DatabaseManager& operator=(const DatabaseManager&) = delete;
-    QSqlDatabase m_database; bool m_isInitialized = false; QString m_connectionName = "svfs_connection"; QString m_dbPath = "svfs.db";
+    QSqlDatabase m_database; QString m_connectionName = "svfs_connection"; QString m_dbPath = "svfs.db"; int m_transactionDepth = 0; bool m_transactionFailed = false;
+    QList<int> m_packRemovals; // packs to delete once the outermost transaction has committed
+    std::atomic<quint64> m_connectionGeneration{1}; QMutex m_pathMutex; // read connections follow reopens
+    // Set on the writer's thread, read by every thread that picks a connection
+    std::atomic<QThread*> m_writerThread{nullptr}; std::atomic<bool> m_isInitialized{false};
+    // Writes go through m_database on the thread that opened it; reads from any other
+    // thread use that thread's own read-only connection (WAL keeps them out of the writer's way)
+    QSqlDatabase readConnection();
+    // Cached prepared statement of this thread's connection: prepared once per SQL text,
+    // re-bound by position on every use and reset (finish()) when the handle goes away.
+    // Two handles on the same SQL text must not be alive at once.
+    class Statement {
+    public:
+        explicit Statement(QSqlQuery *query) : m_query(query) {}
+        Statement(Statement &&other) noexcept : m_query(other.m_query) { other.m_query = nullptr; }
+        ~Statement();
+        QSqlQuery* operator->() const { return m_query; }
+        QSqlQuery& operator*() const { return *m_query; }
+    private:
+        Statement(const Statement&) = delete; Statement& operator=(const Statement&) = delete;
+        QSqlQuery *m_query;
+    };
+    Statement statement(const QString &sql);
+    std::atomic<bool> m_hasSearchIndex{false}; // files_fts exists and is maintained
+    PackStore m_packs;
+    std::unique_ptr<BlobStore> m_inlineBlobs = BlobStore::create(BlobStore::Inline, m_packs);
+    std::unique_ptr<BlobStore> m_incrementalBlobs = BlobStore::create(BlobStore::Incremental, m_packs);
+    std::unique_ptr<BlobStore> m_packBlobs = BlobStore::create(BlobStore::Pack, m_packs);
+    BlobStore *m_blobStore = m_inlineBlobs.get(); // where new payloads go
+    qint64 m_inlineThreshold = DEFAULT_INLINE_THRESHOLD;
+    BlobStore* blobStore(BlobStore::Kind kind) const;
+    BlobStore* blobReader(bool inPack) const; // the store holding a row, by its pack_id
+    QString packDirectory() const; // <vault file>.packs
+    bool createSearchIndex();
+    bool createDirectoryTree();
+    bool createUserStats();
+    Statement searchStatement(const char *columns, const QString &text, int userId, int limit);
+    void enableWriteAheadLog();
+    bool addColumnIfMissing(const QString &table, const QString &column, const QString &definition);
+    bool releaseFileChunks(int fileId, int fromIndex, int toIndex);
+    bool execStatement(const QString &sql, const QVariantList &values); // cached, bound by position
+    bool clearCopyMaps();
+    bool copyMappedChunks(); // file_chunks rows and refcounts for every pair in temp.copy_files
+    friend class InlineBlobStore; friend class IncrementalBlobStore; friend class PackBlobStore; friend class BlobStream;
     QByteArray generateSalt(); QByteArray hashPassword(const QString &password, const QByteArray &salt); bool verifyPassword(const QString &password, const QByteArray &hash, const QByteArray &salt);
 };
 
@@ -5,10 +5,17 @@
 #include <QByteArray>
 #include <QString>
 #include <openssl/evp.h>
+#include <functional>
+#include <atomic>
 
 class EncryptionManager {
 public:
     enum EncryptionAlgorithm { AES_256_CBC, AES_256_GCM, ChaCha20_Poly1305 };
+    // Plaintext SVFENC header fields; ivLength is the base nonce length for version 2, tagLength the per-segment tag
+    struct HeaderInfo {
+        unsigned char version = 0; EncryptionAlgorithm algorithm = AES_256_GCM; unsigned char flags = 0; int ivLength = 0; int tagLength = 0;
+    };
+    static constexpr int HEADER_PROBE_SIZE = 64; // bytes from the start of a blob that cover any valid header
     static EncryptionManager& instance();
     bool generateKey(const QString &password, const QByteArray &salt);
     bool loadKey(const QString &password, const QByteArray &salt);
@@ -17,18 +24,46 @@ public:
     QByteArray decrypt(const QByteArray &encryptedData, EncryptionAlgorithm algorithm = AES_256_GCM);
     QByteArray encryptWithFlags(const QByteArray &data, EncryptionAlgorithm algorithm, unsigned char flags);
     bool decryptAndGetFlags(const QByteArray &encryptedData, QByteArray &plaintext, unsigned char &flags, EncryptionAlgorithm &detectedAlg);
+    // Parses the header only: no key needed, no crypto work; data may be just the first HEADER_PROBE_SIZE bytes
+    bool probeHeader(const QByteArray &data, HeaderInfo &info) const;
+    // Decrypts at least [offset, offset + length) (length -1 = to the end): only the covering segments
+    // of a version 2 blob, everything for version 1. plaintextOffset is where plaintext starts.
+    bool decryptRange(const QByteArray &encryptedData, qint64 offset, qint64 length, QByteArray &plaintext, qint64 &plaintextOffset);
+    // Zero-copy decryption into a caller buffer: plaintextCapacity() gives the size out must have
+    // (an upper bound for CBC), decryptInto() returns the plaintext length or -1 on failure
+    qint64 plaintextCapacity(const char *data, qint64 size) const;
+    qint64 decryptInto(const char *data, qint64 size, char *out, qint64 capacity, unsigned char *flags = nullptr);
     bool encryptFile(const QString &inputPath, const QString &outputPath, EncryptionAlgorithm algorithm = AES_256_CBC);
     bool decryptFile(const QString &inputPath, const QString &outputPath, EncryptionAlgorithm algorithm = AES_256_CBC);
+    // HMAC-SHA256 under a subkey of the loaded key, separated per domain; equal input gives equal output
+    QByteArray keyedHash(const QByteArray &data, const QByteArray &domain);
     QByteArray generateRandomBytes(int size); QByteArray calculateChecksum(const QByteArray &data); bool verifyChecksum(const QByteArray &data, const QByteArray &checksum);
     QString getAlgorithmName(EncryptionAlgorithm algorithm) const; int getKeySize(EncryptionAlgorithm algorithm) const; int getIVSize(EncryptionAlgorithm algorithm) const;
 private:
     EncryptionManager() = default; ~EncryptionManager() = default; EncryptionManager(const EncryptionManager&) = delete; EncryptionManager& operator=(const EncryptionManager&) = delete;
     QByteArray m_derivedKey; bool m_keyLoaded = false; QByteArray deriveKey(const QString &password, const QByteArray &salt);
-    QByteArray encryptAES256CBC(const QByteArray &data); QByteArray decryptAES256CBC(const QByteArray &encryptedData);
-    QByteArray encryptAES256GCM(const QByteArray &data); QByteArray decryptAES256GCM(const QByteArray &encryptedData);
-    QByteArray encryptChaCha20Poly1305(const QByteArray &data); QByteArray decryptChaCha20Poly1305(const QByteArray &encryptedData);
-    QByteArray evpEncrypt(const QByteArray &data, const EVP_CIPHER *cipher, QByteArray &iv, QByteArray &tag);
-    QByteArray evpDecrypt(const QByteArray &enc, const EVP_CIPHER *cipher, const QByteArray &iv, const QByteArray &tag, bool &ok);
+    std::atomic<quint64> m_keyGeneration{1}; // bumped on every key change, stales the per-thread contexts
+    // Parsed SVFENC header; pointers alias the blob, nothing is copied
+    struct HeaderView {
+        unsigned char version = 0; unsigned char algCode = 0; unsigned char flags = 0;
+        const unsigned char *header = nullptr; int headerLen = 0; // version 2: also the AAD prefix of every segment
+        const unsigned char *iv = nullptr; int ivLen = 0; const unsigned char *tag = nullptr; int tagLen = 0;
+        const unsigned char *payload = nullptr; qint64 payloadLen = 0;
+        quint32 segmentSize = 0; qint64 segmentCount = 0; qint64 plainSize = 0; // version 2 only
+    };
+    static bool parseHeader(const char *data, qint64 size, HeaderView &view);
+    static bool parseSegmentLayout(HeaderView &view);
+    // Cached context for this thread, keyed with the current key; only the IV/nonce needs setting
+    EVP_CIPHER_CTX* keyedContext(unsigned char algCode, bool encrypt);
+    QByteArray encryptAES256CBC(const QByteArray &data);
+    QByteArray encryptAES256GCM(const QByteArray &data);
+    QByteArray encryptChaCha20Poly1305(const QByteArray &data);
+    // Runs work over segments [first, last] split across a thread pool, each batch on its thread's cached context
+    bool forEachSegment(unsigned char algCode, bool encrypt, qint64 first, qint64 last,
+                        const std::function<bool(EVP_CIPHER_CTX *ctx, qint64 index)> &work);
+    QByteArray encryptV1(const QByteArray &data, unsigned char algCode, unsigned char flags);
+    QByteArray encryptSegmented(const QByteArray &data, unsigned char algCode, unsigned char flags);
+    bool decryptSegments(const HeaderView &view, qint64 first, qint64 last, unsigned char *out);
 };
 
 #endif // ENCRYPTIONMANAGER_H
@@ -0,0 +1,74 @@
+// Canonical location for ImportPipeline
+#ifndef IMPORTPIPELINE_H
+#define IMPORTPIPELINE_H
+
+#include <QObject>
+#include <QString>
+#include <QList>
+#include <QHash>
+#include <QSet>
+#include <QThreadPool>
+#include <QElapsedTimer>
+#include <atomic>
+#include "BoundedQueue.h"
+#include "BatchWriter.h"
+#include "DatabaseManager.h"
+#include "VFSManager.h"
+
+struct ImportJob { QString sourcePath; QString filename; QString vfsPath; };
+
+// Imports many local files at once as a staged pipeline:
+//   reader thread -> compress workers -> encrypt workers -> database writer
+// joined by bounded queues. The reader chunks files with ContentChunker, the CPU stages
+// run on a pool sized to the machine, and the writer runs on the thread that owns this
+// object (the database connection is bound to it) and group-commits through a BatchWriter.
+class ImportPipeline : public QObject {
+    Q_OBJECT
+public:
+    explicit ImportPipeline(QObject *parent = nullptr);
+    ~ImportPipeline() override; // cancels, waits for the workers, removes half-written files
+    bool start(const QList<ImportJob> &jobs, bool encrypt, bool compress); // one run per pipeline
+    void cancel(); // files already written are kept
+    bool isRunning() const { return m_running; }
+signals:
+    void progress(int imported, int failed, int totalFiles, qint64 bytesImported);
+    void finished(int imported, int failed, qint64 bytesImported, qint64 elapsedMs, bool cancelled);
+private:
+    // One chunk on its way to the writer, or the end marker of a file (sent by the reader).
+    // A file within the inline threshold travels as one inlined item and is stored in its row.
+    struct Item {
+        int file = -1; bool end = false; bool failed = false; bool cancelled = false; bool inlined = false;
+        FileChunk chunk; QByteArray plain; // plain outlives the compress stage only for dedup hits
+        int chunkCount = 0; qint64 size = 0; QByteArray checksum; // end marker only
+    };
+    // Writer-side state of a file whose chunks are still arriving
+    struct OpenFile {
+        int fileId = -1; int chunksSeen = 0; int chunkCount = -1; bool failed = false; bool cancelled = false;
+        qint64 size = 0; QByteArray checksum;
+        QByteArray inlineData; bool inlined = false; // processed content, row created on close
+    };
+    void readFiles();
+    void compressStage();
+    void encryptStage();
+    void scheduleDrain();
+    void drainWrites(); // runs on the owning thread
+    void batchFlushed(int rows, bool committed);
+    bool writeItem(Item &item, OpenFile &state);
+    bool createRow(int file, OpenFile &state);
+    bool closeFile(int file, OpenFile &state); // finishes or deletes the row
+    void discardFile(const OpenFile &state);
+
+    QList<ImportJob> m_jobs; bool m_encrypt = false; bool m_compress = false; bool m_started = false; bool m_running = false;
+    qint64 m_inlineThreshold = 0;
+    VFSManager::Processing m_processing{}; // settings as of start(), for every stage
+    int m_workers; QThreadPool m_pool;
+    BoundedQueue<Item> m_compressQueue; BoundedQueue<Item> m_encryptQueue; BoundedQueue<Item> m_writeQueue;
+    std::atomic_int m_compressWorkers{0};
+    std::atomic_bool m_cancelled{false}; std::atomic_bool m_drainScheduled{false};
+    BatchWriter m_batch;
+    QHash<int, OpenFile> m_open; QList<int> m_closing; QSet<int> m_touched; // m_closing: written, awaiting commit
+    int m_imported = 0; int m_failed = 0; int m_closed = 0; qint64 m_bytes = 0;
+    QElapsedTimer m_timer;
+};
+
+#endif // IMPORTPIPELINE_H
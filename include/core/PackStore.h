@@ -0,0 +1,61 @@
+// Canonical location for PackStore
+#ifndef PACKSTORE_H
+#define PACKSTORE_H
+
+#include <QString>
+#include <QByteArray>
+#include <QList>
+#include <QHash>
+#include <QFile>
+#include <QMutex>
+#include <memory>
+
+// Where one payload lives: SQLite keeps these four values instead of the bytes
+struct PackLocation { int packId = 0; qint64 offset = 0; qint64 length = 0; quint64 checksum = 0; };
+
+// Append-only pack files for processed chunk payloads, kept in a directory next to the
+// vault database (pack-000001.svpk, ...). Payloads are only ever appended, so writes are
+// sequential; space of payloads nobody references is reclaimed by compaction, which
+// copies the live ones forward and drops whole packs. Thread-safe.
+//
+// Crash safety: an append is durable after sync(), and DatabaseManager syncs before
+// committing the rows that point at it. A crash before that leaves at most unreferenced
+// bytes at the end of a pack, never a row pointing at missing data.
+//
+// Reads of sealed packs are served from a memory mapping made once per pack: the payload
+// is copied straight out of the page cache, without a seek/read syscall or QFile's buffer,
+// and outside the store's lock (a cold page faults in without blocking other readers).
+// The append pack still grows, so it is read through its file instead. A reader pins the
+// mapping while it copies; close() and removePack() only drop the store's reference, and
+// the last one out unmaps. Nothing read() returned points into a mapping.
+class PackStore {
+public:
+    static constexpr qint64 MAX_PACK_BYTES = qint64(1) << 30; // a new pack is started beyond this
+    PackStore() = default;
+    ~PackStore(); // closes
+    bool open(const QString &directory); // created if missing
+    void close();
+    bool isOpen() const;
+    bool append(const QByteArray &data, PackLocation &location);
+    bool sync(); // flush + fsync of everything appended so far; cheap when nothing was
+    bool read(const PackLocation &location, QByteArray &data); // verified against the checksum
+    QList<int> packIds() const;
+    int appendPackId() const; // the pack being appended to; never compacted
+    qint64 packSize(int packId) const;
+    bool removePack(int packId); // not the append pack
+    static quint64 checksum(const char *data, qsizetype size);
+private:
+    PackStore(const PackStore&) = delete; PackStore& operator=(const PackStore&) = delete;
+    QString packPath(int packId) const;
+    bool openAppendPack(int packId);
+    QFile* reader(int packId);
+    // A sealed pack mapped as a whole; unmapped (with the file) when the last holder lets go
+    struct Mapping { explicit Mapping(const QString &path) : file(path) {} QFile file; const char *base = nullptr; qint64 size = 0; };
+    std::shared_ptr<Mapping> mapped(const PackLocation &location); // covering the record, or null to read instead
+    mutable QMutex m_mutex;
+    QString m_directory; QFile m_append; int m_appendId = 0; bool m_unflushed = false; bool m_unsynced = false;
+    QHash<int, QFile*> m_readers;
+    QHash<int, std::shared_ptr<Mapping>> m_mappings; bool m_mapFailed = false;
+};
+
+#endif // PACKSTORE_H
@@ -0,0 +1,69 @@
+// Canonical location for VFSFile
+#ifndef VFSFILE_H
+#define VFSFILE_H
+
+#include <QIODevice>
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QList>
+#include <memory>
+#include "DatabaseManager.h"
+
+class QTemporaryFile;
+
+// Random-access handle on one vault file for the current user.
+// Reads decrypt/decompress only the chunks covering the requested range.
+// WriteOnly processes new content into chunks as it arrives and stages them, in their
+// stored form, in a temporary file; nothing reaches the vault until commit(), which
+// replaces the old content in one transaction. close() without commit() discards it.
+class VFSFile : public QIODevice {
+    Q_OBJECT
+
+public:
+    explicit VFSFile(int fileId, QObject *parent = nullptr);
+    ~VFSFile() override;
+
+    bool open(OpenMode mode) override; // ReadOnly, or WriteOnly (always truncates)
+    void close() override;
+    bool commit();
+
+    int fileId() const { return m_fileId; }
+    const FileMeta& meta() const { return m_meta; }
+    qint64 size() const override;
+    bool seek(qint64 pos) override;
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+    qint64 writeData(const char *data, qint64 maxSize) override;
+
+private:
+    bool loadWindow(int layoutIndex, qint64 inChunk);
+    bool hashWindow(qint64 fileOffset);
+    bool flushChunks(bool final);
+    void reset();
+
+    int m_fileId;
+    FileMeta m_meta{};
+    QList<FileChunk> m_layout; // chunk positions only; data is fetched per chunk
+    // Decoded window: the whole chunk, or for encrypted uncompressed chunks only
+    // the segments around the read position (the stored chunk is kept for the next window)
+    int m_cachedIndex = -1;
+    qint64 m_cachedBegin = 0;
+    QByteArray m_cached;
+    int m_storedIndex = -1;
+    QByteArray m_stored;
+    // Whole-file checksum, verified when a reader goes through the file in order
+    QCryptographicHash m_hash{QCryptographicHash::Sha256};
+    qint64 m_hashedBytes = 0;
+    bool m_failed = false;
+    // Write mode
+    bool m_writing = false;
+    QByteArray m_pending;
+    qint64 m_written = 0;
+    qint64 m_flushed = 0;
+    std::unique_ptr<QTemporaryFile> m_staging;
+    QList<FileChunk> m_staged; // data left empty, the payloads follow each other in m_staging
+    QList<qint64> m_stagedSizes;
+};
+
+#endif // VFSFILE_H
@@ -10,12 +10,20 @@
 #include <QByteArray>
 #include <QList>
 #include <QDateTime>
+#include <QIODevice>
+#include <QTimer>
+#include <functional>
 #include "DatabaseManager.h"
 #include "EncryptionManager.h"
 #include "CompressionManager.h"
 
+class VFSFile;
+class ImportPipeline;
+
 class VFSManager : public QObject {
     Q_OBJECT
+    friend class VFSFile;
+    friend class ImportPipeline;
 
 public:
     static VFSManager& instance();
@@ -29,21 +37,45 @@ public:
     // File operations
     bool createFile(const QString &filename, const QString &path, const QByteArray &content,
                     bool encrypt = false, bool compress = false);
+    // Streams the source into chunked storage; memory use is bounded by one chunk
+    bool createFile(const QString &filename, const QString &path, QIODevice &source,
+                    bool encrypt = false, bool compress = false);
     bool updateFile(int fileId, const QByteArray &content);
     bool deleteFile(int fileId);
-    bool getFileContent(int fileId, QByteArray &content);
+    // Rename/move change metadata rows only; content is never re-read or re-encrypted
+    bool renameFile(int fileId, const QString &newName);
+    bool moveFile(int fileId, const QString &destPath);
+    // Copies share the stored content: metadata rows only, copy-on-write on later updates
+    bool copyFile(int fileId, const QString &destPath);
+    bool getFileContent(int fileId, QByteArray &content); // whole file; prefer VFSFile for partial reads
     QList<FileRecord> getFilesInDirectory(const QString &path);
-    QList<FileRecord> searchFiles(const QString &query);
+    QList<FileRecord> searchFiles(const QString &query, int limit = DatabaseManager::DEFAULT_SEARCH_LIMIT);
+    // Metadata-only variants for listings (no content blobs are loaded)
+    bool getFileMeta(int fileId, FileMeta &meta);
+    QList<FileMeta> listDirectory(const QString &path);
+    QList<FileMeta> searchFileMeta(const QString &query, int limit = DatabaseManager::DEFAULT_SEARCH_LIMIT); // ranked
 
     // Directory operations
     bool createDirectory(const QString &name, const QString &path);
-    bool deleteDirectory(int dirId);
+    bool deleteDirectory(int dirId); // recursive; freed chunks are reclaimed in the background
+    bool renameDirectory(int dirId, const QString &newName);
+    bool moveDirectory(int dirId, const QString &destPath); // with everything below it
+    bool copyDirectory(int dirId, const QString &destPath);
     QList<DirectoryRecord> getDirectoriesInPath(const QString &path);
+    bool findDirectory(const QString &path, int &dirId); // "/" is 0; false if any component is missing
+    bool getDirectoryStats(int dirId, UserStats &stats); // totals for the whole subtree
 
     // File import/export
     bool importFile(const QString &localPath, const QString &vfsPath, bool encrypt = false, bool compress = false);
     bool exportFile(int fileId, const QString &localPath);
+    // Content as stored (still encrypted/compressed): a single-blob row as that blob,
+    // chunked content as an SVFSRAW1 container of its chunks (format in readme.md)
+    bool exportRawFile(int fileId, const QString &localPath);
     bool reprocessFile(int fileId, bool encrypt, bool compress); // reapply enc/comp settings
+    // Raw stored bytes (inline blob or each chunk in order); return false from consumer to stop early
+    bool readStoredBlocks(int fileId, const std::function<bool(const QByteArray &block)> &consumer);
+    // First maxBytes of the first stored block, e.g. for EncryptionManager::probeHeader()
+    bool readStoredPrefix(int fileId, int maxBytes, QByteArray &prefix);
 
     // Preferences: defaults
     void setDefaultEncryptionAlgorithm(EncryptionManager::EncryptionAlgorithm alg) { m_defaultEncAlg = alg; }
@@ -52,8 +84,15 @@ public:
     EncryptionManager::EncryptionAlgorithm defaultEncryptionAlgorithm() const { return m_defaultEncAlg; }
     CompressionManager::CompressionAlgorithm defaultCompressionAlgorithm() const { return m_defaultCompAlg; }
     int compressionLevel() const { return m_compLevel; }
+    // Per vault: where new content payloads are stored (see BlobStore)
+    bool setBlobStore(BlobStore::Kind kind) { return DatabaseManager::instance().setBlobStore(kind); }
+    BlobStore::Kind blobStoreKind() const { return DatabaseManager::instance().blobStoreKind(); }
+    // Per vault: files up to this size keep their content in the files row (0: always chunked)
+    bool setInlineThreshold(qint64 bytes) { return DatabaseManager::instance().setInlineThreshold(bytes); }
+    qint64 inlineThreshold() const { return DatabaseManager::instance().inlineThreshold(); }
 
     // Statistics
+    bool getUserStats(UserStats &stats); // all totals for the current user in one read
     qint64 getTotalStorageUsed();
     int getFileCount();
     int getDirectoryCount();
@@ -68,6 +107,7 @@ signals:
     void fileUpdated(int fileId);
     void directoryCreated(int dirId, const QString &name);
     void directoryDeleted(int dirId);
+    void directoryUpdated(int dirId);
 
 private:
     VFSManager();
@@ -80,10 +120,31 @@ private:
     EncryptionManager::EncryptionAlgorithm m_defaultEncAlg = EncryptionManager::AES_256_GCM;
     CompressionManager::CompressionAlgorithm m_defaultCompAlg = CompressionManager::ZLIB;
     int m_compLevel = 6;
+    QTimer m_chunkCollector;
 
     QString getMimeType(const QString &filename);
-    QByteArray processContent(const QByteArray &content, bool encrypt, bool compress);
+    void scheduleChunkCollection();
+    void collectChunks(); // one batch; re-arms itself while there is more
+    QString availableName(int dirId, const QString &name); // name, or a numbered "(copy)" variant that is free
+    FileRecord newFileRecord(const QString &filename, const QString &path, bool encrypt, bool compress); // empty chunked row
+    void inlineFileRecord(FileRecord &file, const QByteArray &stored, qint64 size, const QByteArray &checksum); // makes it an inline one
+    bool takeInlineContent(QIODevice &source, QByteArray &content); // the rest of source, if within the inline threshold
+    // Algorithms and level new content is processed with; jobs running on worker threads take a
+    // copy up front, so a settings change meanwhile can neither race them nor mix two settings
+    struct Processing { EncryptionManager::EncryptionAlgorithm encryption; CompressionManager::CompressionAlgorithm compression; int level; };
+    Processing processing() const { return {m_defaultEncAlg, m_defaultCompAlg, m_compLevel}; }
+    QByteArray processContent(const QByteArray &content, bool encrypt, bool compress) { return processContent(content, encrypt, compress, processing()); }
+    QByteArray processContent(const QByteArray &content, bool encrypt, bool compress, const Processing &settings);
+    // The two halves of processContent(); safe to call from worker threads
+    QByteArray compressContent(const QByteArray &content, const Processing &settings);
+    QByteArray encryptContent(const QByteArray &content, bool compressed, const Processing &settings);
     QByteArray unprocessContent(const QByteArray &processedContent, bool isEncrypted, bool isCompressed);
+    QByteArray chunkKey(const QByteArray &plain, bool encrypt, bool compress) const { return chunkKey(plain, encrypt, compress, processing()); }
+    QByteArray chunkKey(const QByteArray &plain, bool encrypt, bool compress, const Processing &settings) const;
+    bool storeChunk(int fileId, FileChunk &chunk, const QByteArray &plain, bool encrypt, bool compress);
+    bool storeChunks(int fileId, QIODevice &source, bool encrypt, bool compress, qint64 &size, QByteArray &checksum, int &chunkCount);
+    bool rewriteContent(const FileMeta &file, QIODevice &source, bool encrypt, bool compress);
+    bool forEachPlainChunk(const FileMeta &file, const std::function<bool(const QByteArray &plain)> &consumer);
 };
 
 #endif // VFSMANAGER_H
\ No newline at end of file
@@ -10,6 +10,7 @@ class QLabel;
 class QProgressBar;
 class QAction;
 class FileSystemScanner;
+class ImportPipeline;
 class QTreeWidgetItem;
 template <typename K, typename V> class QHash;
 
@@ -89,9 +90,12 @@ private:
     FileSystemScanner *m_scanner = nullptr;
     QAction *m_scanAction = nullptr;
     QAction *m_cancelScanAction = nullptr;
+    QAction *m_compactStorageAction = nullptr; // disabled while an import runs
+    ImportPipeline *m_importPipeline = nullptr; // running import, if any
     
     // Clipboard for copy/paste
-    int m_clipboardFileId = -1;
+    int m_clipboardFileId = -1; // file or directory id
+    bool m_clipboardIsDirectory = false;
     bool m_cutMode = false;
 
     // System scan helpers
@@ -0,0 +1,82 @@
+#include "BatchWriter.h"
+#include <QDebug>
+
+BatchWriter::BatchWriter(QObject *parent, int maxRows, int maxDelayMs)
+    : QObject(parent), m_maxRows(qMax(1, maxRows)) {
+    m_timer.setSingleShot(true);
+    m_timer.setInterval(qMax(0, maxDelayMs));
+    connect(&m_timer, &QTimer::timeout, this, [this] { flush(); });
+}
+
+BatchWriter::~BatchWriter() {
+    flush();
+}
+
+bool BatchWriter::createFile(FileRecord &file) {
+    return write([&] { return DatabaseManager::instance().createFile(file); });
+}
+
+bool BatchWriter::updateFile(const FileRecord &file) {
+    return write([&] { return DatabaseManager::instance().updateFile(file); });
+}
+
+bool BatchWriter::deleteFile(int fileId) {
+    m_collectChunks = true;
+    return write([&] { return DatabaseManager::instance().deleteFile(fileId, false); });
+}
+
+bool BatchWriter::write(const std::function<bool()> &work, int rows) {
+    DatabaseManager &db = DatabaseManager::instance();
+    if (!open() || !db.beginTransaction()) {
+        return false;
+    }
+    bool ok = work();
+    if (ok) {
+        ok = db.commitTransaction();
+    } else {
+        db.rollbackTransaction();
+    }
+    m_pendingRows += rows;
+    if (m_pendingRows >= m_maxRows) {
+        ok = flush() && ok;
+    }
+    return ok;
+}
+
+bool BatchWriter::open() {
+    if (m_open) {
+        return true;
+    }
+    if (!DatabaseManager::instance().beginTransaction()) {
+        return false;
+    }
+    // The delay counts from the first write, so a trickle of rows still commits promptly
+    m_open = true;
+    m_timer.start();
+    return true;
+}
+
+bool BatchWriter::flush() {
+    if (!m_open) {
+        return true;
+    }
+    DatabaseManager &db = DatabaseManager::instance();
+    m_timer.stop();
+    m_open = false;
+    const bool collected = !m_collectChunks || db.collectUnreferencedChunks() >= 0;
+    m_collectChunks = false;
+    bool committed = false;
+    if (collected) {
+        committed = db.commitTransaction();
+    } else {
+        db.rollbackTransaction();
+    }
+
+    const int rows = m_pendingRows;
+    m_pendingRows = 0;
+    if (!committed) {
+        qWarning() << "BatchWriter: Batch of" << rows << "row(s) rolled back";
+    }
+    emit flushed(rows, committed);
+    return committed;
+}
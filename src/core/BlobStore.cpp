@@ -0,0 +1,229 @@
+#include "BlobStore.h"
+#include <QSqlQuery>
+#include <QSqlDriver>
+#include <QSqlError>
+#include <QDebug>
+#include "DatabaseManager.h"
+#include "PackStore.h"
+#ifdef HAVE_SQLITE3
+#include <sqlite3.h>
+#endif
+
+// Implementations are friends of DatabaseManager: they run its cached statements on
+// the calling thread's connection
+
+class InlineBlobStore : public BlobStore {
+public:
+    Kind kind() const override { return Inline; }
+
+    bool insert(const QByteArray &hash, qint64 plainSize, const QByteArray &data) override {
+        DatabaseManager::Statement query = DatabaseManager::instance().statement(
+            "INSERT INTO chunk_store (hash, plain_size, data, ref_count) VALUES (?, ?, ?, 1)");
+        query->bindValue(0, hash);
+        query->bindValue(1, plainSize);
+        query->bindValue(2, data);
+        return query->exec();
+    }
+
+    bool read(qint64 chunkId, QByteArray &data, qint64 maxBytes) override {
+        // substr() trims inside SQLite, only the prefix is handed back
+        DatabaseManager::Statement query = DatabaseManager::instance().statement(maxBytes < 0
+            ? QString("SELECT data FROM chunk_store WHERE id = ?")
+            : QString("SELECT substr(data, 1, ?2) FROM chunk_store WHERE id = ?1"));
+        query->bindValue(0, chunkId);
+        if (maxBytes >= 0) {
+            query->bindValue(1, maxBytes);
+        }
+        if (!query->exec() || !query->next()) {
+            return false;
+        }
+        data = query->value(0).toByteArray();
+        return true;
+    }
+};
+
+class IncrementalBlobStore : public BlobStore {
+public:
+    Kind kind() const override { return Incremental; }
+    bool isAvailable() const override { return BlobStream::isAvailable(); }
+
+    bool insert(const QByteArray &hash, qint64 plainSize, const QByteArray &data) override {
+        // The row reserves the space, the payload is written into it without a bound copy
+        DatabaseManager::Statement query = DatabaseManager::instance().statement(
+            "INSERT INTO chunk_store (hash, plain_size, data, ref_count) VALUES (?, ?, zeroblob(?), 1)");
+        query->bindValue(0, hash);
+        query->bindValue(1, plainSize);
+        query->bindValue(2, qint64(data.size()));
+        if (!query->exec()) {
+            return false;
+        }
+        BlobStream stream;
+        return stream.open("chunk_store", "data", query->lastInsertId().toLongLong(), true) && stream.write(0, data);
+    }
+
+    bool read(qint64 chunkId, QByteArray &data, qint64 maxBytes) override {
+        // Straight into the result buffer, no QVariant in between
+        BlobStream stream;
+        return stream.open("chunk_store", "data", chunkId, false) &&
+               stream.read(0, maxBytes < 0 ? stream.size() : maxBytes, data);
+    }
+};
+
+class PackBlobStore : public BlobStore {
+public:
+    explicit PackBlobStore(PackStore &packs) : m_packs(packs) {}
+    Kind kind() const override { return Pack; }
+    bool isAvailable() const override { return m_packs.isOpen(); }
+
+    bool insert(const QByteArray &hash, qint64 plainSize, const QByteArray &data) override {
+        // Appended before the row exists: a rollback leaves only unreferenced pack bytes
+        PackLocation location;
+        if (!m_packs.append(data, location)) {
+            return false;
+        }
+        DatabaseManager::Statement query = DatabaseManager::instance().statement(R"(
+            INSERT INTO chunk_store (hash, plain_size, data, ref_count, pack_id, pack_offset, pack_length, pack_checksum)
+            VALUES (?, ?, X'', 1, ?, ?, ?, ?)
+        )");
+        query->bindValue(0, hash);
+        query->bindValue(1, plainSize);
+        query->bindValue(2, location.packId);
+        query->bindValue(3, location.offset);
+        query->bindValue(4, location.length);
+        query->bindValue(5, qint64(location.checksum));
+        return query->exec();
+    }
+
+    bool read(qint64 chunkId, QByteArray &data, qint64 maxBytes) override {
+        PackLocation location;
+        {
+            DatabaseManager::Statement query = DatabaseManager::instance().statement(
+                "SELECT pack_id, pack_offset, pack_length, pack_checksum FROM chunk_store WHERE id = ? AND pack_id IS NOT NULL");
+            query->bindValue(0, chunkId);
+            if (!query->exec() || !query->next()) {
+                return false;
+            }
+            location.packId = query->value(0).toInt();
+            location.offset = query->value(1).toLongLong();
+            location.length = query->value(2).toLongLong();
+            location.checksum = quint64(query->value(3).toLongLong());
+        }
+        // The whole record is verified either way; the mapping makes that cheap
+        if (!m_packs.read(location, data)) {
+            return false;
+        }
+        if (maxBytes >= 0 && maxBytes < data.size()) {
+            data.truncate(maxBytes);
+        }
+        return true;
+    }
+
+private:
+    PackStore &m_packs;
+};
+
+std::unique_ptr<BlobStore> BlobStore::create(Kind kind, PackStore &packs) {
+    switch (kind) {
+        case Incremental: return std::make_unique<IncrementalBlobStore>();
+        case Pack: return std::make_unique<PackBlobStore>(packs);
+        default: return std::make_unique<InlineBlobStore>();
+    }
+}
+
+QString BlobStore::kindName(Kind kind) {
+    switch (kind) {
+        case Incremental: return "incremental";
+        case Pack: return "pack";
+        default: return "inline";
+    }
+}
+
+bool BlobStore::kindFromName(const QString &name, Kind &kind) {
+    for (Kind candidate : {Inline, Incremental, Pack}) {
+        if (kindName(candidate) == name) {
+            kind = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+#ifdef HAVE_SQLITE3
+namespace {
+    // The QSQLITE driver's own handle for this thread's connection. Qt must use the same
+    // SQLite library as this build (-system-sqlite), or the handle belongs to another copy.
+    sqlite3* connectionHandle(QSqlDatabase database) {
+        const QVariant native = database.isValid() ? database.driver()->handle() : QVariant();
+        if (!native.isValid() || qstrcmp(native.typeName(), "sqlite3*") != 0) {
+            return nullptr;
+        }
+        return *static_cast<sqlite3 * const *>(native.constData());
+    }
+}
+
+bool BlobStream::isAvailable() {
+    return true;
+}
+
+bool BlobStream::open(const char *table, const char *column, qint64 rowId, bool writable) {
+    close();
+    sqlite3 *connection = connectionHandle(DatabaseManager::instance().readConnection());
+    if (!connection) {
+        qWarning() << "BlobStream: No native SQLite handle";
+        return false;
+    }
+    sqlite3_blob *blob = nullptr;
+    if (sqlite3_blob_open(connection, "main", table, column, rowId, writable ? 1 : 0, &blob) != SQLITE_OK) {
+        // Also the answer for a NULL cell, which callers may treat as empty
+        qDebug() << "BlobStream: Cannot open" << table << column << rowId << ":" << sqlite3_errmsg(connection);
+        sqlite3_blob_close(blob);
+        return false;
+    }
+    m_blob = blob;
+    return true;
+}
+
+void BlobStream::close() {
+    if (m_blob) {
+        sqlite3_blob_close(static_cast<sqlite3_blob*>(m_blob));
+        m_blob = nullptr;
+    }
+}
+
+qint64 BlobStream::size() const {
+    return m_blob ? sqlite3_blob_bytes(static_cast<sqlite3_blob*>(m_blob)) : 0;
+}
+
+bool BlobStream::read(qint64 offset, qint64 length, QByteArray &data) {
+    data.clear();
+    if (!m_blob || offset < 0 || length < 0 || offset > size()) {
+        return false;
+    }
+    length = qMin(length, size() - offset);
+    data = QByteArray(length, Qt::Uninitialized);
+    if (sqlite3_blob_read(static_cast<sqlite3_blob*>(m_blob), data.data(), int(length), int(offset)) != SQLITE_OK) {
+        data.clear();
+        return false;
+    }
+    return true;
+}
+
+bool BlobStream::write(qint64 offset, const QByteArray &data) {
+    // Never grows the value: the space must have been reserved with zeroblob()
+    if (!m_blob || offset < 0 || offset + data.size() > size()) {
+        return false;
+    }
+    return sqlite3_blob_write(static_cast<sqlite3_blob*>(m_blob), data.constData(), int(data.size()), int(offset)) == SQLITE_OK;
+}
+#else
+bool BlobStream::isAvailable() { return false; }
+bool BlobStream::open(const char *, const char *, qint64, bool) { return false; }
+void BlobStream::close() {}
+qint64 BlobStream::size() const { return 0; }
+bool BlobStream::read(qint64, qint64, QByteArray &data) { data.clear(); return false; }
+bool BlobStream::write(qint64, const QByteArray &) { return false; }
+#endif
+
+BlobStream::~BlobStream() {
+    close();
+}
@@ -2,19 +2,92 @@
 // Created by siddh on 31-08-2025.
 //
 #include "CompressionManager.h"
+#include "CompressionStream.h"
 #include <QDebug>
 #include <QFile>
 #include <QIODevice>
 #include <QDataStream>
 #include <QBuffer>
+#include <QtEndian>
+#include <cstring>
 
-#ifdef HAVE_LZ4
-#include <lz4.h>
-#include <lz4frame.h>
-#endif
-#ifdef HAVE_ZSTD
-#include <zstd.h>
-#endif
+namespace {
+    // compressFile()/decompressFile() stream the input in blocks of this size
+    constexpr qint64 FILE_BLOCK_SIZE = 1024 * 1024;
+
+    // Frame header (16 bytes), followed by the compress() payload:
+    //   magic "SVCF" | version | algorithm (0=zlib,1=lz4,2=zstd) | level (int8) | reserved | originalSize (8, LE)
+    constexpr const char* FRAME_MAGIC = "SVCF";
+    constexpr unsigned char FRAME_VERSION = 1;
+
+    unsigned char frameCode(CompressionManager::CompressionAlgorithm algorithm) {
+        switch (algorithm) {
+            case CompressionManager::LZ4: return 1;
+            case CompressionManager::ZSTD: return 2;
+            default: return 0;
+        }
+    }
+
+    // Most a payload of the given size can expand to, from each codec's worst case (a zstd RLE
+    // block is 4 bytes for 128 KiB); a frame declaring more is corrupt, not just very compressible
+    qint64 maxExpansion(CompressionManager::CompressionAlgorithm algorithm, qint64 payloadSize) {
+        const qint64 ratio = algorithm == CompressionManager::ZSTD ? 32768 : algorithm == CompressionManager::LZ4 ? 256 : 1032;
+        return (payloadSize + 64) * ratio;
+    }
+
+    // Unframed payloads written before frames existed still carry their codec's own magic, if any
+    CompressionManager::CompressionAlgorithm sniffAlgorithm(const QByteArray &data, CompressionManager::CompressionAlgorithm fallback) {
+        if (data.startsWith(QByteArray::fromHex("04224d18"))) return CompressionManager::LZ4;
+        if (data.startsWith(QByteArray::fromHex("28b52ffd"))) return CompressionManager::ZSTD;
+        return fallback;
+    }
+
+    QByteArray runStream(CompressionStream::Direction direction, const QByteArray &data,
+                         CompressionManager::CompressionAlgorithm algorithm, int level, qint64 sizeHint) {
+        CompressionStream stream(direction, algorithm, level);
+        stream.setSizeHint(sizeHint);
+        if (!stream.push(data) || !stream.finish()) {
+            return QByteArray();
+        }
+        return stream.takeOutput();
+    }
+
+    bool pumpFile(const QString &inputPath, const QString &outputPath, CompressionStream &stream, bool setSizeHint) {
+        QFile inputFile(inputPath);
+        if (!inputFile.open(QIODevice::ReadOnly)) {
+            return false;
+        }
+        QFile outputFile(outputPath);
+        if (!outputFile.open(QIODevice::WriteOnly)) {
+            return false;
+        }
+        if (setSizeHint) {
+            // A file that changes size while it is read fails in finish() instead of
+            // leaving a frame whose header declares the wrong size
+            stream.setSizeHint(inputFile.size());
+        }
+        
+        // Only one input block and the output it produced are held at a time
+        bool ok = true;
+        while (ok && !inputFile.atEnd()) {
+            const QByteArray block = inputFile.read(FILE_BLOCK_SIZE);
+            ok = !block.isEmpty() && stream.push(block);
+            const QByteArray produced = stream.takeOutput();
+            ok = ok && outputFile.write(produced) == produced.size();
+        }
+        if (ok) {
+            ok = stream.finish();
+            const QByteArray produced = stream.takeOutput();
+            ok = ok && outputFile.write(produced) == produced.size();
+        }
+        
+        outputFile.close();
+        if (!ok) {
+            outputFile.remove();
+        }
+        return ok;
+    }
+}
 
 CompressionManager& CompressionManager::instance() {
     static CompressionManager instance;
@@ -28,39 +101,10 @@ QByteArray CompressionManager::compress(const QByteArray &data, CompressionAlgor
         case GZIP:
             return compressGzip(data, level);
         case LZ4:
-        {
-#ifdef HAVE_LZ4
-            if (!data.isEmpty()) {
-                // Use LZ4 frame API to embed size for robust decode
-                LZ4F_preferences_t prefs{};
-                prefs.compressionLevel = level;
-                size_t bound = LZ4F_compressFrameBound(static_cast<size_t>(data.size()), &prefs);
-                QByteArray out;
-                out.resize(static_cast<int>(bound));
-                size_t written = LZ4F_compressFrame(out.data(), bound, data.constData(), static_cast<size_t>(data.size()), &prefs);
-                if (LZ4F_isError(written)) return QByteArray();
-                out.resize(static_cast<int>(written));
-                return out;
-            }
-#endif
-            return compressZlib(data, level);
-        }
         case ZSTD:
-        {
-#ifdef HAVE_ZSTD
-            if (!data.isEmpty()) {
-                int lvl = qBound(1, level, 22);
-                size_t bound = ZSTD_compressBound(static_cast<size_t>(data.size()));
-                QByteArray out;
-                out.resize(static_cast<int>(bound));
-                size_t written = ZSTD_compress(out.data(), bound, data.constData(), static_cast<size_t>(data.size()), lvl);
-                if (ZSTD_isError(written)) return QByteArray();
-                out.resize(static_cast<int>(written));
-                return out;
-            }
-#endif
-            return compressZlib(data, level);
-        }
+            // Through CompressionStream so the per-thread codec contexts are reused
+            return data.isEmpty() ? QByteArray()
+                                  : runStream(CompressionStream::Compress, data, algorithm, level, data.size());
         default:
             return compressZlib(data, level);
     }
@@ -73,66 +117,91 @@ QByteArray CompressionManager::decompress(const QByteArray &compressedData, Comp
         case GZIP:
             return decompressGzip(compressedData);
         case LZ4:
-        {
-#ifdef HAVE_LZ4
-            if (compressedData.isEmpty()) return QByteArray();
-            LZ4F_decompressionContext_t dctx;
-            if (LZ4F_isError(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION))) return QByteArray();
-            QByteArray out; out.reserve(compressedData.size() * 3); // heuristic
-            const char *src = compressedData.constData();
-            size_t srcSize = static_cast<size_t>(compressedData.size());
-            size_t srcPos = 0;
-            char buf[64 * 1024];
-            while (srcPos < srcSize) {
-                size_t inSize = srcSize - srcPos;
-                size_t outSize = sizeof(buf);
-                size_t ret = LZ4F_decompress(dctx, buf, &outSize, src + srcPos, &inSize, nullptr);
-                if (LZ4F_isError(ret)) { LZ4F_freeDecompressionContext(dctx); return QByteArray(); }
-                srcPos += inSize;
-                if (outSize > 0) out.append(buf, static_cast<int>(outSize));
-                if (ret == 0) break; // done
-            }
-            LZ4F_freeDecompressionContext(dctx);
-            return out;
-#else
+        case ZSTD:
+            return compressedData.isEmpty() ? QByteArray()
+                                            : runStream(CompressionStream::Decompress, compressedData, algorithm, 0, -1);
+        default:
             return decompressZlib(compressedData);
+    }
+}
+
+QByteArray CompressionManager::compressFramed(const QByteArray &data, CompressionAlgorithm algorithm, int level) {
+    const CompressionAlgorithm used = resolveAlgorithm(algorithm);
+    const QByteArray payload = compress(data, used, level);
+    if (payload.isEmpty() && !data.isEmpty()) {
+        return QByteArray();
+    }
+    
+    QByteArray framed(FRAME_HEADER_SIZE + payload.size(), Qt::Uninitialized);
+    char *p = framed.data();
+    std::memcpy(p, FRAME_MAGIC, 4);
+    p[4] = char(FRAME_VERSION);
+    p[5] = char(frameCode(used));
+    p[6] = char(qBound(-128, level, 127));
+    p[7] = 0;
+    qToLittleEndian<qint64>(data.size(), p + 8);
+    std::memcpy(p + FRAME_HEADER_SIZE, payload.constData(), size_t(payload.size()));
+    return framed;
+}
+
+bool CompressionManager::readFrameHeader(const QByteArray &data, FrameInfo &info) const {
+    if (data.size() < FRAME_HEADER_SIZE || std::memcmp(data.constData(), FRAME_MAGIC, 4) != 0 ||
+        static_cast<unsigned char>(data[4]) != FRAME_VERSION) {
+        return false;
+    }
+    switch (static_cast<unsigned char>(data[5])) {
+        case 0: info.algorithm = ZLIB; break;
+        case 1: info.algorithm = LZ4; break;
+        case 2: info.algorithm = ZSTD; break;
+        default: return false;
+    }
+    info.level = static_cast<signed char>(data[6]);
+    info.originalSize = qFromLittleEndian<qint64>(data.constData() + 8);
+    return info.originalSize >= 0;
+}
+
+bool CompressionManager::decompressFramed(const QByteArray &data, QByteArray &decompressed, CompressionAlgorithm legacyAlgorithm) {
+    decompressed.clear();
+    FrameInfo info;
+    if (!readFrameHeader(data, info)) {
+        decompressed = decompress(data, sniffAlgorithm(data, legacyAlgorithm));
+        return !decompressed.isEmpty() || data.isEmpty();
+    }
+    if (info.originalSize == 0) {
+        return true;
+    }
+    if (resolveAlgorithm(info.algorithm) != info.algorithm) {
+        qWarning() << "CompressionManager: frame uses" << getAlgorithmName(info.algorithm) << "which is not built in";
+        return false;
+    }
+    
+    const qint64 payloadSize = data.size() - FRAME_HEADER_SIZE;
+    if (info.originalSize > maxExpansion(info.algorithm, payloadSize)) {
+        qWarning() << "CompressionManager: frame declares" << info.originalSize << "bytes for a"
+                   << payloadSize << "byte payload";
+        return false;
+    }
+
+    // The exact size is known: allocate once and let the codec write in place
+    decompressed.resize(info.originalSize);
+    const qint64 written = CompressionStream::decompressInto(info.algorithm, data.constData() + FRAME_HEADER_SIZE,
+                                                             payloadSize, decompressed.data(), info.originalSize);
+    if (written != info.originalSize) {
+        decompressed.clear();
+        return false;
+    }
+    return true;
+}
+
+CompressionManager::CompressionAlgorithm CompressionManager::resolveAlgorithm(CompressionAlgorithm algorithm) const {
+    switch (algorithm) {
+#ifdef HAVE_LZ4
+        case LZ4: return LZ4;
 #endif
-        }
-        case ZSTD:
-        {
 #ifdef HAVE_ZSTD
-            if (compressedData.isEmpty()) return QByteArray();
-            size_t contentSize = ZSTD_getFrameContentSize(compressedData.constData(), static_cast<size_t>(compressedData.size()));
-            if (contentSize == ZSTD_CONTENTSIZE_ERROR) return QByteArray();
-            if (contentSize == ZSTD_CONTENTSIZE_UNKNOWN) {
-                // Fallback to streaming
-                ZSTD_DStream *dstream = ZSTD_createDStream();
-                if (!dstream) return QByteArray();
-                size_t initRes = ZSTD_initDStream(dstream);
-                if (ZSTD_isError(initRes)) { ZSTD_freeDStream(dstream); return QByteArray(); }
-                QByteArray out; out.reserve(compressedData.size() * 3);
-                ZSTD_inBuffer in = { compressedData.constData(), static_cast<size_t>(compressedData.size()), 0 };
-                QByteArray chunk; chunk.resize(64 * 1024);
-                while (in.pos < in.size) {
-                    ZSTD_outBuffer outBuf = { chunk.data(), static_cast<size_t>(chunk.size()), 0 };
-                    size_t res = ZSTD_decompressStream(dstream, &outBuf, &in);
-                    if (ZSTD_isError(res)) { ZSTD_freeDStream(dstream); return QByteArray(); }
-                    if (outBuf.pos > 0) out.append(chunk.constData(), static_cast<int>(outBuf.pos));
-                }
-                ZSTD_freeDStream(dstream);
-                return out;
-            } else {
-                QByteArray out; out.resize(static_cast<int>(contentSize));
-                size_t res = ZSTD_decompress(out.data(), contentSize, compressedData.constData(), static_cast<size_t>(compressedData.size()));
-                if (ZSTD_isError(res)) return QByteArray();
-                return out;
-            }
-#else
-            return decompressZlib(compressedData);
+        case ZSTD: return ZSTD;
 #endif
-        }
-        default:
-            return decompressZlib(compressedData);
+        default: return ZLIB;
     }
 }
 
@@ -161,53 +230,13 @@ QByteArray CompressionManager::decompressGzip(const QByteArray &compressedData)
 }
 
 bool CompressionManager::compressFile(const QString &inputPath, const QString &outputPath, CompressionAlgorithm algorithm, int level) {
-    QFile inputFile(inputPath);
-    if (!inputFile.open(QIODevice::ReadOnly)) {
-        return false;
-    }
-    
-    QByteArray data = inputFile.readAll();
-    inputFile.close();
-    
-    QByteArray compressedData = compress(data, algorithm, level);
-    if (compressedData.isEmpty()) {
-        return false;
-    }
-    
-    QFile outputFile(outputPath);
-    if (!outputFile.open(QIODevice::WriteOnly)) {
-        return false;
-    }
-    
-    qint64 bytesWritten = outputFile.write(compressedData);
-    outputFile.close();
-    
-    return bytesWritten == compressedData.size();
+    CompressionStream stream(CompressionStream::Compress, algorithm, level);
+    return pumpFile(inputPath, outputPath, stream, true);
 }
 
 bool CompressionManager::decompressFile(const QString &inputPath, const QString &outputPath, CompressionAlgorithm algorithm) {
-    QFile inputFile(inputPath);
-    if (!inputFile.open(QIODevice::ReadOnly)) {
-        return false;
-    }
-    
-    QByteArray compressedData = inputFile.readAll();
-    inputFile.close();
-    
-    QByteArray decompressedData = decompress(compressedData, algorithm);
-    if (decompressedData.isEmpty()) {
-        return false;
-    }
-    
-    QFile outputFile(outputPath);
-    if (!outputFile.open(QIODevice::WriteOnly)) {
-        return false;
-    }
-    
-    qint64 bytesWritten = outputFile.write(decompressedData);
-    outputFile.close();
-    
-    return bytesWritten == decompressedData.size();
+    CompressionStream stream(CompressionStream::Decompress, algorithm);
+    return pumpFile(inputPath, outputPath, stream, false);
 }
 
 double CompressionManager::getCompressionRatio(const QByteArray &original, const QByteArray &compressed) {
@@ -0,0 +1,412 @@
+#include "CompressionStream.h"
+#include <QDebug>
+#include <QtEndian>
+#include <cstring>
+#include <utility>
+
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace {
+    // push() hands input to the codec in slices of this size
+    constexpr qint64 PUSH_SLICE = 1024 * 1024;
+    // Output grows by this much per codec call where the library has no preferred size
+    constexpr qint64 OUTPUT_STEP = 64 * 1024;
+    // Upper bound for reserving output up front from a size recorded in the (untrusted) frame header
+    constexpr qint64 MAX_RESERVE = 64 * 1024 * 1024;
+    constexpr int ZLIB_SIZE_PREFIX = 4;
+
+    // One idle context of each kind per thread. Streams borrow it and give it back when
+    // done, so nested or interleaved streams on the same thread never share a context.
+    struct ThreadContexts {
+#ifdef HAVE_ZSTD
+        ZSTD_CCtx *zstdCompress = nullptr; ZSTD_DCtx *zstdDecompress = nullptr;
+#endif
+#ifdef HAVE_LZ4
+        LZ4F_cctx *lz4Compress = nullptr; LZ4F_dctx *lz4Decompress = nullptr;
+#endif
+        ~ThreadContexts() {
+#ifdef HAVE_ZSTD
+            ZSTD_freeCCtx(zstdCompress);
+            ZSTD_freeDCtx(zstdDecompress);
+#endif
+#ifdef HAVE_LZ4
+            if (lz4Compress) LZ4F_freeCompressionContext(lz4Compress);
+            if (lz4Decompress) LZ4F_freeDecompressionContext(lz4Decompress);
+#endif
+        }
+    };
+    thread_local ThreadContexts t_contexts;
+
+    template <typename Ctx> Ctx* borrow(Ctx *&slot) {
+        Ctx *ctx = slot;
+        slot = nullptr;
+        return ctx;
+    }
+
+    template <typename Ctx, typename Free> void giveBack(Ctx *&slot, Ctx *&ctx, Free release) {
+        if (!ctx) return;
+        if (slot) release(ctx);
+        else slot = ctx;
+        ctx = nullptr;
+    }
+
+#ifdef HAVE_LZ4
+    LZ4F_preferences_t lz4Preferences(int level, qint64 sizeHint) {
+        LZ4F_preferences_t prefs{};
+        prefs.compressionLevel = level;
+        if (sizeHint > 0) prefs.frameInfo.contentSize = static_cast<unsigned long long>(sizeHint);
+        return prefs;
+    }
+#endif
+}
+
+CompressionStream::CompressionStream(Direction direction, CompressionManager::CompressionAlgorithm algorithm, int level)
+    : m_direction(direction), m_algorithm(algorithm), m_level(level) {
+    // Same fallbacks as CompressionManager: GZIP and unavailable codecs use the zlib format
+    m_algorithm = CompressionManager::instance().resolveAlgorithm(algorithm);
+}
+
+CompressionStream::~CompressionStream() {
+    releaseContexts();
+}
+
+void CompressionStream::setSizeHint(qint64 size) {
+    m_sizeHint = size;
+}
+
+bool CompressionStream::push(const char *data, qint64 size) {
+    if (m_failed || m_finished) {
+        return false;
+    }
+    if (!m_started && !start()) {
+        m_failed = true;
+        return false;
+    }
+    for (qint64 pos = 0; pos < size; pos += PUSH_SLICE) {
+        const qint64 slice = qMin(PUSH_SLICE, size - pos);
+        const bool ok = m_direction == Compress ? compressData(data + pos, slice, false)
+                                                : decompressData(data + pos, slice);
+        if (!ok) {
+            m_failed = true;
+            releaseContexts();
+            return false;
+        }
+        m_pushed += slice;
+    }
+    return true;
+}
+
+bool CompressionStream::finish() {
+    if (m_failed) {
+        return false;
+    }
+    if (m_finished) {
+        return true;
+    }
+    if (!m_started && !start()) {
+        m_failed = true;
+        return false;
+    }
+
+    bool ok = true;
+    if (m_direction == Compress && m_sizeHint >= 0 && m_pushed != m_sizeHint) {
+        // The frame header already declared m_sizeHint bytes (zlib's size prefix, zstd's
+        // pledged size, LZ4's content size): the input changed size while it was read
+        qDebug() << "Compression stream input was" << m_pushed << "bytes, not the" << m_sizeHint << "announced";
+        ok = false;
+    } else if (m_direction == Compress) {
+        ok = compressData(nullptr, 0, true);
+#ifndef HAVE_ZLIB
+    } else if (m_algorithm == CompressionManager::ZLIB) {
+        // The whole frame was buffered; an empty result is only valid for a zero size prefix
+        m_output = qUncompress(m_pending);
+        ok = !m_output.isEmpty() || (m_pending.size() >= ZLIB_SIZE_PREFIX && qFromBigEndian<quint32>(m_pending.constData()) == 0);
+        m_pending.clear();
+#endif
+    } else {
+        ok = m_frameComplete;
+    }
+
+    m_finished = true;
+    m_failed = !ok;
+    releaseContexts();
+    if (!ok) {
+        qDebug() << "Compression stream failed to finish";
+    }
+    return ok;
+}
+
+QByteArray CompressionStream::takeOutput() {
+    return std::exchange(m_output, QByteArray());
+}
+
+qint64 CompressionStream::decompressInto(CompressionManager::CompressionAlgorithm algorithm, const char *data, qint64 size,
+                                         char *out, qint64 capacity) {
+    switch (CompressionManager::instance().resolveAlgorithm(algorithm)) {
+#ifdef HAVE_ZSTD
+        case CompressionManager::ZSTD: {
+            ZSTD_DCtx *ctx = borrow(t_contexts.zstdDecompress);
+            if (!ctx && !(ctx = ZSTD_createDCtx())) return -1;
+            const size_t written = ZSTD_decompressDCtx(ctx, out, static_cast<size_t>(capacity), data, static_cast<size_t>(size));
+            giveBack(t_contexts.zstdDecompress, ctx, ZSTD_freeDCtx);
+            return ZSTD_isError(written) ? -1 : qint64(written);
+        }
+#endif
+#ifdef HAVE_LZ4
+        case CompressionManager::LZ4: {
+            LZ4F_dctx *ctx = borrow(t_contexts.lz4Decompress);
+            if (ctx) {
+                LZ4F_resetDecompressionContext(ctx);
+            } else if (LZ4F_isError(LZ4F_createDecompressionContext(&ctx, LZ4F_VERSION))) {
+                return -1;
+            }
+            size_t inPos = 0;
+            size_t outPos = 0;
+            size_t ret = 1;
+            while (ret != 0) {
+                size_t inSize = static_cast<size_t>(size) - inPos;
+                size_t outSize = static_cast<size_t>(capacity) - outPos;
+                ret = LZ4F_decompress(ctx, out + outPos, &outSize, data + inPos, &inSize, nullptr);
+                // No progress with the frame unfinished: truncated input or output too small
+                if (LZ4F_isError(ret) || (ret != 0 && inSize == 0 && outSize == 0)) break;
+                inPos += inSize;
+                outPos += outSize;
+            }
+            giveBack(t_contexts.lz4Decompress, ctx, LZ4F_freeDecompressionContext);
+            return ret == 0 ? qint64(outPos) : -1;
+        }
+#endif
+        default: {
+            // qCompress() layout: 4-byte big-endian size prefix, then a zlib stream
+            if (size < ZLIB_SIZE_PREFIX) return -1;
+#ifdef HAVE_ZLIB
+            uLongf written = static_cast<uLongf>(capacity);
+            const int ret = uncompress(reinterpret_cast<Bytef*>(out), &written,
+                                       reinterpret_cast<const Bytef*>(data + ZLIB_SIZE_PREFIX), static_cast<uLong>(size - ZLIB_SIZE_PREFIX));
+            return ret == Z_OK ? qint64(written) : -1;
+#else
+            const QByteArray decoded = qUncompress(reinterpret_cast<const uchar*>(data), size);
+            if (decoded.size() > capacity) return -1;
+            memcpy(out, decoded.constData(), size_t(decoded.size()));
+            return decoded.size();
+#endif
+        }
+    }
+}
+
+char* CompressionStream::outputSpace(qint64 bytes) {
+    const qint64 used = m_output.size();
+    m_output.resize(used + bytes);
+    return m_output.data() + used;
+}
+
+bool CompressionStream::start() {
+    m_started = true;
+    switch (m_algorithm) {
+#ifdef HAVE_ZSTD
+        case CompressionManager::ZSTD:
+            if (m_direction == Compress) {
+                m_zstdCompress = borrow(t_contexts.zstdCompress);
+                if (!m_zstdCompress) m_zstdCompress = ZSTD_createCCtx();
+                return m_zstdCompress &&
+                       !ZSTD_isError(ZSTD_CCtx_reset(m_zstdCompress, ZSTD_reset_session_and_parameters)) &&
+                       !ZSTD_isError(ZSTD_CCtx_setParameter(m_zstdCompress, ZSTD_c_compressionLevel, qBound(1, m_level, 22))) &&
+                       (m_sizeHint < 0 || !ZSTD_isError(ZSTD_CCtx_setPledgedSrcSize(m_zstdCompress, static_cast<unsigned long long>(m_sizeHint))));
+            }
+            m_zstdDecompress = borrow(t_contexts.zstdDecompress);
+            if (!m_zstdDecompress) m_zstdDecompress = ZSTD_createDCtx();
+            return m_zstdDecompress && !ZSTD_isError(ZSTD_DCtx_reset(m_zstdDecompress, ZSTD_reset_session_only));
+#endif
+#ifdef HAVE_LZ4
+        case CompressionManager::LZ4:
+            if (m_direction == Compress) {
+                m_lz4Compress = borrow(t_contexts.lz4Compress);
+                if (!m_lz4Compress && LZ4F_isError(LZ4F_createCompressionContext(&m_lz4Compress, LZ4F_VERSION))) {
+                    return false;
+                }
+                // compressBegin restarts a context that was abandoned mid-frame
+                const LZ4F_preferences_t prefs = lz4Preferences(m_level, m_sizeHint);
+                const size_t written = LZ4F_compressBegin(m_lz4Compress, outputSpace(LZ4F_HEADER_SIZE_MAX), LZ4F_HEADER_SIZE_MAX, &prefs);
+                if (LZ4F_isError(written)) return false;
+                m_output.resize(m_output.size() - (LZ4F_HEADER_SIZE_MAX - qint64(written)));
+                return true;
+            }
+            m_lz4Decompress = borrow(t_contexts.lz4Decompress);
+            if (!m_lz4Decompress) {
+                return !LZ4F_isError(LZ4F_createDecompressionContext(&m_lz4Decompress, LZ4F_VERSION));
+            }
+            LZ4F_resetDecompressionContext(m_lz4Decompress);
+            return true;
+#endif
+        default:
+#ifdef HAVE_ZLIB
+        {
+            // Same layout as qCompress(): big-endian size prefix, then a zlib stream
+            m_zlib = new z_stream{};
+            if (m_direction == Decompress) {
+                m_zlibHeaderBytes = ZLIB_SIZE_PREFIX;
+                return inflateInit(m_zlib) == Z_OK;
+            }
+            if (deflateInit(m_zlib, m_level < 0 ? Z_DEFAULT_COMPRESSION : qBound(0, m_level, 9)) != Z_OK) {
+                return false;
+            }
+            const quint32 sizeHint = m_sizeHint > 0 ? quint32(qMin<qint64>(m_sizeHint, 0xffffffff)) : 0;
+            qToBigEndian<quint32>(sizeHint, outputSpace(ZLIB_SIZE_PREFIX));
+            return true;
+        }
+#else
+            return true;
+#endif
+    }
+}
+
+bool CompressionStream::compressData(const char *data, qint64 size, bool end) {
+    switch (m_algorithm) {
+#ifdef HAVE_ZSTD
+        case CompressionManager::ZSTD: {
+            ZSTD_inBuffer in = { data, static_cast<size_t>(size), 0 };
+            const ZSTD_EndDirective mode = end ? ZSTD_e_end : ZSTD_e_continue;
+            for (;;) {
+                const size_t room = ZSTD_CStreamOutSize();
+                ZSTD_outBuffer out = { outputSpace(qint64(room)), room, 0 };
+                const size_t remaining = ZSTD_compressStream2(m_zstdCompress, &out, &in, mode);
+                m_output.resize(m_output.size() - qint64(room - out.pos));
+                if (ZSTD_isError(remaining)) return false;
+                if (end ? remaining == 0 : in.pos == in.size) return true;
+            }
+        }
+#endif
+#ifdef HAVE_LZ4
+        case CompressionManager::LZ4: {
+            const LZ4F_preferences_t prefs = lz4Preferences(m_level, m_sizeHint);
+            const size_t room = LZ4F_compressBound(static_cast<size_t>(size), &prefs);
+            char *out = outputSpace(qint64(room));
+            const size_t written = end ? LZ4F_compressEnd(m_lz4Compress, out, room, nullptr)
+                                       : LZ4F_compressUpdate(m_lz4Compress, out, room, data, static_cast<size_t>(size), nullptr);
+            if (LZ4F_isError(written)) return false;
+            m_output.resize(m_output.size() - qint64(room - written));
+            return true;
+        }
+#endif
+        default:
+#ifdef HAVE_ZLIB
+        {
+            m_zlib->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+            m_zlib->avail_in = static_cast<uInt>(size);
+            for (;;) {
+                m_zlib->next_out = reinterpret_cast<Bytef*>(outputSpace(OUTPUT_STEP));
+                m_zlib->avail_out = static_cast<uInt>(OUTPUT_STEP);
+                const int ret = deflate(m_zlib, end ? Z_FINISH : Z_NO_FLUSH);
+                m_output.resize(m_output.size() - qint64(m_zlib->avail_out));
+                if (ret == Z_STREAM_ERROR) return false;
+                // Without Z_FINISH, spare output room means all input was consumed
+                if (end ? ret == Z_STREAM_END : m_zlib->avail_out != 0) return true;
+            }
+        }
+#else
+            if (end) {
+                m_output = qCompress(m_pending, qBound(-1, m_level, 9));
+                m_pending.clear();
+            } else {
+                m_pending.append(data, size);
+            }
+            return true;
+#endif
+    }
+}
+
+bool CompressionStream::decompressData(const char *data, qint64 size) {
+    switch (m_algorithm) {
+#ifdef HAVE_ZSTD
+        case CompressionManager::ZSTD: {
+            if (m_pushed == 0) {
+                const unsigned long long contentSize = ZSTD_getFrameContentSize(data, static_cast<size_t>(size));
+                if (contentSize != ZSTD_CONTENTSIZE_ERROR && contentSize != ZSTD_CONTENTSIZE_UNKNOWN) {
+                    m_output.reserve(qint64(qMin<unsigned long long>(contentSize, MAX_RESERVE)));
+                }
+            }
+            ZSTD_inBuffer in = { data, static_cast<size_t>(size), 0 };
+            for (;;) {
+                const size_t room = ZSTD_DStreamOutSize();
+                const size_t consumedBefore = in.pos;
+                ZSTD_outBuffer out = { outputSpace(qint64(room)), room, 0 };
+                const size_t ret = ZSTD_decompressStream(m_zstdDecompress, &out, &in);
+                m_output.resize(m_output.size() - qint64(room - out.pos));
+                if (ZSTD_isError(ret)) return false;
+                if (in.pos > consumedBefore || out.pos > 0) m_frameComplete = ret == 0;
+                // A full output buffer may mean more is pending inside the context
+                if (in.pos == in.size && out.pos < room) return true;
+            }
+        }
+#endif
+#ifdef HAVE_LZ4
+        case CompressionManager::LZ4: {
+            qint64 pos = 0;
+            for (;;) {
+                size_t inSize = static_cast<size_t>(size - pos);
+                size_t outSize = static_cast<size_t>(OUTPUT_STEP);
+                const size_t ret = LZ4F_decompress(m_lz4Decompress, outputSpace(OUTPUT_STEP), &outSize, data + pos, &inSize, nullptr);
+                m_output.resize(m_output.size() - (OUTPUT_STEP - qint64(outSize)));
+                if (LZ4F_isError(ret)) return false;
+                pos += qint64(inSize);
+                if (inSize > 0 || outSize > 0) m_frameComplete = ret == 0;
+                if (pos == size && qint64(outSize) < OUTPUT_STEP) return true;
+            }
+        }
+#endif
+        default:
+#ifdef HAVE_ZLIB
+        {
+            const qint64 skip = qMin<qint64>(m_zlibHeaderBytes, size);
+            m_zlibHeaderBytes -= int(skip);
+            if (m_frameComplete) {
+                return size == skip; // nothing may follow the end of the stream
+            }
+            m_zlib->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data + skip));
+            m_zlib->avail_in = static_cast<uInt>(size - skip);
+            for (;;) {
+                m_zlib->next_out = reinterpret_cast<Bytef*>(outputSpace(OUTPUT_STEP));
+                m_zlib->avail_out = static_cast<uInt>(OUTPUT_STEP);
+                const int ret = inflate(m_zlib, Z_NO_FLUSH);
+                m_output.resize(m_output.size() - qint64(m_zlib->avail_out));
+                if (ret == Z_STREAM_END) {
+                    m_frameComplete = true;
+                    return m_zlib->avail_in == 0;
+                }
+                if (ret != Z_OK && ret != Z_BUF_ERROR) return false;
+                if (m_zlib->avail_out != 0) return true;
+            }
+        }
+#else
+            m_pending.append(data, size);
+            return true;
+#endif
+    }
+}
+
+void CompressionStream::releaseContexts() {
+#ifdef HAVE_ZSTD
+    giveBack(t_contexts.zstdCompress, m_zstdCompress, ZSTD_freeCCtx);
+    giveBack(t_contexts.zstdDecompress, m_zstdDecompress, ZSTD_freeDCtx);
+#endif
+#ifdef HAVE_LZ4
+    giveBack(t_contexts.lz4Compress, m_lz4Compress, LZ4F_freeCompressionContext);
+    giveBack(t_contexts.lz4Decompress, m_lz4Decompress, LZ4F_freeDecompressionContext);
+#endif
+#ifdef HAVE_ZLIB
+    if (m_zlib) {
+        if (m_direction == Compress) deflateEnd(m_zlib);
+        else inflateEnd(m_zlib);
+        delete m_zlib;
+        m_zlib = nullptr;
+    }
+#endif
+}
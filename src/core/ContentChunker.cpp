@@ -0,0 +1,92 @@
+#include "ContentChunker.h"
+#include <array>
+
+namespace {
+    constexpr qint64 READ_BLOCK_SIZE = 1024 * 1024;
+
+    // Normalized chunking: a stricter mask before the average size and a looser
+    // one after it keeps chunk sizes clustered around AVG_CHUNK_SIZE.
+    // Masks test high bits, which depend on the last 64 input bytes.
+    constexpr quint64 MASK_SMALL = ~quint64(0) << (64 - 22);
+    constexpr quint64 MASK_LARGE = ~quint64(0) << (64 - 18);
+
+    // Gear table from a fixed splitmix64 sequence. Must never change:
+    // different boundaries would stop new chunks deduplicating against stored ones.
+    const std::array<quint64, 256>& gearTable() {
+        static const std::array<quint64, 256> table = [] {
+            std::array<quint64, 256> t{};
+            quint64 state = 0x5356465343444331ULL; // "SVFSCDC1"
+            for (auto &entry : t) {
+                state += 0x9E3779B97F4A7C15ULL;
+                quint64 z = state;
+                z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+                z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+                entry = z ^ (z >> 31);
+            }
+            return t;
+        }();
+        return table;
+    }
+}
+
+ContentChunker::ContentChunker(QIODevice &source) : m_source(source) {
+    gearTable(); // initialize outside the scan loop
+}
+
+bool ContentChunker::fill() {
+    // Drop consumed bytes before growing the buffer
+    if (m_pos > 0) {
+        m_buffer.remove(0, m_pos);
+        m_pos = 0;
+    }
+    while (!m_eof && m_buffer.size() < MAX_CHUNK_SIZE) {
+        if (m_source.atEnd()) {
+            m_eof = true;
+            break;
+        }
+        QByteArray block = m_source.read(READ_BLOCK_SIZE);
+        if (block.isEmpty()) {
+            m_eof = true;
+            m_error = !m_source.atEnd();
+            break;
+        }
+        m_buffer.append(block);
+    }
+    return !m_error;
+}
+
+qsizetype ContentChunker::findBoundary(const uchar *data, qsizetype available) {
+    if (available <= MIN_CHUNK_SIZE) {
+        return available;
+    }
+    const auto &gear = gearTable();
+    const qsizetype limit = qMin<qsizetype>(available, MAX_CHUNK_SIZE);
+    const qsizetype normal = qMin<qsizetype>(limit, AVG_CHUNK_SIZE);
+    quint64 hash = 0;
+    qsizetype i = MIN_CHUNK_SIZE;
+    for (; i < normal; ++i) {
+        hash = (hash << 1) + gear[data[i]];
+        if (!(hash & MASK_SMALL)) return i + 1;
+    }
+    for (; i < limit; ++i) {
+        hash = (hash << 1) + gear[data[i]];
+        if (!(hash & MASK_LARGE)) return i + 1;
+    }
+    return limit;
+}
+
+bool ContentChunker::next(QByteArray &chunk) {
+    chunk.clear();
+    if (m_buffer.size() - m_pos < MAX_CHUNK_SIZE && !fill()) {
+        return false;
+    }
+    const qsizetype available = m_buffer.size() - m_pos;
+    if (available == 0) {
+        return false;
+    }
+    const uchar *data = reinterpret_cast<const uchar*>(m_buffer.constData()) + m_pos;
+    const qsizetype length = findBoundary(data, available);
+    chunk = m_buffer.mid(m_pos, length);
+    m_pos += length;
+    return true;
+}
@@ -5,17 +5,220 @@
 #include <QSqlDatabase>
 #include <QSqlQuery>
 #include <QSqlError>
+#include <QHash>
+#include <QStringList>
 #include <QCryptographicHash>
 #include <QRandomGenerator>
 #include <QStandardPaths>
 #include <QDir>
+#include <QFileInfo>
 #include <QDebug>
+#include <QThread>
+#include <QMutex>
+#include <climits>
+
+namespace {
+    // Writer waits out readers' WAL locks instead of failing with "database is locked"
+    const char WRITER_CONNECT_OPTIONS[] = "QSQLITE_BUSY_TIMEOUT=5000";
+    const char READER_CONNECT_OPTIONS[] = "QSQLITE_OPEN_READONLY;QSQLITE_BUSY_TIMEOUT=5000";
+
+    // This thread's database state: QSqlDatabase handles may only be used by the thread that
+    // opened them, so every worker keeps its own read-only connection (removed on thread exit),
+    // and every thread its own prepared statements for the connection it uses
+    struct ThreadConnection {
+        QString name; quint64 generation = 0; QSqlDatabase database;
+        QHash<QString, QSqlQuery*> statements; // keyed by SQL text
+        void clearStatements() {
+            qDeleteAll(statements);
+            statements.clear();
+        }
+        void release() {
+            clearStatements(); // results must go before their connection
+            if (name.isEmpty()) {
+                return;
+            }
+            database.close();
+            database = QSqlDatabase(); // no handle may be alive for removeDatabase()
+            QSqlDatabase::removeDatabase(name);
+            name.clear();
+        }
+        ~ThreadConnection() { release(); }
+    };
+    thread_local ThreadConnection t_connection;
+
+    // Columns for metadata-only reads. length() on a BLOB does not load its overflow pages,
+    // so listings stay cheap no matter how large the stored content is.
+    constexpr const char* FILE_META_COLUMNS =
+        "id, filename, path, mime_type, size, created_at, modified_at, user_id, "
+        "is_encrypted, is_compressed, checksum, "
+        "CASE WHEN is_chunked THEN (SELECT COALESCE(SUM(COALESCE(s.pack_length, length(s.data), length(c.data))), 0) "
+        "FROM file_chunks c LEFT JOIN chunk_store s ON s.id = c.chunk_id WHERE c.file_id = files.id) "
+        "WHEN is_encrypted THEN length(encrypted_content) ELSE length(content) END, "
+        "is_chunked, dir_id";
+
+    // Explicit column lists, read back by index (SELECT * order depends on migration history)
+    constexpr const char* FILE_RECORD_COLUMNS =
+        "id, filename, path, content, encrypted_content, mime_type, size, created_at, modified_at, "
+        "user_id, is_encrypted, is_compressed, checksum, is_chunked, dir_id";
+    constexpr const char* DIRECTORY_COLUMNS = "id, name, path, parent_id, user_id, created_at, modified_at";
+
+    // Full path of a directories row: its parent's path (the path column) plus its name
+    QString directoryFullPath(const char *row) {
+        return QString("CASE WHEN %1.path IN ('', '/') THEN '/' || %1.name ELSE %1.path || '/' || %1.name END").arg(row);
+    }
+
+    // Stored bytes of a files row's inline content (zero for chunked files, whose chunks count instead)
+    QString inlineStoredSize(const char *row) {
+        return QString("COALESCE(length(CASE WHEN %1.is_encrypted THEN %1.encrypted_content ELSE %1.content END), 0)").arg(row);
+    }
+
+    // Stored bytes of a file_chunks row: the shared chunk_store payload (in SQLite or a pack), or the legacy inline one
+    QString chunkStoredSize(const char *row) {
+        return QString("COALESCE((SELECT COALESCE(pack_length, length(data)) FROM chunk_store WHERE id = %1.chunk_id), length(%1.data), 0)").arg(row);
+    }
+
+    // chunk_store rows whose payload lives in a pack file say where; value(first) is NULL otherwise
+    bool readPackLocation(const QSqlQuery &query, int first, PackLocation &location) {
+        if (query.value(first).isNull()) {
+            return false;
+        }
+        location.packId = query.value(first).toInt();
+        location.offset = query.value(first + 1).toLongLong();
+        location.length = query.value(first + 2).toLongLong();
+        location.checksum = quint64(query.value(first + 3).toLongLong());
+        return true;
+    }
+
+    constexpr double PACK_COMPACT_MIN_GARBAGE = 0.5; // packs with at least this share of dead bytes are rewritten
+
+    FileRecord readFileRecord(const QSqlQuery &query) {
+        FileRecord file;
+        file.id = query.value(0).toInt();
+        file.filename = query.value(1).toString();
+        file.path = query.value(2).toString();
+        file.content = query.value(3).toByteArray();
+        file.encryptedContent = query.value(4).toByteArray();
+        file.mimeType = query.value(5).toString();
+        file.size = query.value(6).toLongLong();
+        file.createdAt = query.value(7).toDateTime();
+        file.modifiedAt = query.value(8).toDateTime();
+        file.userId = query.value(9).toInt();
+        file.isEncrypted = query.value(10).toBool();
+        file.isCompressed = query.value(11).toBool();
+        file.checksum = query.value(12).toByteArray();
+        file.isChunked = query.value(13).toBool();
+        file.dirId = query.value(14).toInt();
+        return file;
+    }
+
+    DirectoryRecord readDirectory(const QSqlQuery &query) {
+        DirectoryRecord dir;
+        dir.id = query.value(0).toInt();
+        dir.name = query.value(1).toString();
+        dir.path = query.value(2).toString();
+        dir.parentId = query.value(3).toInt();
+        dir.userId = query.value(4).toInt();
+        dir.createdAt = query.value(5).toDateTime();
+        dir.modifiedAt = query.value(6).toDateTime();
+        return dir;
+    }
+
+    FileMeta readFileMeta(const QSqlQuery &query) {
+        FileMeta meta;
+        meta.id = query.value(0).toInt();
+        meta.filename = query.value(1).toString();
+        meta.path = query.value(2).toString();
+        meta.mimeType = query.value(3).toString();
+        meta.size = query.value(4).toLongLong();
+        meta.createdAt = query.value(5).toDateTime();
+        meta.modifiedAt = query.value(6).toDateTime();
+        meta.userId = query.value(7).toInt();
+        meta.isEncrypted = query.value(8).toBool();
+        meta.isCompressed = query.value(9).toBool();
+        meta.checksum = query.value(10).toByteArray();
+        meta.storedSize = query.value(11).toLongLong();
+        meta.isChunked = query.value(12).toBool();
+        meta.dirId = query.value(13).toInt();
+        return meta;
+    }
+}
 
 DatabaseManager& DatabaseManager::instance() {
     static DatabaseManager instance;
     return instance;
 }
 
+QSqlDatabase DatabaseManager::readConnection() {
+    ThreadConnection &conn = t_connection;
+    const quint64 generation = m_connectionGeneration.load();
+    
+    // The writer's thread reads on the writer so it sees its own uncommitted rows
+    if (!m_isInitialized.load() || QThread::currentThread() == m_writerThread.load()) {
+        if (conn.generation != generation) {
+            conn.clearStatements();
+            conn.generation = generation;
+        }
+        return m_database;
+    }
+    
+    if (conn.generation != generation || conn.name.isEmpty()) {
+        conn.release();
+        QString path;
+        {
+            QMutexLocker locker(&m_pathMutex);
+            path = m_dbPath;
+        }
+        conn.name = QString("svfs_read_%1_%2").arg(QString::number(quint64(quintptr(QThread::currentThreadId())), 16)).arg(generation);
+        conn.database = QSqlDatabase::addDatabase("QSQLITE", conn.name);
+        conn.database.setDatabaseName(path);
+        conn.database.setConnectOptions(READER_CONNECT_OPTIONS);
+        if (!conn.database.open()) {
+            qDebug() << "Failed to open read connection:" << conn.database.lastError().text();
+            conn.release();
+            return QSqlDatabase();
+        }
+        conn.generation = generation;
+    }
+    return conn.database;
+}
+
+DatabaseManager::Statement::~Statement() {
+    if (m_query) {
+        m_query->finish(); // ends the read snapshot, keeps the prepared statement
+    }
+}
+
+DatabaseManager::Statement DatabaseManager::statement(const QString &sql) {
+    QSqlDatabase database = readConnection();
+    ThreadConnection &conn = t_connection;
+    QSqlQuery *query = conn.statements.value(sql);
+    if (!query) {
+        // A failed prepare is cached too: exec() then reports the error, and the
+        // next reopen (new generation) prepares again
+        query = new QSqlQuery(database);
+        query->setForwardOnly(true);
+        if (!query->prepare(sql)) {
+            qDebug() << "Failed to prepare statement:" << query->lastError().text();
+        }
+        conn.statements.insert(sql, query);
+    }
+    return Statement(query);
+}
+
+void DatabaseManager::enableWriteAheadLog() {
+    // WAL lets the read connections run while the writer commits; NORMAL sync is
+    // still crash-safe in WAL mode and saves an fsync per commit
+    m_writerThread = QThread::currentThread();
+    QSqlQuery query(m_database);
+    if (!query.exec("PRAGMA journal_mode=WAL") || !query.next() ||
+        query.value(0).toString().compare("wal", Qt::CaseInsensitive) != 0) {
+        qDebug() << "WAL journaling unavailable, readers will wait for the writer:" << query.lastError().text();
+    }
+    if (!query.exec("PRAGMA synchronous=NORMAL")) {
+        qDebug() << "Failed to set synchronous mode:" << query.lastError().text();
+    }
+}
+
 bool DatabaseManager::initializeDatabase(const QString &dbPath) {
     if (m_isInitialized && m_dbPath == dbPath) {
         return true; // Already initialized with this path
@@ -26,15 +229,21 @@ bool DatabaseManager::initializeDatabase(const QString &dbPath) {
         closeDatabase();
     }
     
-    m_dbPath = dbPath;
+    {
+        QMutexLocker locker(&m_pathMutex);
+        m_dbPath = dbPath;
+    }
+    ++m_connectionGeneration;
     m_database = QSqlDatabase::addDatabase("QSQLITE", m_connectionName);
     m_database.setDatabaseName(m_dbPath);
+    m_database.setConnectOptions(WRITER_CONNECT_OPTIONS);
     
     if (!m_database.open()) {
         qDebug() << "Failed to open database:" << m_database.lastError().text();
         qDebug() << "Database path:" << m_dbPath;
         return false;
     }
+    enableWriteAheadLog();
     
     qDebug() << "Successfully opened database:" << m_dbPath;
     m_isInitialized = true;
@@ -107,15 +316,570 @@ bool DatabaseManager::createTables() {
         return false;
     }
     
+    // Databases created before chunked storage lack this column
+    if (!addColumnIfMissing("files", "is_chunked", "BOOLEAN DEFAULT 0")) {
+        return false;
+    }
+    // Containing directory (0 = root); path stays as a denormalized copy for display and search
+    if (!addColumnIfMissing("files", "dir_id", "INTEGER NOT NULL DEFAULT 0")) {
+        return false;
+    }
+    
+    // Chunk table: each row is processed (compressed/encrypted) on its own,
+    // so reads and writes never need the whole file in memory
+    QString createFileChunksTable = R"(
+        CREATE TABLE IF NOT EXISTS file_chunks (
+            id INTEGER PRIMARY KEY AUTOINCREMENT,
+            file_id INTEGER NOT NULL,
+            chunk_index INTEGER NOT NULL,
+            plain_offset INTEGER NOT NULL,
+            plain_size INTEGER NOT NULL,
+            data BLOB NOT NULL,
+            FOREIGN KEY (file_id) REFERENCES files(id)
+        )
+    )";
+    
+    if (!query.exec(createFileChunksTable)) {
+        qDebug() << "Failed to create file_chunks table:" << query.lastError().text();
+        return false;
+    }
+    
+    // Deduplicated chunk payloads shared by every file (and user) that contains them.
+    // hash is a keyed hash of the plaintext plus processing settings; ref_count counts
+    // file_chunks rows pointing here and rows at zero are reclaimed by collectUnreferencedChunks().
+    QString createChunkStoreTable = R"(
+        CREATE TABLE IF NOT EXISTS chunk_store (
+            id INTEGER PRIMARY KEY AUTOINCREMENT,
+            hash BLOB NOT NULL UNIQUE,
+            plain_size INTEGER NOT NULL,
+            data BLOB NOT NULL,
+            ref_count INTEGER NOT NULL DEFAULT 0
+        )
+    )";
+    
+    if (!query.exec(createChunkStoreTable)) {
+        qDebug() << "Failed to create chunk_store table:" << query.lastError().text();
+        return false;
+    }
+    
+    // Chunk rows written before deduplication keep their payload inline in file_chunks.data;
+    // newer rows leave it empty and reference chunk_store instead
+    if (!addColumnIfMissing("file_chunks", "chunk_id", "INTEGER REFERENCES chunk_store(id)")) {
+        return false;
+    }
+    
+    // Payloads stored in pack files (see PackStore) keep an empty data column and these instead
+    if (!addColumnIfMissing("chunk_store", "pack_id", "INTEGER") ||
+        !addColumnIfMissing("chunk_store", "pack_offset", "INTEGER") ||
+        !addColumnIfMissing("chunk_store", "pack_length", "INTEGER") ||
+        !addColumnIfMissing("chunk_store", "pack_checksum", "INTEGER")) {
+        return false;
+    }
+    
+    // Per-vault options, e.g. where new chunk payloads go
+    if (!query.exec("CREATE TABLE IF NOT EXISTS vault_settings (key TEXT PRIMARY KEY, value TEXT NOT NULL)")) {
+        qDebug() << "Failed to create vault_settings table:" << query.lastError().text();
+        return false;
+    }
+    
     // Create indexes for better performance
-    query.exec("CREATE INDEX IF NOT EXISTS idx_files_path ON files(path)");
+    query.exec("CREATE UNIQUE INDEX IF NOT EXISTS idx_file_chunks_file ON file_chunks(file_id, chunk_index)");
+    query.exec("CREATE INDEX IF NOT EXISTS idx_file_chunks_chunk ON file_chunks(chunk_id)");
+    query.exec("CREATE INDEX IF NOT EXISTS idx_chunk_store_unreferenced ON chunk_store(ref_count) WHERE ref_count <= 0");
+    query.exec("CREATE INDEX IF NOT EXISTS idx_chunk_store_pack ON chunk_store(pack_id) WHERE pack_id IS NOT NULL");
     query.exec("CREATE INDEX IF NOT EXISTS idx_files_user_id ON files(user_id)");
-    query.exec("CREATE INDEX IF NOT EXISTS idx_directories_path ON directories(path)");
+    query.exec("CREATE INDEX IF NOT EXISTS idx_files_dir ON files(user_id, dir_id)");
     query.exec("CREATE INDEX IF NOT EXISTS idx_directories_user_id ON directories(user_id)");
+    query.exec("CREATE INDEX IF NOT EXISTS idx_directories_parent ON directories(user_id, parent_id, name)");
+    // Listings no longer look rows up by path string
+    query.exec("DROP INDEX IF EXISTS idx_files_path");
+    query.exec("DROP INDEX IF EXISTS idx_directories_path");
+    
+    if (!createDirectoryTree() || !createUserStats()) {
+        return false;
+    }
+    
+    // Optional: without it search falls back to LIKE scans
+    m_hasSearchIndex = createSearchIndex();
+    
+    // Packs are opened up front whenever the vault has or may write any, so reader
+    // threads never race to open them
+    BlobStore::Kind kind = BlobStore::Inline;
+    BlobStore::kindFromName(vaultSetting("chunk_storage"), kind);
+    if ((kind == BlobStore::Pack || QDir(packDirectory()).exists()) && !m_packs.open(packDirectory())) {
+        return false;
+    }
+    bool thresholdOk = false;
+    m_inlineThreshold = vaultSetting("inline_threshold").toLongLong(&thresholdOk);
+    if (!thresholdOk || m_inlineThreshold < 0) {
+        m_inlineThreshold = DEFAULT_INLINE_THRESHOLD;
+    }
+    m_blobStore = blobStore(kind);
+    if (!m_blobStore->isAvailable()) {
+        qWarning() << "Chunk storage" << BlobStore::kindName(kind) << "unavailable in this build, using inline";
+        m_blobStore = m_inlineBlobs.get();
+    }
+    
+    return true;
+}
+
+BlobStore* DatabaseManager::blobStore(BlobStore::Kind kind) const {
+    switch (kind) {
+        case BlobStore::Incremental: return m_incrementalBlobs.get();
+        case BlobStore::Pack: return m_packBlobs.get();
+        default: return m_inlineBlobs.get();
+    }
+}
+
+BlobStore* DatabaseManager::blobReader(bool inPack) const {
+    if (inPack) {
+        return m_packBlobs.get();
+    }
+    // Both SQLite stores read the same column; the vault's choice decides how
+    return m_blobStore->kind() == BlobStore::Pack ? m_inlineBlobs.get() : m_blobStore;
+}
+
+QString DatabaseManager::packDirectory() const {
+    return QFileInfo(m_dbPath).absoluteFilePath() + ".packs";
+}
+
+QString DatabaseManager::vaultSetting(const QString &key, const QString &defaultValue) {
+    Statement query = statement("SELECT value FROM vault_settings WHERE key = ?");
+    query->bindValue(0, key);
     
+    if (!query->exec() || !query->next()) {
+        return defaultValue;
+    }
+    return query->value(0).toString();
+}
+
+bool DatabaseManager::setVaultSetting(const QString &key, const QString &value) {
+    Statement query = statement("INSERT OR REPLACE INTO vault_settings (key, value) VALUES (?, ?)");
+    query->bindValue(0, key);
+    query->bindValue(1, value);
+    return query->exec();
+}
+
+bool DatabaseManager::isBlobStoreAvailable(BlobStore::Kind kind) {
+    // Pack files are available once opened; that happens on selection
+    return kind == BlobStore::Pack || blobStore(kind)->isAvailable();
+}
+
+bool DatabaseManager::setBlobStore(BlobStore::Kind kind) {
+    // Only new payloads follow the setting; existing ones are read from wherever they are
+    if (kind == BlobStore::Pack && !m_packs.isOpen() && !m_packs.open(packDirectory())) {
+        return false;
+    }
+    if (!blobStore(kind)->isAvailable()) {
+        qWarning() << "Chunk storage" << BlobStore::kindName(kind) << "unavailable in this build";
+        return false;
+    }
+    if (!setVaultSetting("chunk_storage", BlobStore::kindName(kind))) {
+        return false;
+    }
+    m_blobStore = blobStore(kind);
     return true;
 }
 
+qint64 DatabaseManager::compactPacks() {
+    if (!m_packs.isOpen()) {
+        return 0;
+    }
+    // Old packs go only after the moved rows are really committed; inside an open
+    // transaction (e.g. an import batch) that commit would be someone else's
+    if (m_transactionDepth > 0) {
+        qWarning() << "Pack compaction refused: a transaction is open";
+        return -1;
+    }
+    // Runs after chunk GC so the space of every unreferenced payload counts as dead
+    if (collectUnreferencedChunks() < 0) {
+        return -1;
+    }
+    
+    qint64 reclaimed = 0;
+    const int appendPack = m_packs.appendPackId();
+    for (int packId : m_packs.packIds()) {
+        if (packId == appendPack) {
+            continue;
+        }
+        const qint64 packBytes = m_packs.packSize(packId);
+        
+        // Live payloads of this pack; everything else in it is garbage
+        QList<QPair<qint64, PackLocation>> live;
+        qint64 liveBytes = 0;
+        {
+            Statement query = statement(
+                "SELECT id, pack_id, pack_offset, pack_length, pack_checksum FROM chunk_store WHERE pack_id = ? ORDER BY pack_offset");
+            query->bindValue(0, packId);
+            if (!query->exec()) {
+                return -1;
+            }
+            while (query->next()) {
+                PackLocation location;
+                readPackLocation(*query, 1, location);
+                live.append(qMakePair(query->value(0).toLongLong(), location));
+                liveBytes += location.length;
+            }
+        }
+        if (!live.isEmpty() && liveBytes >= packBytes * (1.0 - PACK_COMPACT_MIN_GARBAGE)) {
+            continue;
+        }
+        
+        // Copy the live payloads forward; the commit syncs them before the rows point there
+        if (!beginTransaction()) {
+            return -1;
+        }
+        bool ok = true;
+        for (const auto &entry : std::as_const(live)) {
+            QByteArray data;
+            PackLocation moved;
+            Statement update = statement(
+                "UPDATE chunk_store SET pack_id = ?, pack_offset = ?, pack_length = ?, pack_checksum = ? WHERE id = ?");
+            ok = m_packs.read(entry.second, data) && m_packs.append(data, moved);
+            if (!ok) {
+                break;
+            }
+            update->bindValue(0, moved.packId);
+            update->bindValue(1, moved.offset);
+            update->bindValue(2, moved.length);
+            update->bindValue(3, qint64(moved.checksum));
+            update->bindValue(4, entry.first);
+            if (!update->exec()) {
+                ok = false;
+                break;
+            }
+        }
+        if (!ok) {
+            rollbackTransaction();
+            return -1;
+        }
+        m_packRemovals.append(packId);
+        if (!commitTransaction()) {
+            return -1;
+        }
+        // Where the pack could not be deleted it stays until the next compaction
+        if (m_packs.packSize(packId) == 0) {
+            reclaimed += packBytes - liveBytes;
+        }
+    }
+    return reclaimed;
+}
+
+bool DatabaseManager::createDirectoryTree() {
+    // Closure table: one row per (ancestor, descendant) pair including each directory
+    // itself at depth 0, so a whole subtree is one indexed lookup on ancestor_id.
+    // Kept current by triggers on directories; the root (id 0) has no rows.
+    QSqlQuery query(m_database);
+    const bool exists = query.exec("SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = 'directory_tree'") && query.next();
+    
+    if (!beginTransaction()) {
+        return false;
+    }
+    const QStringList statements = {
+        R"(CREATE TABLE IF NOT EXISTS directory_tree (
+            ancestor_id INTEGER NOT NULL,
+            descendant_id INTEGER NOT NULL,
+            depth INTEGER NOT NULL,
+            PRIMARY KEY (ancestor_id, descendant_id)
+        ) WITHOUT ROWID)",
+        "CREATE INDEX IF NOT EXISTS idx_directory_tree_descendant ON directory_tree(descendant_id)",
+        R"(CREATE TRIGGER IF NOT EXISTS directory_tree_insert AFTER INSERT ON directories BEGIN
+            INSERT INTO directory_tree (ancestor_id, descendant_id, depth)
+            SELECT ancestor_id, new.id, depth + 1 FROM directory_tree WHERE descendant_id = new.parent_id
+            UNION ALL SELECT new.id, new.id, 0;
+        END)",
+        R"(CREATE TRIGGER IF NOT EXISTS directory_tree_delete AFTER DELETE ON directories BEGIN
+            DELETE FROM directory_tree WHERE descendant_id = old.id OR ancestor_id = old.id;
+        END)",
+        // A moved subtree drops its links to the old ancestors and gains the new ones;
+        // links inside the subtree stay as they are
+        R"(CREATE TRIGGER IF NOT EXISTS directory_tree_move AFTER UPDATE OF parent_id ON directories
+        WHEN old.parent_id IS NOT new.parent_id BEGIN
+            DELETE FROM directory_tree
+            WHERE descendant_id IN (SELECT descendant_id FROM directory_tree WHERE ancestor_id = new.id)
+              AND ancestor_id NOT IN (SELECT descendant_id FROM directory_tree WHERE ancestor_id = new.id);
+            INSERT INTO directory_tree (ancestor_id, descendant_id, depth)
+            SELECT a.ancestor_id, d.descendant_id, a.depth + d.depth + 1
+            FROM directory_tree a JOIN directory_tree d ON d.ancestor_id = new.id
+            WHERE a.descendant_id = new.parent_id;
+        END)",
+    };
+    for (const QString &sql : statements) {
+        if (!query.exec(sql)) {
+            qDebug() << "Failed to create directory_tree:" << query.lastError().text();
+            rollbackTransaction();
+            return false;
+        }
+    }
+    
+    if (!exists) {
+        // Older vaults linked rows only through path strings (and never set parent_id):
+        // derive the ids from them once, then build the closure. Each directory's full path
+        // is computed once into an indexed lookup table (the lowest id wins for duplicates),
+        // so every row is one index probe instead of a scan of its user's directories.
+        const QStringList backfill = {
+            R"(CREATE TEMP TABLE directory_paths (
+                user_id INTEGER NOT NULL, full_path TEXT NOT NULL, id INTEGER NOT NULL,
+                PRIMARY KEY (user_id, full_path)
+            ) WITHOUT ROWID)",
+            QString("INSERT OR IGNORE INTO directory_paths (user_id, full_path, id) "
+                    "SELECT d.user_id, %1, d.id FROM directories d ORDER BY d.id").arg(directoryFullPath("d")),
+            "UPDATE directories SET parent_id = COALESCE((SELECT p.id FROM directory_paths p "
+            "WHERE p.user_id = directories.user_id AND p.full_path = directories.path), 0)",
+            "UPDATE files SET dir_id = COALESCE((SELECT p.id FROM directory_paths p "
+            "WHERE p.user_id = files.user_id AND p.full_path = files.path), 0)",
+            "DROP TABLE temp.directory_paths",
+            R"(WITH RECURSIVE tree (ancestor_id, descendant_id, depth) AS (
+                SELECT id, id, 0 FROM directories
+                UNION ALL
+                SELECT t.ancestor_id, d.id, t.depth + 1 FROM tree t JOIN directories d ON d.parent_id = t.descendant_id
+            )
+            INSERT INTO directory_tree (ancestor_id, descendant_id, depth) SELECT ancestor_id, descendant_id, depth FROM tree)",
+        };
+        for (const QString &sql : backfill) {
+            if (!query.exec(sql)) {
+                qDebug() << "Failed to migrate directory hierarchy:" << query.lastError().text();
+                rollbackTransaction();
+                return false;
+            }
+        }
+    }
+    return commitTransaction();
+}
+
+bool DatabaseManager::createUserStats() {
+    // Per-user totals kept current by triggers, in the same transaction as the change,
+    // so the status bar reads one row instead of scanning files and directories.
+    // logical_bytes is the sum of file sizes; stored_bytes what their content takes
+    // after compression/encryption (shared chunks count once per referencing file).
+    // inline_* count the files whose content sits in the files row (is_chunked = 0).
+    QSqlQuery query(m_database);
+    const bool exists = query.exec("SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = 'user_stats'") && query.next();
+    const bool hasInlineColumns = exists && query.exec("SELECT inline_file_count FROM user_stats LIMIT 0");
+    
+    if (!beginTransaction()) {
+        return false;
+    }
+    const QString addUser = "INSERT OR IGNORE INTO user_stats (user_id) VALUES (%1.user_id); ";
+    const QString fileDelta = "UPDATE user_stats SET file_count = file_count %1 1, logical_bytes = logical_bytes %1 %2.size, "
+                              "stored_bytes = stored_bytes %1 %3, inline_file_count = inline_file_count %1 (NOT %2.is_chunked), "
+                              "inline_bytes = inline_bytes %1 CASE WHEN %2.is_chunked THEN 0 ELSE %2.size END "
+                              "WHERE user_id = %2.user_id; ";
+    const QString chunkDelta = "UPDATE user_stats SET stored_bytes = stored_bytes %1 %3 "
+                               "WHERE user_id = (SELECT user_id FROM files WHERE id = %2.file_id); ";
+    const QString dirDelta = "UPDATE user_stats SET directory_count = directory_count %1 1 WHERE user_id = %2.user_id; ";
+    const QStringList statements = {
+        // Recreated on every open: the expressions follow the storage layout and columns
+        "DROP TRIGGER IF EXISTS user_stats_file_insert",
+        "DROP TRIGGER IF EXISTS user_stats_file_delete",
+        "DROP TRIGGER IF EXISTS user_stats_file_update",
+        "DROP TRIGGER IF EXISTS user_stats_chunk_insert",
+        "DROP TRIGGER IF EXISTS user_stats_chunk_delete",
+        R"(CREATE TABLE IF NOT EXISTS user_stats (
+            user_id INTEGER PRIMARY KEY,
+            file_count INTEGER NOT NULL DEFAULT 0,
+            directory_count INTEGER NOT NULL DEFAULT 0,
+            logical_bytes INTEGER NOT NULL DEFAULT 0,
+            stored_bytes INTEGER NOT NULL DEFAULT 0,
+            inline_file_count INTEGER NOT NULL DEFAULT 0,
+            inline_bytes INTEGER NOT NULL DEFAULT 0
+        ))",
+        "CREATE TRIGGER IF NOT EXISTS user_stats_file_insert AFTER INSERT ON files BEGIN " +
+            addUser.arg("new") + fileDelta.arg("+", "new", inlineStoredSize("new")) + "END",
+        "CREATE TRIGGER IF NOT EXISTS user_stats_file_delete AFTER DELETE ON files BEGIN " +
+            fileDelta.arg("-", "old", inlineStoredSize("old")) + "END",
+        // Out with the old row, in with the new one: also right if the owner changes
+        "CREATE TRIGGER IF NOT EXISTS user_stats_file_update "
+        "AFTER UPDATE OF size, content, encrypted_content, is_encrypted, is_chunked, user_id ON files BEGIN " +
+            fileDelta.arg("-", "old", inlineStoredSize("old")) + addUser.arg("new") +
+            fileDelta.arg("+", "new", inlineStoredSize("new")) + "END",
+        "CREATE TRIGGER IF NOT EXISTS user_stats_chunk_insert AFTER INSERT ON file_chunks BEGIN " +
+            chunkDelta.arg("+", "new", chunkStoredSize("new")) + "END",
+        "CREATE TRIGGER IF NOT EXISTS user_stats_chunk_delete AFTER DELETE ON file_chunks BEGIN " +
+            chunkDelta.arg("-", "old", chunkStoredSize("old")) + "END",
+        "CREATE TRIGGER IF NOT EXISTS user_stats_directory_insert AFTER INSERT ON directories BEGIN " +
+            addUser.arg("new") + dirDelta.arg("+", "new") + "END",
+        "CREATE TRIGGER IF NOT EXISTS user_stats_directory_delete AFTER DELETE ON directories BEGIN " +
+            dirDelta.arg("-", "old") + "END",
+    };
+    for (const QString &sql : statements) {
+        if (!query.exec(sql)) {
+            qDebug() << "Failed to create user_stats:" << query.lastError().text();
+            rollbackTransaction();
+            return false;
+        }
+    }
+    if (exists && !hasInlineColumns &&
+        (!addColumnIfMissing("user_stats", "inline_file_count", "INTEGER NOT NULL DEFAULT 0") ||
+         !addColumnIfMissing("user_stats", "inline_bytes", "INTEGER NOT NULL DEFAULT 0"))) {
+        rollbackTransaction();
+        return false;
+    }
+    // Vaults from before the table (or its columns) existed start from a full count
+    if ((!exists || !hasInlineColumns) && !recomputeUserStats()) {
+        rollbackTransaction();
+        return false;
+    }
+    return commitTransaction();
+}
+
+bool DatabaseManager::recomputeUserStats() {
+    if (!beginTransaction()) {
+        return false;
+    }
+    
+    QSqlQuery query(m_database);
+    const QString recompute = QString(R"(
+        INSERT INTO user_stats (user_id, file_count, directory_count, logical_bytes, stored_bytes, inline_file_count, inline_bytes)
+        SELECT u.user_id,
+            (SELECT COUNT(*) FROM files f WHERE f.user_id = u.user_id),
+            (SELECT COUNT(*) FROM directories d WHERE d.user_id = u.user_id),
+            (SELECT COALESCE(SUM(f.size), 0) FROM files f WHERE f.user_id = u.user_id),
+            (SELECT COALESCE(SUM(%1), 0) FROM files f WHERE f.user_id = u.user_id) +
+            (SELECT COALESCE(SUM(%2), 0) FROM file_chunks c JOIN files f ON f.id = c.file_id WHERE f.user_id = u.user_id),
+            (SELECT COUNT(*) FROM files f WHERE f.user_id = u.user_id AND NOT f.is_chunked),
+            (SELECT COALESCE(SUM(f.size), 0) FROM files f WHERE f.user_id = u.user_id AND NOT f.is_chunked)
+        FROM (SELECT id AS user_id FROM users UNION SELECT user_id FROM files UNION SELECT user_id FROM directories) u
+    )").arg(inlineStoredSize("f"), chunkStoredSize("c"));
+    if (!query.exec("DELETE FROM user_stats") || !query.exec(recompute)) {
+        qDebug() << "Failed to recompute user_stats:" << query.lastError().text();
+        rollbackTransaction();
+        return false;
+    }
+    
+    return commitTransaction();
+}
+
+bool DatabaseManager::createSearchIndex() {
+    // Trigram FTS5 index over filename and path: any substring of three or more characters
+    // is answered from the index. External content (no second copy of the text), kept in
+    // step with files by triggers; renames only fire the update trigger.
+    QSqlQuery query(m_database);
+    const bool exists = query.exec("SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = 'files_fts'") && query.next();
+    
+    if (!beginTransaction()) {
+        return false;
+    }
+    const QStringList statements = {
+        "CREATE VIRTUAL TABLE IF NOT EXISTS files_fts USING fts5("
+        "filename, path, content='files', content_rowid='id', tokenize='trigram')",
+        "CREATE TRIGGER IF NOT EXISTS files_fts_insert AFTER INSERT ON files BEGIN "
+        "INSERT INTO files_fts(rowid, filename, path) VALUES (new.id, new.filename, new.path); END",
+        "CREATE TRIGGER IF NOT EXISTS files_fts_delete AFTER DELETE ON files BEGIN "
+        "INSERT INTO files_fts(files_fts, rowid, filename, path) VALUES ('delete', old.id, old.filename, old.path); END",
+        "CREATE TRIGGER IF NOT EXISTS files_fts_update AFTER UPDATE OF filename, path ON files BEGIN "
+        "INSERT INTO files_fts(files_fts, rowid, filename, path) VALUES ('delete', old.id, old.filename, old.path); "
+        "INSERT INTO files_fts(rowid, filename, path) VALUES (new.id, new.filename, new.path); END",
+    };
+    for (const QString &sql : statements) {
+        if (!query.exec(sql)) {
+            qDebug() << "Full-text search unavailable, using LIKE:" << query.lastError().text();
+            rollbackTransaction();
+            return false;
+        }
+    }
+    // Files written before the index existed
+    if (!exists && !query.exec("INSERT INTO files_fts(files_fts) VALUES ('rebuild')")) {
+        qDebug() << "Failed to build search index:" << query.lastError().text();
+        rollbackTransaction();
+        return false;
+    }
+    return commitTransaction();
+}
+
+bool DatabaseManager::addColumnIfMissing(const QString &table, const QString &column, const QString &definition) {
+    QSqlQuery query(m_database);
+    if (!query.exec(QString("PRAGMA table_info(%1)").arg(table))) {
+        return false;
+    }
+    while (query.next()) {
+        if (query.value(1).toString() == column) {
+            return true;
+        }
+    }
+    if (!query.exec(QString("ALTER TABLE %1 ADD COLUMN %2 %3").arg(table, column, definition))) {
+        qDebug() << "Failed to add column" << column << "to" << table << ":" << query.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+bool DatabaseManager::beginTransaction() {
+    if (m_transactionDepth > 0) {
+        QSqlQuery query(m_database);
+        if (!query.exec(QString("SAVEPOINT svfs_%1").arg(m_transactionDepth))) {
+            qDebug() << "Failed to open savepoint:" << query.lastError().text();
+            return false;
+        }
+        ++m_transactionDepth;
+        return true;
+    }
+    m_transactionDepth = 1;
+    m_transactionFailed = false;
+    if (!m_database.transaction()) {
+        qDebug() << "Failed to begin transaction:" << m_database.lastError().text();
+        m_transactionDepth = 0;
+        return false;
+    }
+    return true;
+}
+
+bool DatabaseManager::commitTransaction() {
+    if (m_transactionDepth == 0) {
+        return false;
+    }
+    if (--m_transactionDepth > 0) {
+        QSqlQuery query(m_database);
+        if (!query.exec(QString("RELEASE svfs_%1").arg(m_transactionDepth))) {
+            qDebug() << "Failed to release savepoint:" << query.lastError().text();
+            m_transactionFailed = true;
+        }
+        return !m_transactionFailed;
+    }
+    if (m_transactionFailed) {
+        // A savepoint could not be undone; the outermost scope cannot commit partial work
+        m_database.rollback();
+        m_packRemovals.clear();
+        return false;
+    }
+    // Pack payloads must be durable before any committed row points at them
+    if (!m_packs.sync()) {
+        m_database.rollback();
+        m_packRemovals.clear();
+        return false;
+    }
+    if (!m_database.commit()) {
+        qDebug() << "Failed to commit transaction:" << m_database.lastError().text();
+        m_database.rollback();
+        m_packRemovals.clear();
+        return false;
+    }
+    // Nothing committed points into these any more
+    for (int packId : std::as_const(m_packRemovals)) {
+        m_packs.removePack(packId);
+    }
+    m_packRemovals.clear();
+    return true;
+}
+
+void DatabaseManager::rollbackTransaction() {
+    if (m_transactionDepth == 0) {
+        return;
+    }
+    if (--m_transactionDepth == 0) {
+        m_database.rollback();
+        m_packRemovals.clear();
+        return;
+    }
+    // Back to where this scope began; the savepoint itself goes with the release
+    QSqlQuery query(m_database);
+    if (!query.exec(QString("ROLLBACK TO svfs_%1").arg(m_transactionDepth)) ||
+        !query.exec(QString("RELEASE svfs_%1").arg(m_transactionDepth))) {
+        qDebug() << "Failed to roll back savepoint:" << query.lastError().text();
+        m_transactionFailed = true;
+    }
+}
+
 QByteArray DatabaseManager::generateSalt() {
     QByteArray salt(32, 0);
     for (int i = 0; i < 32; ++i) {
@@ -137,46 +901,49 @@ bool DatabaseManager::verifyPassword(const QString &password, const QByteArray &
 }
 
 bool DatabaseManager::createUser(const QString &username, const QString &password) {
-    QSqlQuery query(m_database);
-    
-    // Check if user already exists
-    query.prepare("SELECT id FROM users WHERE username = ?");
-    query.addBindValue(username);
-    if (query.exec() && query.next()) {
-        return false; // User already exists
+    {
+        // Check if user already exists
+        Statement query = statement("SELECT id FROM users WHERE username = ?");
+        query->bindValue(0, username);
+        if (query->exec() && query->next()) {
+            return false; // User already exists
+        }
     }
     
     QByteArray salt = generateSalt();
     QByteArray passwordHash = hashPassword(password, salt);
     
-    query.prepare(R"(
+    Statement query = statement(R"(
         INSERT INTO users (username, password_hash, salt, created_at)
         VALUES (?, ?, ?, CURRENT_TIMESTAMP)
     )");
-    query.addBindValue(username);
-    query.addBindValue(passwordHash);
-    query.addBindValue(salt);
+    query->bindValue(0, username);
+    query->bindValue(1, passwordHash);
+    query->bindValue(2, salt);
     
-    return query.exec();
+    return query->exec();
 }
 
 bool DatabaseManager::authenticateUser(const QString &username, const QString &password, User &user) {
-    QSqlQuery query(m_database);
-    query.prepare("SELECT * FROM users WHERE username = ? AND is_active = 1");
-    query.addBindValue(username);
-    
-    if (!query.exec() || !query.next()) {
-        return false;
+    {
+        Statement query = statement(
+            "SELECT id, username, password_hash, salt, created_at, last_login, is_active "
+            "FROM users WHERE username = ? AND is_active = 1");
+        query->bindValue(0, username);
+        
+        if (!query->exec() || !query->next()) {
+            return false;
+        }
+        
+        user.id = query->value(0).toInt();
+        user.username = query->value(1).toString();
+        user.passwordHash = query->value(2).toByteArray();
+        user.salt = query->value(3).toByteArray();
+        user.createdAt = query->value(4).toDateTime();
+        user.lastLogin = query->value(5).toDateTime();
+        user.isActive = query->value(6).toBool();
     }
     
-    user.id = query.value("id").toInt();
-    user.username = query.value("username").toString();
-    user.passwordHash = query.value("password_hash").toByteArray();
-    user.salt = query.value("salt").toByteArray();
-    user.createdAt = query.value("created_at").toDateTime();
-    user.lastLogin = query.value("last_login").toDateTime();
-    user.isActive = query.value("is_active").toBool();
-    
     if (!verifyPassword(password, user.passwordHash, user.salt)) {
         return false;
     }
@@ -187,278 +954,958 @@ bool DatabaseManager::authenticateUser(const QString &username, const QString &p
 }
 
 bool DatabaseManager::updateUserLastLogin(int userId) {
-    QSqlQuery query(m_database);
-    query.prepare("UPDATE users SET last_login = CURRENT_TIMESTAMP WHERE id = ?");
-    query.addBindValue(userId);
-    return query.exec();
+    Statement query = statement("UPDATE users SET last_login = CURRENT_TIMESTAMP WHERE id = ?");
+    query->bindValue(0, userId);
+    return query->exec();
 }
 
 bool DatabaseManager::changePassword(int userId, const QString &newPassword) {
-    QSqlQuery query(m_database);
-    
-    // Get current salt
-    query.prepare("SELECT salt FROM users WHERE id = ?");
-    query.addBindValue(userId);
-    
-    if (!query.exec() || !query.next()) {
-        return false;
+    QByteArray salt;
+    {
+        // Get current salt
+        Statement query = statement("SELECT salt FROM users WHERE id = ?");
+        query->bindValue(0, userId);
+        
+        if (!query->exec() || !query->next()) {
+            return false;
+        }
+        salt = query->value(0).toByteArray();
     }
     
-    QByteArray salt = query.value("salt").toByteArray();
     QByteArray newPasswordHash = hashPassword(newPassword, salt);
     
     // Update password
-    query.prepare("UPDATE users SET password_hash = ? WHERE id = ?");
-    query.addBindValue(newPasswordHash);
-    query.addBindValue(userId);
+    Statement query = statement("UPDATE users SET password_hash = ? WHERE id = ?");
+    query->bindValue(0, newPasswordHash);
+    query->bindValue(1, userId);
     
-    return query.exec();
+    return query->exec();
 }
 
-bool DatabaseManager::createFile(const FileRecord &file) {
-    QSqlQuery query(m_database);
-    query.prepare(R"(
+bool DatabaseManager::createFile(FileRecord &file) {
+    if (file.dirId < 0) {
+        qDebug() << "No such directory:" << file.path;
+        return false;
+    }
+    Statement query = statement(R"(
         INSERT INTO files (filename, path, content, encrypted_content, mime_type, 
-                          size, user_id, is_encrypted, is_compressed, checksum)
-        VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?)
+                          size, user_id, is_encrypted, is_compressed, checksum, is_chunked, dir_id)
+        VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)
     )");
     
-    query.addBindValue(file.filename);
-    query.addBindValue(file.path);
-    query.addBindValue(file.content);
-    query.addBindValue(file.encryptedContent);
-    query.addBindValue(file.mimeType);
-    query.addBindValue(file.size);
-    query.addBindValue(file.userId);
-    query.addBindValue(file.isEncrypted);
-    query.addBindValue(file.isCompressed);
-    query.addBindValue(file.checksum);
+    query->bindValue(0, file.filename);
+    query->bindValue(1, file.path);
+    query->bindValue(2, file.content);
+    query->bindValue(3, file.encryptedContent);
+    query->bindValue(4, file.mimeType);
+    query->bindValue(5, file.size);
+    query->bindValue(6, file.userId);
+    query->bindValue(7, file.isEncrypted);
+    query->bindValue(8, file.isCompressed);
+    query->bindValue(9, file.checksum);
+    query->bindValue(10, file.isChunked);
+    query->bindValue(11, file.dirId);
     
-    return query.exec();
+    if (!query->exec()) {
+        return false;
+    }
+    file.id = query->lastInsertId().toInt();
+    return true;
 }
 
 bool DatabaseManager::updateFile(const FileRecord &file) {
-    QSqlQuery query(m_database);
-    query.prepare(R"(
-        UPDATE files SET 
-            filename = ?, path = ?, content = ?, encrypted_content = ?, 
-            mime_type = ?, size = ?, modified_at = CURRENT_TIMESTAMP,
-            is_encrypted = ?, is_compressed = ?, checksum = ?
-        WHERE id = ?
-    )");
+    auto update = [&] {
+        Statement query = statement(R"(
+            UPDATE files SET 
+                filename = ?, path = ?, content = ?, encrypted_content = ?, 
+                mime_type = ?, size = ?, modified_at = CURRENT_TIMESTAMP,
+                is_encrypted = ?, is_compressed = ?, checksum = ?, is_chunked = ?, dir_id = ?
+            WHERE id = ?
+        )");
+        
+        query->bindValue(0, file.filename);
+        query->bindValue(1, file.path);
+        query->bindValue(2, file.content);
+        query->bindValue(3, file.encryptedContent);
+        query->bindValue(4, file.mimeType);
+        query->bindValue(5, file.size);
+        query->bindValue(6, file.isEncrypted);
+        query->bindValue(7, file.isCompressed);
+        query->bindValue(8, file.checksum);
+        query->bindValue(9, file.isChunked);
+        query->bindValue(10, file.dirId);
+        query->bindValue(11, file.id);
+        return query->exec();
+    };
     
-    query.addBindValue(file.filename);
-    query.addBindValue(file.path);
-    query.addBindValue(file.content);
-    query.addBindValue(file.encryptedContent);
-    query.addBindValue(file.mimeType);
-    query.addBindValue(file.size);
-    query.addBindValue(file.isEncrypted);
-    query.addBindValue(file.isCompressed);
-    query.addBindValue(file.checksum);
-    query.addBindValue(file.id);
+    if (file.isChunked) {
+        return update();
+    }
     
-    return query.exec();
+    // Inline content replaces any chunks the file had; drop their references
+    if (!beginTransaction()) {
+        return false;
+    }
+    if (!update() || !deleteFileChunks(file.id) || collectUnreferencedChunks() < 0) {
+        rollbackTransaction();
+        return false;
+    }
+    return commitTransaction();
 }
 
-bool DatabaseManager::deleteFile(int fileId) {
-    QSqlQuery query(m_database);
-    query.prepare("DELETE FROM files WHERE id = ?");
-    query.addBindValue(fileId);
-    return query.exec();
+bool DatabaseManager::deleteFile(int fileId, bool collectChunks) {
+    if (!beginTransaction()) {
+        return false;
+    }
+    
+    // Chunks first: their stats trigger looks up the owner through the files row
+    Statement query = statement("DELETE FROM files WHERE id = ?");
+    query->bindValue(0, fileId);
+    if (!deleteFileChunks(fileId) || !query->exec() || (collectChunks && collectUnreferencedChunks() < 0)) {
+        rollbackTransaction();
+        return false;
+    }
+    
+    return commitTransaction();
 }
 
-bool DatabaseManager::getFile(int fileId, FileRecord &file) {
+bool DatabaseManager::moveFile(int fileId, int dirId, const QString &filename) {
+    int userId = -1;
+    bool unchanged = false;
+    {
+        Statement current = statement("SELECT user_id, dir_id, filename FROM files WHERE id = ?");
+        current->bindValue(0, fileId);
+        if (!current->exec() || !current->next()) {
+            return false;
+        }
+        userId = current->value(0).toInt();
+        unchanged = current->value(1).toInt() == dirId && current->value(2).toString() == filename;
+    }
+    // Not onto an existing file or folder (staying put under the same name is fine)
+    if (!unchanged && isNameTaken(userId, dirId, filename)) {
+        return false;
+    }
+    
+    // Metadata only: content and chunks stay where they are
+    Statement query = statement(QString(R"(
+        UPDATE files SET filename = ?1, dir_id = ?2, modified_at = CURRENT_TIMESTAMP,
+            path = COALESCE((SELECT %1 FROM directories d WHERE d.id = ?2 AND d.user_id = files.user_id), '/')
+        WHERE id = ?3 AND (?2 = 0 OR EXISTS (SELECT 1 FROM directories d WHERE d.id = ?2 AND d.user_id = files.user_id))
+    )").arg(directoryFullPath("d")));
+    query->bindValue(0, filename);
+    query->bindValue(1, dirId);
+    query->bindValue(2, fileId);
+    
+    return query->exec() && query->numRowsAffected() == 1;
+}
+
+bool DatabaseManager::copyFile(int fileId, int dirId, const QString &filename, int &newFileId) {
+    if (!beginTransaction() || !clearCopyMaps()) {
+        rollbackTransaction();
+        return false;
+    }
+    
+    {
+        Statement query = statement(QString(R"(
+            INSERT INTO files (filename, path, content, encrypted_content, mime_type, size, user_id,
+                               is_encrypted, is_compressed, checksum, is_chunked, dir_id)
+            SELECT ?1, COALESCE((SELECT %1 FROM directories d WHERE d.id = ?2 AND d.user_id = f.user_id), '/'),
+                   content, encrypted_content, mime_type, size, user_id,
+                   is_encrypted, is_compressed, checksum, is_chunked, ?2
+            FROM files f
+            WHERE f.id = ?3 AND (?2 = 0 OR EXISTS (SELECT 1 FROM directories d WHERE d.id = ?2 AND d.user_id = f.user_id))
+        )").arg(directoryFullPath("d")));
+        query->bindValue(0, filename);
+        query->bindValue(1, dirId);
+        query->bindValue(2, fileId);
+        if (!query->exec() || query->numRowsAffected() != 1) {
+            rollbackTransaction();
+            return false;
+        }
+        newFileId = query->lastInsertId().toInt();
+    }
+    
+    Statement map = statement("INSERT INTO temp.copy_files (old_id, new_id) VALUES (?, ?)");
+    map->bindValue(0, fileId);
+    map->bindValue(1, newFileId);
+    if (!map->exec() || !copyMappedChunks()) {
+        rollbackTransaction();
+        return false;
+    }
+    
+    return commitTransaction();
+}
+
+bool DatabaseManager::execStatement(const QString &sql, const QVariantList &values) {
+    Statement query = statement(sql);
+    for (int i = 0; i < values.size(); ++i) {
+        query->bindValue(i, values.at(i));
+    }
+    if (!query->exec()) {
+        qDebug() << "Statement failed:" << query->lastError().text();
+        return false;
+    }
+    return true;
+}
+
+bool DatabaseManager::clearCopyMaps() {
+    // Per-connection scratch tables mapping source rows to their copies
     QSqlQuery query(m_database);
-    query.prepare("SELECT * FROM files WHERE id = ?");
-    query.addBindValue(fileId);
+    return query.exec("CREATE TEMP TABLE IF NOT EXISTS copy_dirs (old_id INTEGER PRIMARY KEY, new_id INTEGER NOT NULL, depth INTEGER NOT NULL)") &&
+           query.exec("CREATE TEMP TABLE IF NOT EXISTS copy_files (old_id INTEGER PRIMARY KEY, new_id INTEGER NOT NULL)") &&
+           query.exec("DELETE FROM temp.copy_dirs") &&
+           query.exec("DELETE FROM temp.copy_files");
+}
+
+bool DatabaseManager::copyMappedChunks() {
+    // The copies point at the same chunk_store rows; only the references are new.
+    // Writing either copy later replaces its own file_chunks rows, which is the copy-on-write.
+    {
+        Statement query = statement(R"(
+            INSERT INTO file_chunks (file_id, chunk_index, plain_offset, plain_size, data, chunk_id)
+            SELECT m.new_id, c.chunk_index, c.plain_offset, c.plain_size, c.data, c.chunk_id
+            FROM temp.copy_files m JOIN file_chunks c ON c.file_id = m.old_id
+        )");
+        if (!query->exec()) {
+            qDebug() << "Failed to copy chunk references:" << query->lastError().text();
+            return false;
+        }
+    }
     
-    if (!query.exec() || !query.next()) {
+    Statement query = statement(R"(
+        WITH added AS (
+            SELECT c.chunk_id, COUNT(*) AS refs
+            FROM temp.copy_files m JOIN file_chunks c ON c.file_id = m.new_id
+            WHERE c.chunk_id IS NOT NULL GROUP BY c.chunk_id
+        )
+        UPDATE chunk_store SET ref_count = ref_count + (SELECT refs FROM added WHERE added.chunk_id = chunk_store.id)
+        WHERE id IN (SELECT chunk_id FROM added)
+    )");
+    if (!query->exec()) {
+        qDebug() << "Failed to reference copied chunks:" << query->lastError().text();
         return false;
     }
+    return true;
+}
+
+bool DatabaseManager::getFile(int fileId, FileRecord &file) {
+    Statement query = statement(QString("SELECT %1 FROM files WHERE id = ?").arg(FILE_RECORD_COLUMNS));
+    query->bindValue(0, fileId);
     
-    file.id = query.value("id").toInt();
-    file.filename = query.value("filename").toString();
-    file.path = query.value("path").toString();
-    file.content = query.value("content").toByteArray();
-    file.encryptedContent = query.value("encrypted_content").toByteArray();
-    file.mimeType = query.value("mime_type").toString();
-    file.size = query.value("size").toLongLong();
-    file.createdAt = query.value("created_at").toDateTime();
-    file.modifiedAt = query.value("modified_at").toDateTime();
-    file.userId = query.value("user_id").toInt();
-    file.isEncrypted = query.value("is_encrypted").toBool();
-    file.isCompressed = query.value("is_compressed").toBool();
-    file.checksum = query.value("checksum").toByteArray();
+    if (!query->exec() || !query->next()) {
+        return false;
+    }
     
+    file = readFileRecord(*query);
     return true;
 }
 
-QList<FileRecord> DatabaseManager::getFilesInDirectory(const QString &path, int userId) {
+QList<FileRecord> DatabaseManager::getFilesInDirectory(int dirId, int userId) {
     QList<FileRecord> files;
-    QSqlQuery query(m_database);
-    query.prepare("SELECT * FROM files WHERE path = ? AND user_id = ?");
-    query.addBindValue(path);
-    query.addBindValue(userId);
-    
-    if (query.exec()) {
-        while (query.next()) {
-            FileRecord file;
-            file.id = query.value("id").toInt();
-            file.filename = query.value("filename").toString();
-            file.path = query.value("path").toString();
-            file.content = query.value("content").toByteArray();
-            file.encryptedContent = query.value("encrypted_content").toByteArray();
-            file.mimeType = query.value("mime_type").toString();
-            file.size = query.value("size").toLongLong();
-            file.createdAt = query.value("created_at").toDateTime();
-            file.modifiedAt = query.value("modified_at").toDateTime();
-            file.userId = query.value("user_id").toInt();
-            file.isEncrypted = query.value("is_encrypted").toBool();
-            file.isCompressed = query.value("is_compressed").toBool();
-            file.checksum = query.value("checksum").toByteArray();
-            files.append(file);
+    Statement query = statement(QString("SELECT %1 FROM files WHERE user_id = ? AND dir_id = ?").arg(FILE_RECORD_COLUMNS));
+    query->bindValue(0, userId);
+    query->bindValue(1, dirId);
+    
+    if (query->exec()) {
+        while (query->next()) {
+            files.append(readFileRecord(*query));
         }
     }
     
     return files;
 }
 
-QList<FileRecord> DatabaseManager::searchFiles(const QString &query, int userId) {
+QList<FileRecord> DatabaseManager::searchFiles(const QString &query, int userId, int limit) {
     QList<FileRecord> files;
-    QSqlQuery sqlQuery(m_database);
-    sqlQuery.prepare("SELECT * FROM files WHERE (filename LIKE ? OR path LIKE ?) AND user_id = ?");
-    QString searchPattern = "%" + query + "%";
-    sqlQuery.addBindValue(searchPattern);
-    sqlQuery.addBindValue(searchPattern);
-    sqlQuery.addBindValue(userId);
-    
-    if (sqlQuery.exec()) {
-        while (sqlQuery.next()) {
-            FileRecord file;
-            file.id = sqlQuery.value("id").toInt();
-            file.filename = sqlQuery.value("filename").toString();
-            file.path = sqlQuery.value("path").toString();
-            file.content = sqlQuery.value("content").toByteArray();
-            file.encryptedContent = sqlQuery.value("encrypted_content").toByteArray();
-            file.mimeType = sqlQuery.value("mime_type").toString();
-            file.size = sqlQuery.value("size").toLongLong();
-            file.createdAt = sqlQuery.value("created_at").toDateTime();
-            file.modifiedAt = sqlQuery.value("modified_at").toDateTime();
-            file.userId = sqlQuery.value("user_id").toInt();
-            file.isEncrypted = sqlQuery.value("is_encrypted").toBool();
-            file.isCompressed = sqlQuery.value("is_compressed").toBool();
-            file.checksum = sqlQuery.value("checksum").toByteArray();
-            files.append(file);
+    Statement sqlQuery = searchStatement(FILE_RECORD_COLUMNS, query, userId, limit);
+    
+    if (sqlQuery->exec()) {
+        while (sqlQuery->next()) {
+            files.append(readFileRecord(*sqlQuery));
         }
     }
     
     return files;
 }
 
-bool DatabaseManager::createDirectory(const DirectoryRecord &dir) {
-    QSqlQuery query(m_database);
-    query.prepare(R"(
+bool DatabaseManager::getFileMeta(int fileId, FileMeta &meta) {
+    Statement query = statement(QString("SELECT %1 FROM files WHERE id = ?").arg(FILE_META_COLUMNS));
+    query->bindValue(0, fileId);
+    
+    if (!query->exec() || !query->next()) {
+        return false;
+    }
+    
+    meta = readFileMeta(*query);
+    return true;
+}
+
+QList<FileMeta> DatabaseManager::getFileMetaInDirectory(int dirId, int userId) {
+    QList<FileMeta> files;
+    Statement query = statement(QString("SELECT %1 FROM files WHERE user_id = ? AND dir_id = ?").arg(FILE_META_COLUMNS));
+    query->bindValue(0, userId);
+    query->bindValue(1, dirId);
+    
+    if (query->exec()) {
+        while (query->next()) {
+            files.append(readFileMeta(*query));
+        }
+    }
+    
+    return files;
+}
+
+QList<FileMeta> DatabaseManager::searchFileMeta(const QString &query, int userId, int limit) {
+    QList<FileMeta> files;
+    Statement sqlQuery = searchStatement(FILE_META_COLUMNS, query, userId, limit);
+    
+    if (sqlQuery->exec()) {
+        while (sqlQuery->next()) {
+            files.append(readFileMeta(*sqlQuery));
+        }
+    }
+    
+    return files;
+}
+
+DatabaseManager::Statement DatabaseManager::searchStatement(const char *columns, const QString &text, int userId, int limit) {
+    if (m_hasSearchIndex && text.size() >= 3) {
+        // Best matches first: bm25 ranks a hit in the filename well above one in the path
+        Statement query = statement(QString(R"(
+            SELECT %1 FROM files
+            JOIN (SELECT rowid AS hit, bm25(files_fts, 10.0, 1.0) AS score
+                  FROM files_fts WHERE files_fts MATCH ?) ON files.id = hit
+            WHERE user_id = ? ORDER BY score LIMIT ?
+        )").arg(columns));
+        QString phrase = text;
+        phrase.replace("\"", "\"\""); // one quoted phrase: no FTS5 query syntax from the user
+        query->bindValue(0, "\"" + phrase + "\"");
+        query->bindValue(1, userId);
+        query->bindValue(2, limit);
+        return query;
+    }
+    
+    // Shorter than a trigram (or no index): scan, but still stop at the limit
+    Statement query = statement(QString(
+        "SELECT %1 FROM files WHERE (filename LIKE ?1 OR path LIKE ?1) AND user_id = ?2 ORDER BY filename LIMIT ?3")
+        .arg(columns));
+    query->bindValue(0, "%" + text + "%");
+    query->bindValue(1, userId);
+    query->bindValue(2, limit);
+    return query;
+}
+
+bool DatabaseManager::getFileBlob(int fileId, QByteArray &blob) {
+    // Only the column that actually holds the stored bytes is read
+    Statement query = statement("SELECT CASE WHEN is_encrypted THEN encrypted_content ELSE content END FROM files WHERE id = ?");
+    query->bindValue(0, fileId);
+    
+    if (!query->exec() || !query->next()) {
+        return false;
+    }
+    
+    blob = query->value(0).toByteArray();
+    return true;
+}
+
+bool DatabaseManager::getFileBlobRange(int fileId, qint64 offset, qint64 length, QByteArray &data) {
+    data.clear();
+    if (offset < 0 || length < 0) {
+        return false;
+    }
+    bool isEncrypted = false;
+    {
+        Statement query = statement("SELECT is_encrypted, CASE WHEN is_encrypted THEN encrypted_content ELSE content END IS NULL FROM files WHERE id = ?");
+        query->bindValue(0, fileId);
+        if (!query->exec() || !query->next()) {
+            return false;
+        }
+        if (query->value(1).toBool()) {
+            return true; // no content
+        }
+        isEncrypted = query->value(0).toBool();
+    }
+    
+    BlobStream stream;
+    if (stream.open("files", isEncrypted ? "encrypted_content" : "content", fileId, false)) {
+        return stream.read(offset, length, data);
+    }
+    
+    // substr() trims inside SQLite (which still loads the value), only the range is handed back
+    Statement query = statement("SELECT substr(CASE WHEN is_encrypted THEN encrypted_content ELSE content END, ?2, ?3) FROM files WHERE id = ?1");
+    query->bindValue(0, fileId);
+    query->bindValue(1, offset + 1);
+    query->bindValue(2, length);
+    if (!query->exec() || !query->next()) {
+        return false;
+    }
+    data = query->value(0).toByteArray();
+    return true;
+}
+
+bool DatabaseManager::getFileBlobPrefix(int fileId, int maxBytes, QByteArray &prefix) {
+    // Only the prefix is handed back; legacy single-blob rows go through getFileBlobRange()
+    Statement query = statement(R"(
+        SELECT f.is_chunked, substr(c.data, 1, ?1), s.id, s.pack_id IS NOT NULL
+        FROM files f
+        LEFT JOIN file_chunks c ON f.is_chunked AND c.file_id = f.id AND c.chunk_index = 0
+        LEFT JOIN chunk_store s ON s.id = c.chunk_id
+        WHERE f.id = ?2
+    )");
+    query->bindValue(0, maxBytes);
+    query->bindValue(1, fileId);
+    
+    if (!query->exec() || !query->next()) {
+        return false;
+    }
+    
+    if (!query->value(0).toBool()) {
+        query->finish();
+        return getFileBlobRange(fileId, 0, maxBytes, prefix);
+    }
+    prefix = query->value(1).toByteArray();
+    if (!query->value(2).isNull()) {
+        return blobReader(query->value(3).toBool())->read(query->value(2).toLongLong(), prefix, maxBytes);
+    }
+    return true;
+}
+
+bool DatabaseManager::hasChunk(const QByteArray &hash) {
+    // Unreferenced rows may be reclaimed at any moment, so they do not count
+    Statement query = statement("SELECT 1 FROM chunk_store WHERE hash = ? AND ref_count > 0");
+    query->bindValue(0, hash);
+    return query->exec() && query->next();
+}
+
+bool DatabaseManager::writeFileChunk(int fileId, const FileChunk &chunk) {
+    if (!beginTransaction()) {
+        return false;
+    }
+    
+    // Take the new reference before releasing whatever the slot held, so rewriting
+    // a chunk with identical content never drops its ref_count to zero
+    Statement addRef = statement("UPDATE chunk_store SET ref_count = ref_count + 1 WHERE hash = ?");
+    addRef->bindValue(0, chunk.hash);
+    if (!addRef->exec()) {
+        rollbackTransaction();
+        return false;
+    }
+    
+    if (addRef->numRowsAffected() == 0) {
+        if (chunk.data.isEmpty()) {
+            qDebug() << "Chunk payload missing for unknown hash";
+            rollbackTransaction();
+            return false;
+        }
+        if (!m_blobStore->insert(chunk.hash, chunk.plainSize, chunk.data)) {
+            rollbackTransaction();
+            return false;
+        }
+    }
+    
+    if (!releaseFileChunks(fileId, chunk.index, chunk.index + 1)) {
+        rollbackTransaction();
+        return false;
+    }
+    
+    Statement link = statement(R"(
+        INSERT OR REPLACE INTO file_chunks (file_id, chunk_index, plain_offset, plain_size, data, chunk_id)
+        SELECT ?, ?, ?, ?, X'', id FROM chunk_store WHERE hash = ?
+    )");
+    
+    link->bindValue(0, fileId);
+    link->bindValue(1, chunk.index);
+    link->bindValue(2, chunk.plainOffset);
+    link->bindValue(3, chunk.plainSize);
+    link->bindValue(4, chunk.hash);
+    
+    if (!link->exec() || link->numRowsAffected() != 1) {
+        rollbackTransaction();
+        return false;
+    }
+    
+    return commitTransaction();
+}
+
+bool DatabaseManager::readFileChunks(int fileId, int firstIndex, int count, QList<FileChunk> &chunks) {
+    chunks.clear();
+    Statement query = statement(R"(
+        SELECT c.chunk_index, c.plain_offset, c.plain_size, c.data, s.hash, s.id, s.pack_id IS NOT NULL
+        FROM file_chunks c LEFT JOIN chunk_store s ON s.id = c.chunk_id
+        WHERE c.file_id = ? AND c.chunk_index >= ? AND c.chunk_index < ?
+        ORDER BY c.chunk_index
+    )");
+    query->bindValue(0, fileId);
+    query->bindValue(1, firstIndex);
+    query->bindValue(2, firstIndex + count);
+    
+    if (!query->exec()) {
+        return false;
+    }
+    
+    while (query->next()) {
+        FileChunk chunk;
+        chunk.index = query->value(0).toInt();
+        chunk.plainOffset = query->value(1).toLongLong();
+        chunk.plainSize = query->value(2).toLongLong();
+        chunk.data = query->value(3).toByteArray();
+        chunk.hash = query->value(4).toByteArray();
+        // Legacy rows carry the payload inline, shared ones live in a BlobStore
+        if (!query->value(5).isNull() && !blobReader(query->value(6).toBool())->read(query->value(5).toLongLong(), chunk.data)) {
+            return false;
+        }
+        chunks.append(chunk);
+    }
+    
+    return true;
+}
+
+bool DatabaseManager::readFileChunkLayout(int fileId, QList<FileChunk> &chunks) {
+    chunks.clear();
+    Statement query = statement("SELECT chunk_index, plain_offset, plain_size FROM file_chunks WHERE file_id = ? ORDER BY chunk_index");
+    query->bindValue(0, fileId);
+    
+    if (!query->exec()) {
+        return false;
+    }
+    
+    while (query->next()) {
+        FileChunk chunk;
+        chunk.index = query->value(0).toInt();
+        chunk.plainOffset = query->value(1).toLongLong();
+        chunk.plainSize = query->value(2).toLongLong();
+        chunks.append(chunk);
+    }
+    
+    return true;
+}
+
+int DatabaseManager::getFileChunkCount(int fileId) {
+    Statement query = statement("SELECT COUNT(*) FROM file_chunks WHERE file_id = ?");
+    query->bindValue(0, fileId);
+    
+    if (query->exec() && query->next()) {
+        return query->value(0).toInt();
+    }
+    
+    return 0;
+}
+
+bool DatabaseManager::deleteFileChunks(int fileId, int fromIndex) {
+    if (!beginTransaction()) {
+        return false;
+    }
+    
+    if (!releaseFileChunks(fileId, fromIndex, INT_MAX)) {
+        rollbackTransaction();
+        return false;
+    }
+    
+    return commitTransaction();
+}
+
+bool DatabaseManager::releaseFileChunks(int fileId, int fromIndex, int toIndex) {
+    Statement release = statement(R"(
+        UPDATE chunk_store SET ref_count = ref_count - (
+            SELECT COUNT(*) FROM file_chunks c
+            WHERE c.chunk_id = chunk_store.id AND c.file_id = ?1 AND c.chunk_index >= ?2 AND c.chunk_index < ?3
+        )
+        WHERE id IN (
+            SELECT chunk_id FROM file_chunks
+            WHERE file_id = ?1 AND chunk_index >= ?2 AND chunk_index < ?3 AND chunk_id IS NOT NULL
+        )
+    )");
+    release->bindValue(0, fileId);
+    release->bindValue(1, fromIndex);
+    release->bindValue(2, toIndex);
+    if (!release->exec()) {
+        qDebug() << "Failed to release chunk references:" << release->lastError().text();
+        return false;
+    }
+    
+    Statement remove = statement("DELETE FROM file_chunks WHERE file_id = ? AND chunk_index >= ? AND chunk_index < ?");
+    remove->bindValue(0, fileId);
+    remove->bindValue(1, fromIndex);
+    remove->bindValue(2, toIndex);
+    return remove->exec();
+}
+
+int DatabaseManager::collectUnreferencedChunks(int limit) {
+    // Deferred until the caller finished rewriting, so chunks that merely moved
+    // to a different index are re-referenced instead of deleted and re-inserted
+    Statement query = statement("DELETE FROM chunk_store WHERE id IN (SELECT id FROM chunk_store WHERE ref_count <= 0 LIMIT ?)");
+    query->bindValue(0, limit); // negative: no limit
+    if (!query->exec()) {
+        qDebug() << "Failed to collect unreferenced chunks:" << query->lastError().text();
+        return -1;
+    }
+    return query->numRowsAffected();
+}
+
+bool DatabaseManager::finishChunkedFile(int fileId, qint64 size, const QByteArray &checksum, bool isEncrypted, bool isCompressed) {
+    Statement query = statement(R"(
+        UPDATE files SET size = ?, checksum = ?, is_encrypted = ?, is_compressed = ?, is_chunked = 1,
+            content = NULL, encrypted_content = NULL, modified_at = CURRENT_TIMESTAMP
+        WHERE id = ?
+    )");
+    query->bindValue(0, size);
+    query->bindValue(1, checksum);
+    query->bindValue(2, isEncrypted);
+    query->bindValue(3, isCompressed);
+    query->bindValue(4, fileId);
+    return query->exec() && query->numRowsAffected() == 1;
+}
+
+bool DatabaseManager::setInlineContent(int fileId, const QByteArray &stored, qint64 size, const QByteArray &checksum, bool isEncrypted, bool isCompressed) {
+    Statement query = statement(R"(
+        UPDATE files SET size = ?, checksum = ?, is_encrypted = ?, is_compressed = ?, is_chunked = 0,
+            content = ?, encrypted_content = ?, modified_at = CURRENT_TIMESTAMP
+        WHERE id = ?
+    )");
+    query->bindValue(0, size);
+    query->bindValue(1, checksum);
+    query->bindValue(2, isEncrypted);
+    query->bindValue(3, isCompressed);
+    query->bindValue(4, isEncrypted ? QVariant() : QVariant(stored));
+    query->bindValue(5, isEncrypted ? QVariant(stored) : QVariant());
+    query->bindValue(6, fileId);
+    return query->exec() && query->numRowsAffected() == 1;
+}
+
+bool DatabaseManager::setInlineThreshold(qint64 bytes) {
+    if (bytes < 0 || !setVaultSetting("inline_threshold", QString::number(bytes))) {
+        return false;
+    }
+    m_inlineThreshold = bytes;
+    return true;
+}
+
+bool DatabaseManager::createDirectory(DirectoryRecord &dir) {
+    Statement query = statement(R"(
         INSERT INTO directories (name, path, parent_id, user_id, created_at, modified_at)
         VALUES (?, ?, ?, ?, CURRENT_TIMESTAMP, CURRENT_TIMESTAMP)
     )");
     
-    query.addBindValue(dir.name);
-    query.addBindValue(dir.path);
-    query.addBindValue(dir.parentId);
-    query.addBindValue(dir.userId);
+    query->bindValue(0, dir.name);
+    query->bindValue(1, dir.path);
+    query->bindValue(2, dir.parentId);
+    query->bindValue(3, dir.userId);
     
-    return query.exec();
+    if (!query->exec()) {
+        return false;
+    }
+    dir.id = query->lastInsertId().toInt();
+    return true;
 }
 
-bool DatabaseManager::getDirectory(int dirId, DirectoryRecord &dir) {
-    QSqlQuery query(m_database);
-    query.prepare("SELECT * FROM directories WHERE id = ?");
-    query.addBindValue(dirId);
+bool DatabaseManager::moveDirectory(int dirId, int parentId, const QString &name) {
+    DirectoryRecord dir;
+    if (!getDirectory(dirId, dir)) {
+        return false;
+    }
     
-    if (!query.exec() || !query.next()) {
+    QString parentPath = "/";
+    if (parentId != 0) {
+        DirectoryRecord parent;
+        if (!getDirectory(parentId, parent) || parent.userId != dir.userId) {
+            return false;
+        }
+        parentPath = parent.path.endsWith('/') ? parent.path + parent.name : parent.path + '/' + parent.name;
+    }
+    {
+        // Not into itself or below itself
+        Statement query = statement(
+            "SELECT EXISTS (SELECT 1 FROM directory_tree WHERE ancestor_id = ? AND descendant_id = ?)");
+        query->bindValue(0, dirId);
+        query->bindValue(1, parentId);
+        if (!query->exec() || !query->next() || query->value(0).toBool()) {
+            return false;
+        }
+    }
+    // Nor onto an existing file or folder (staying put under the same name is fine)
+    if ((parentId != dir.parentId || name != dir.name) && isNameTaken(dir.userId, parentId, name)) {
         return false;
     }
     
-    dir.id = query.value("id").toInt();
-    dir.name = query.value("name").toString();
-    dir.path = query.value("path").toString();
-    dir.parentId = query.value("parent_id").toInt();
-    dir.userId = query.value("user_id").toInt();
-    dir.createdAt = query.value("created_at").toDateTime();
-    dir.modifiedAt = query.value("modified_at").toDateTime();
+    const QString oldPath = dir.path.endsWith('/') ? dir.path + dir.name : dir.path + '/' + dir.name;
+    const QString newPath = parentPath.endsWith('/') ? parentPath + name : parentPath + '/' + name;
     
-    return true;
+    if (!beginTransaction()) {
+        return false;
+    }
+    
+    // One row carries the move; the closure follows by trigger. Below it only the
+    // denormalized path copies change, rewritten set-based over the subtree.
+    const bool ok =
+        execStatement("UPDATE directories SET name = ?, path = ?, parent_id = ?, modified_at = CURRENT_TIMESTAMP WHERE id = ?",
+            {name, parentPath, parentId, dirId}) &&
+        execStatement(R"(UPDATE directories SET path = ?1 || substr(path, length(?2) + 1)
+               WHERE id IN (SELECT descendant_id FROM directory_tree WHERE ancestor_id = ?3 AND depth > 0))",
+            {newPath, oldPath, dirId}) &&
+        execStatement(QString(R"(UPDATE files SET path = (SELECT %1 FROM directories d WHERE d.id = files.dir_id)
+               WHERE user_id = ?1 AND dir_id IN (SELECT descendant_id FROM directory_tree WHERE ancestor_id = ?2))").arg(directoryFullPath("d")),
+            {dir.userId, dirId});
+    if (!ok) {
+        rollbackTransaction();
+        return false;
+    }
+    
+    return commitTransaction();
 }
 
-bool DatabaseManager::deleteDirectory(int dirId) {
-    QSqlQuery query(m_database);
-    query.prepare("DELETE FROM directories WHERE id = ?");
-    query.addBindValue(dirId);
-    return query.exec();
+bool DatabaseManager::copyDirectory(int dirId, int parentId, const QString &name, int &newDirId) {
+    DirectoryRecord dir;
+    if (!getDirectory(dirId, dir)) {
+        return false;
+    }
+    
+    QString parentPath = "/";
+    if (parentId != 0) {
+        DirectoryRecord parent;
+        if (!getDirectory(parentId, parent) || parent.userId != dir.userId) {
+            return false;
+        }
+        parentPath = parent.path.endsWith('/') ? parent.path + parent.name : parent.path + '/' + parent.name;
+    }
+    if (isNameTaken(dir.userId, parentId, name)) {
+        return false;
+    }
+    {
+        // Not into itself or below itself
+        Statement query = statement("SELECT 1 FROM directory_tree WHERE ancestor_id = ? AND descendant_id = ?");
+        query->bindValue(0, dirId);
+        query->bindValue(1, parentId);
+        if (!query->exec() || query->next()) {
+            return false;
+        }
+    }
+    
+    const QString oldPath = dir.path.endsWith('/') ? dir.path + dir.name : dir.path + '/' + dir.name;
+    const QString newPath = parentPath.endsWith('/') ? parentPath + name : parentPath + '/' + name;
+    
+    if (!beginTransaction() || !clearCopyMaps()) {
+        rollbackTransaction();
+        return false;
+    }
+    
+    // Ids for the copies are handed out up front (above both the highest id and the
+    // AUTOINCREMENT sequence), so every level is one INSERT ... SELECT through the maps
+    const QString nextId = "MAX(COALESCE((SELECT seq FROM sqlite_sequence WHERE name = '%1'), 0), "
+                           "COALESCE((SELECT MAX(id) FROM %1), 0))";
+    const bool ok =
+        execStatement(QString(R"(INSERT INTO temp.copy_dirs (old_id, new_id, depth)
+               SELECT descendant_id, %1 + row_number() OVER (ORDER BY depth, descendant_id), depth
+               FROM directory_tree WHERE ancestor_id = ?)").arg(nextId.arg("directories")),
+            {dirId}) &&
+        // Parents before children: the closure trigger extends the parent's rows
+        execStatement(R"(INSERT INTO directories (id, name, path, parent_id, user_id, created_at, modified_at)
+               SELECT m.new_id,
+                   CASE WHEN m.depth = 0 THEN ?1 ELSE d.name END,
+                   CASE WHEN m.depth = 0 THEN ?2 ELSE ?3 || substr(d.path, length(?4) + 1) END,
+                   CASE WHEN m.depth = 0 THEN ?5 ELSE (SELECT p.new_id FROM temp.copy_dirs p WHERE p.old_id = d.parent_id) END,
+                   d.user_id, CURRENT_TIMESTAMP, CURRENT_TIMESTAMP
+               FROM temp.copy_dirs m JOIN directories d ON d.id = m.old_id
+               ORDER BY m.depth, m.new_id)",
+            {name, parentPath, newPath, oldPath, parentId}) &&
+        execStatement(QString(R"(INSERT INTO temp.copy_files (old_id, new_id)
+               SELECT f.id, %1 + row_number() OVER (ORDER BY f.id)
+               FROM temp.copy_dirs m JOIN files f ON f.user_id = ? AND f.dir_id = m.old_id)").arg(nextId.arg("files")),
+            {dir.userId}) &&
+        execStatement(R"(INSERT INTO files (id, filename, path, content, encrypted_content, mime_type, size, user_id,
+                                  is_encrypted, is_compressed, checksum, is_chunked, dir_id)
+               SELECT m.new_id, f.filename, ?1 || substr(f.path, length(?2) + 1),
+                   f.content, f.encrypted_content, f.mime_type, f.size, f.user_id,
+                   f.is_encrypted, f.is_compressed, f.checksum, f.is_chunked,
+                   (SELECT d.new_id FROM temp.copy_dirs d WHERE d.old_id = f.dir_id)
+               FROM temp.copy_files m JOIN files f ON f.id = m.old_id)",
+            {newPath, oldPath}) &&
+        copyMappedChunks();
+    if (!ok) {
+        rollbackTransaction();
+        return false;
+    }
+    
+    Statement query = statement("SELECT new_id FROM temp.copy_dirs WHERE old_id = ?");
+    query->bindValue(0, dirId);
+    if (!query->exec() || !query->next()) {
+        rollbackTransaction();
+        return false;
+    }
+    newDirId = query->value(0).toInt();
+    
+    return commitTransaction();
 }
 
-QList<DirectoryRecord> DatabaseManager::getDirectoriesInPath(const QString &path, int userId) {
-    QList<DirectoryRecord> directories;
-    QSqlQuery query(m_database);
-    query.prepare("SELECT * FROM directories WHERE path = ? AND user_id = ?");
-    query.addBindValue(path);
-    query.addBindValue(userId);
+bool DatabaseManager::isNameTaken(int userId, int dirId, const QString &name) {
+    Statement query = statement(R"(
+        SELECT EXISTS (SELECT 1 FROM directories WHERE user_id = ?1 AND parent_id = ?2 AND name = ?3)
+            OR EXISTS (SELECT 1 FROM files WHERE user_id = ?1 AND dir_id = ?2 AND filename = ?3)
+    )");
+    query->bindValue(0, userId);
+    query->bindValue(1, dirId);
+    query->bindValue(2, name);
     
-    if (query.exec()) {
-        while (query.next()) {
-            DirectoryRecord dir;
-            dir.id = query.value("id").toInt();
-            dir.name = query.value("name").toString();
-            dir.path = query.value("path").toString();
-            dir.parentId = query.value("parent_id").toInt();
-            dir.userId = query.value("user_id").toInt();
-            dir.createdAt = query.value("created_at").toDateTime();
-            dir.modifiedAt = query.value("modified_at").toDateTime();
-            directories.append(dir);
+    return query->exec() && query->next() && query->value(0).toBool();
+}
+
+bool DatabaseManager::findDirectory(int userId, const QString &path, int &dirId) {
+    // One indexed (user_id, parent_id, name) step per path component
+    dirId = 0;
+    const QStringList names = path.split('/', Qt::SkipEmptyParts);
+    for (const QString &name : names) {
+        Statement query = statement(
+            "SELECT id FROM directories WHERE user_id = ? AND parent_id = ? AND name = ? ORDER BY id LIMIT 1");
+        query->bindValue(0, userId);
+        query->bindValue(1, dirId);
+        query->bindValue(2, name);
+        if (!query->exec() || !query->next()) {
+            return false;
         }
+        dirId = query->value(0).toInt();
+    }
+    return true;
+}
+
+bool DatabaseManager::getDirectory(int dirId, DirectoryRecord &dir) {
+    Statement query = statement(QString("SELECT %1 FROM directories WHERE id = ?").arg(DIRECTORY_COLUMNS));
+    query->bindValue(0, dirId);
+    
+    if (!query->exec() || !query->next()) {
+        return false;
     }
     
-    return directories;
+    dir = readDirectory(*query);
+    return true;
 }
 
-qint64 DatabaseManager::getTotalStorageUsed(int userId) {
-    QSqlQuery query(m_database);
-    query.prepare("SELECT SUM(size) FROM files WHERE user_id = ?");
-    query.addBindValue(userId);
+bool DatabaseManager::deleteDirectory(int dirId) {
+    DirectoryRecord dir;
+    if (!getDirectory(dirId, dir)) {
+        return false;
+    }
+    if (!beginTransaction()) {
+        return false;
+    }
     
-    if (query.exec() && query.next()) {
-        return query.value(0).toLongLong();
+    // The whole subtree in four set-based statements over directory_tree, children
+    // first so nothing is ever orphaned. Chunk payloads only lose their references;
+    // reclaiming them is left to collectUnreferencedChunks() later.
+    const QString subtreeFiles = "SELECT f.id FROM directory_tree t JOIN files f ON f.user_id = ?2 AND f.dir_id = t.descendant_id "
+                                 "WHERE t.ancestor_id = ?1";
+    const bool ok =
+        execStatement(QString(R"(
+            WITH released AS (
+                SELECT c.chunk_id, COUNT(*) AS refs FROM file_chunks c
+                WHERE c.file_id IN (%1) AND c.chunk_id IS NOT NULL GROUP BY c.chunk_id
+            )
+            UPDATE chunk_store SET ref_count = ref_count - (SELECT refs FROM released WHERE released.chunk_id = chunk_store.id)
+            WHERE id IN (SELECT chunk_id FROM released))").arg(subtreeFiles),
+            {dirId, dir.userId}) &&
+        execStatement(QString("DELETE FROM file_chunks WHERE file_id IN (%1)").arg(subtreeFiles), {dirId, dir.userId}) &&
+        execStatement(QString("DELETE FROM files WHERE id IN (%1)").arg(subtreeFiles), {dirId, dir.userId}) &&
+        execStatement("DELETE FROM directories WHERE id IN (SELECT descendant_id FROM directory_tree WHERE ancestor_id = ?)", {dirId});
+    if (!ok) {
+        rollbackTransaction();
+        return false;
     }
     
-    return 0;
+    return commitTransaction();
 }
 
-int DatabaseManager::getFileCount(int userId) {
-    QSqlQuery query(m_database);
-    query.prepare("SELECT COUNT(*) FROM files WHERE user_id = ?");
-    query.addBindValue(userId);
+QList<DirectoryRecord> DatabaseManager::getSubdirectories(int parentId, int userId) {
+    QList<DirectoryRecord> directories;
+    Statement query = statement(QString("SELECT %1 FROM directories WHERE user_id = ? AND parent_id = ? ORDER BY name").arg(DIRECTORY_COLUMNS));
+    query->bindValue(0, userId);
+    query->bindValue(1, parentId);
     
-    if (query.exec() && query.next()) {
-        return query.value(0).toInt();
+    if (query->exec()) {
+        while (query->next()) {
+            directories.append(readDirectory(*query));
+        }
     }
     
-    return 0;
+    return directories;
 }
 
-int DatabaseManager::getDirectoryCount(int userId) {
-    QSqlQuery query(m_database);
-    query.prepare("SELECT COUNT(*) FROM directories WHERE user_id = ?");
-    query.addBindValue(userId);
+bool DatabaseManager::getUserStats(int userId, UserStats &stats) {
+    stats = UserStats();
+    Statement query = statement(
+        "SELECT file_count, directory_count, logical_bytes, stored_bytes, inline_file_count, inline_bytes FROM user_stats WHERE user_id = ?");
+    query->bindValue(0, userId);
     
-    if (query.exec() && query.next()) {
-        return query.value(0).toInt();
+    if (!query->exec()) {
+        return false;
+    }
+    if (query->next()) { // no row yet: a user without files or folders
+        stats.fileCount = query->value(0).toInt();
+        stats.directoryCount = query->value(1).toInt();
+        stats.logicalBytes = query->value(2).toLongLong();
+        stats.storedBytes = query->value(3).toLongLong();
+        stats.inlineFileCount = query->value(4).toInt();
+        stats.inlineBytes = query->value(5).toLongLong();
+    }
+    return true;
+}
+
+bool DatabaseManager::getSubtreeStats(int dirId, int userId, UserStats &stats) {
+    if (dirId == 0) {
+        return getUserStats(userId, stats); // the root's subtree is everything the user has
+    }
+    stats = UserStats();
+    {
+        Statement query = statement(QString(R"(
+            SELECT COUNT(*), COALESCE(SUM(f.size), 0),
+                COALESCE(SUM(%1 + (SELECT COALESCE(SUM(%2), 0) FROM file_chunks c WHERE c.file_id = f.id)), 0),
+                COALESCE(SUM(NOT f.is_chunked), 0), COALESCE(SUM(CASE WHEN f.is_chunked THEN 0 ELSE f.size END), 0)
+            FROM directory_tree t JOIN files f ON f.user_id = ?1 AND f.dir_id = t.descendant_id
+            WHERE t.ancestor_id = ?2
+        )").arg(inlineStoredSize("f"), chunkStoredSize("c")));
+        query->bindValue(0, userId);
+        query->bindValue(1, dirId);
+        if (!query->exec() || !query->next()) {
+            return false;
+        }
+        stats.fileCount = query->value(0).toInt();
+        stats.logicalBytes = query->value(1).toLongLong();
+        stats.storedBytes = query->value(2).toLongLong();
+        stats.inlineFileCount = query->value(3).toInt();
+        stats.inlineBytes = query->value(4).toLongLong();
     }
     
-    return 0;
+    Statement query = statement(R"(
+        SELECT COUNT(*) FROM directory_tree t JOIN directories d ON d.id = t.descendant_id
+        WHERE t.ancestor_id = ? AND t.depth > 0 AND d.user_id = ?
+    )");
+    query->bindValue(0, dirId);
+    query->bindValue(1, userId);
+    if (!query->exec() || !query->next()) {
+        return false;
+    }
+    stats.directoryCount = query->value(0).toInt();
+    return true;
+}
+
+qint64 DatabaseManager::getTotalStorageUsed(int userId) {
+    UserStats stats;
+    getUserStats(userId, stats);
+    return stats.logicalBytes;
+}
+
+int DatabaseManager::getFileCount(int userId) {
+    UserStats stats;
+    getUserStats(userId, stats);
+    return stats.fileCount;
+}
+
+int DatabaseManager::getDirectoryCount(int userId) {
+    UserStats stats;
+    getUserStats(userId, stats);
+    return stats.directoryCount;
 }
 
 void DatabaseManager::closeDatabase() {
+    ++m_connectionGeneration; // worker threads drop their read connections on next use
+    t_connection.clearStatements();
     if (m_database.isValid() && m_database.isOpen()) {
         qDebug() << "Closing database:" << m_dbPath;
         m_database.close();
@@ -467,11 +1914,21 @@ void DatabaseManager::closeDatabase() {
         QSqlDatabase::removeDatabase(m_connectionName);
     }
     m_isInitialized = false;
-    m_dbPath.clear();
+    m_hasSearchIndex = false;
+    m_blobStore = m_inlineBlobs.get();
+    m_packs.close();
+    m_transactionDepth = 0;
+    m_packRemovals.clear();
+    {
+        QMutexLocker locker(&m_pathMutex);
+        m_dbPath.clear();
+    }
 }
 
 bool DatabaseManager::reopenDatabase(const QString &dbPath) {
     qDebug() << "Reopening database:" << dbPath;
+    ++m_connectionGeneration;
+    t_connection.clearStatements();
     
     // Close existing connection if open
     if (m_database.isValid() && m_database.isOpen()) {
@@ -484,17 +1941,26 @@ bool DatabaseManager::reopenDatabase(const QString &dbPath) {
     }
     
     m_isInitialized = false;
-    m_dbPath = dbPath;
+    m_transactionDepth = 0;
+    m_packRemovals.clear();
+    m_blobStore = m_inlineBlobs.get();
+    m_packs.close();
+    {
+        QMutexLocker locker(&m_pathMutex);
+        m_dbPath = dbPath;
+    }
     
     // Create new connection
     m_database = QSqlDatabase::addDatabase("QSQLITE", m_connectionName);
     m_database.setDatabaseName(m_dbPath);
+    m_database.setConnectOptions(WRITER_CONNECT_OPTIONS);
     
     if (!m_database.open()) {
         qDebug() << "Failed to reopen database:" << m_database.lastError().text();
         qDebug() << "Database path:" << m_dbPath;
         return false;
     }
+    enableWriteAheadLog();
     
     qDebug() << "Successfully reopened database:" << m_dbPath;
     m_isInitialized = true;
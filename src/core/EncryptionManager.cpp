@@ -4,17 +4,52 @@
 #include <QDebug>
 #include <QFile>
 #include <QIODevice>
+#include <QtEndian>
+#include <QThread>
+#include <QThreadPool>
+#include <QSemaphore>
 
 #include <openssl/evp.h>
 #include <openssl/rand.h>
 #include <openssl/err.h>
+#include <openssl/hmac.h>
 #include <openssl/crypto.h>
 #include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstring>
 
 namespace {
     constexpr const char* MAGIC = "SVFENC"; // 6 bytes
     constexpr unsigned char VERSION = 1;
 
+    // Version 2 (AEAD ciphers only): the payload is a sequence of independently
+    // authenticated segments, each ciphertext followed by its 16-byte tag.
+    //   magic(6) | version=2 | alg | flags | nonceLen=12 | baseNonce(12) | segmentSize(4, LE) | segments...
+    // Segment i uses nonce = baseNonce XOR big-endian i (low 8 bytes). The AAD is the
+    // header followed by a final-segment byte, so header edits, reordering and
+    // truncation all fail authentication.
+    constexpr unsigned char VERSION_SEGMENTED = 2;
+    constexpr int SEGMENT_SIZE = 64 * 1024;
+    constexpr int SEGMENT_TAG_SIZE = 16;
+    constexpr int SEGMENT_NONCE_SIZE = 12;
+    constexpr int SEGMENTED_HEADER_SIZE = 10 + SEGMENT_NONCE_SIZE + 4;
+    constexpr quint32 MAX_SEGMENT_SIZE = 16 * 1024 * 1024;
+    // Below this many segments per thread, handing work to the pool costs more than it saves
+    constexpr qint64 MIN_SEGMENTS_PER_TASK = 4;
+    // Segments read and processed together by encryptFile/decryptFile
+    constexpr qint64 FILE_BATCH_SEGMENTS = 64;
+
+    // Own pool: callers may themselves be running on the global pool
+    QThreadPool* segmentPool() {
+        static QThreadPool *pool = [] {
+            auto *p = new QThreadPool();
+            p->setMaxThreadCount(QThread::idealThreadCount());
+            return p;
+        }();
+        return pool;
+    }
+
     // Map ALG code to OpenSSL cipher
     const EVP_CIPHER* cipherForAlgCode(unsigned char algCode) {
         switch (algCode) {
@@ -33,6 +68,67 @@ namespace {
             default: return 1;
         }
     }
+
+    EncryptionManager::EncryptionAlgorithm enumForAlgCode(unsigned char algCode) {
+        switch (algCode) {
+            case 1: return EncryptionManager::AES_256_CBC;
+            case 3: return EncryptionManager::ChaCha20_Poly1305;
+            default: return EncryptionManager::AES_256_GCM;
+        }
+    }
+
+    void writeSegmentedHeader(char *out, unsigned char algCode, unsigned char flags) {
+        std::memcpy(out, MAGIC, 6);
+        out[6] = char(VERSION_SEGMENTED);
+        out[7] = char(algCode);
+        out[8] = char(flags);
+        out[9] = char(SEGMENT_NONCE_SIZE);
+        RAND_bytes(reinterpret_cast<unsigned char*>(out + 10), SEGMENT_NONCE_SIZE);
+        qToLittleEndian<quint32>(SEGMENT_SIZE, out + 10 + SEGMENT_NONCE_SIZE);
+    }
+
+    // ctx must already carry cipher and key; only the nonce changes per segment
+    bool cryptSegment(EVP_CIPHER_CTX *ctx, bool encrypt, const unsigned char *baseNonce, quint64 index,
+                      const unsigned char *header, int headerLen, bool final,
+                      const unsigned char *in, int inLen, unsigned char *out, unsigned char *tag) {
+        unsigned char nonce[SEGMENT_NONCE_SIZE];
+        std::memcpy(nonce, baseNonce, SEGMENT_NONCE_SIZE);
+        for (int i = 0; i < 8; ++i) {
+            nonce[SEGMENT_NONCE_SIZE - 1 - i] ^= static_cast<unsigned char>((index >> (8 * i)) & 0xff);
+        }
+        const unsigned char finalByte = final ? 1 : 0;
+        int len = 0;
+        if (!EVP_CipherInit_ex(ctx, nullptr, nullptr, nullptr, nonce, -1) ||
+            !EVP_CipherUpdate(ctx, nullptr, &len, header, headerLen) ||
+            !EVP_CipherUpdate(ctx, nullptr, &len, &finalByte, 1)) {
+            return false;
+        }
+        if (!encrypt && !EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, SEGMENT_TAG_SIZE, tag)) {
+            return false;
+        }
+        int outLen = 0;
+        if (inLen > 0 && !EVP_CipherUpdate(ctx, out, &outLen, in, inLen)) {
+            return false;
+        }
+        int finalLen = 0;
+        if (!EVP_CipherFinal_ex(ctx, out + outLen, &finalLen)) {
+            return false;
+        }
+        return !encrypt || EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, SEGMENT_TAG_SIZE, tag);
+    }
+
+    // Keyed contexts per thread, indexed by algorithm code and direction. A context
+    // whose generation no longer matches EncryptionManager::m_keyGeneration is re-keyed.
+    struct ThreadContexts {
+        EVP_CIPHER_CTX *ctx[4][2] = {};
+        quint64 generation[4][2] = {};
+        ~ThreadContexts() {
+            for (auto &row : ctx) {
+                for (EVP_CIPHER_CTX *c : row) EVP_CIPHER_CTX_free(c);
+            }
+        }
+    };
+    thread_local ThreadContexts t_contexts;
 }
 
 EncryptionManager& EncryptionManager::instance() {
@@ -41,6 +137,7 @@ EncryptionManager& EncryptionManager::instance() {
 }
 
 bool EncryptionManager::generateKey(const QString &password, const QByteArray &salt) {
+    clearKey();
     m_derivedKey = deriveKey(password, salt);
     m_keyLoaded = !m_derivedKey.isEmpty();
     return m_keyLoaded;
@@ -56,6 +153,13 @@ void EncryptionManager::clearKey() {
     }
     m_derivedKey.clear();
     m_keyLoaded = false;
+    // Cached contexts hold the key schedule: wipe this thread's now, pool threads re-key on next use
+    ++m_keyGeneration;
+    for (auto &row : t_contexts.ctx) {
+        for (EVP_CIPHER_CTX *c : row) {
+            if (c) EVP_CIPHER_CTX_reset(c);
+        }
+    }
 }
 
 bool EncryptionManager::isKeyLoaded() const {
@@ -77,6 +181,84 @@ QByteArray EncryptionManager::deriveKey(const QString &password, const QByteArra
     return key;
 }
 
+EVP_CIPHER_CTX* EncryptionManager::keyedContext(unsigned char algCode, bool encrypt) {
+    const EVP_CIPHER *cipher = cipherForAlgCode(algCode);
+    if (!cipher || !m_keyLoaded || m_derivedKey.size() < EVP_CIPHER_key_length(cipher)) {
+        return nullptr;
+    }
+
+    EVP_CIPHER_CTX *&ctx = t_contexts.ctx[algCode][encrypt ? 1 : 0];
+    quint64 &generation = t_contexts.generation[algCode][encrypt ? 1 : 0];
+    const quint64 current = m_keyGeneration.load();
+    if (ctx && generation == current) {
+        return ctx;
+    }
+    if (!ctx && !(ctx = EVP_CIPHER_CTX_new())) {
+        return nullptr;
+    }
+    if (!EVP_CipherInit_ex(ctx, cipher, nullptr, reinterpret_cast<const unsigned char*>(m_derivedKey.constData()),
+                           nullptr, encrypt ? 1 : 0)) {
+        generation = 0;
+        return nullptr;
+    }
+    generation = current;
+    return ctx;
+}
+
+bool EncryptionManager::parseHeader(const char *data, qint64 size, HeaderView &view) {
+    view = HeaderView();
+    if (!data || size < 10 || std::memcmp(data, MAGIC, 6) != 0) {
+        return false;
+    }
+    const unsigned char *p = reinterpret_cast<const unsigned char*>(data);
+    view.version = p[6];
+    view.algCode = p[7];
+    view.flags = p[8];
+    view.ivLen = p[9];
+    view.iv = p + 10;
+    view.header = p;
+    const EVP_CIPHER *cipher = cipherForAlgCode(view.algCode);
+    if (!cipher) {
+        return false;
+    }
+    const bool aead = view.algCode != 1;
+
+    if (view.version == VERSION_SEGMENTED) {
+        if (!aead || view.ivLen != SEGMENT_NONCE_SIZE || size < SEGMENTED_HEADER_SIZE) {
+            return false;
+        }
+        view.tagLen = SEGMENT_TAG_SIZE;
+        view.segmentSize = qFromLittleEndian<quint32>(p + 10 + SEGMENT_NONCE_SIZE);
+        view.headerLen = SEGMENTED_HEADER_SIZE;
+    } else {
+        // Version 1: the IV and tag lengths must match the cipher
+        if (view.version != VERSION || view.ivLen != EVP_CIPHER_iv_length(cipher) || size < 11 + view.ivLen) {
+            return false;
+        }
+        view.tagLen = p[10 + view.ivLen];
+        view.tag = p + 11 + view.ivLen;
+        view.headerLen = 11 + view.ivLen + view.tagLen;
+        if (view.tagLen != (aead ? SEGMENT_TAG_SIZE : 0) || size < view.headerLen) {
+            return false;
+        }
+    }
+    view.payload = p + view.headerLen;
+    view.payloadLen = size - view.headerLen;
+    return view.version != VERSION_SEGMENTED || (view.segmentSize > 0 && view.segmentSize <= MAX_SEGMENT_SIZE);
+}
+
+bool EncryptionManager::parseSegmentLayout(HeaderView &view) {
+    // Every segment carries a tag, the last one may be short
+    const qint64 unit = qint64(view.segmentSize) + SEGMENT_TAG_SIZE;
+    view.segmentCount = (view.payloadLen + unit - 1) / unit;
+    const qint64 lastUnit = view.payloadLen - (view.segmentCount - 1) * unit;
+    if (view.segmentCount == 0 || lastUnit < SEGMENT_TAG_SIZE) {
+        return false;
+    }
+    view.plainSize = (view.segmentCount - 1) * view.segmentSize + lastUnit - SEGMENT_TAG_SIZE;
+    return true;
+}
+
 QByteArray EncryptionManager::encrypt(const QByteArray &data, EncryptionAlgorithm algorithm) {
     if (!m_keyLoaded) {
         qWarning() << "EncryptionManager: No key loaded";
@@ -91,127 +273,48 @@ QByteArray EncryptionManager::encrypt(const QByteArray &data, EncryptionAlgorith
 }
 
 QByteArray EncryptionManager::decrypt(const QByteArray &encryptedData, EncryptionAlgorithm /*algorithm*/) {
-    if (!m_keyLoaded) {
-        qWarning() << "EncryptionManager: No key loaded";
-        return {};
-    }
-    // Auto-detect from header
-    if (encryptedData.size() < 10) return {};
-    if (QByteArray(encryptedData.constData(), 6) != MAGIC) return {};
-    unsigned char algCode = static_cast<unsigned char>(encryptedData[7]);
-    switch (algCode) {
-        case 1: return decryptAES256CBC(encryptedData);
-        case 2: return decryptAES256GCM(encryptedData);
-        case 3: return decryptChaCha20Poly1305(encryptedData);
-        default: return {};
-    }
+    // Algorithm and format version are auto-detected from the header
+    QByteArray plain;
+    unsigned char flags = 0;
+    EncryptionAlgorithm detected;
+    return decryptAndGetFlags(encryptedData, plain, flags, detected) ? plain : QByteArray();
 }
 
 QByteArray EncryptionManager::encryptAES256CBC(const QByteArray &data) {
-    QByteArray iv(16, 0);
-    RAND_bytes(reinterpret_cast<unsigned char*>(iv.data()), iv.size());
-    QByteArray tag; // none for CBC
-    QByteArray payload = evpEncrypt(data, EVP_aes_256_cbc(), iv, tag);
-    if (payload.isEmpty()) return {};
-    QByteArray out;
-    out.append(MAGIC);
-    out.append(char(VERSION));
-    out.append(char(1)); // alg code
-    out.append(char(0)); // flags
-    out.append(char(iv.size()));
-    out.append(iv);
-    out.append(char(0)); // tag length
-    out.append(payload);
-    return out;
-}
-
-QByteArray EncryptionManager::decryptAES256CBC(const QByteArray &encryptedData) {
-    if (encryptedData.size() < 10) return {};
-    if (QByteArray(encryptedData.constData(), 6) != MAGIC) return {};
-    int ivLen = static_cast<unsigned char>(encryptedData[9]);
-    int offset = 10;
-    if (encryptedData.size() < offset + ivLen + 1) return {};
-    QByteArray iv = encryptedData.mid(offset, ivLen);
-    offset += ivLen;
-    int tagLen = static_cast<unsigned char>(encryptedData[offset++]); Q_UNUSED(tagLen);
-    QByteArray payload = encryptedData.mid(offset);
-    bool ok = false;
-    QByteArray plain = evpDecrypt(payload, EVP_aes_256_cbc(), iv, {}, ok);
-    return ok ? plain : QByteArray();
+    return encryptV1(data, 1, 0);
 }
 
 QByteArray EncryptionManager::encryptAES256GCM(const QByteArray &data) {
-    QByteArray iv(12, 0);
-    RAND_bytes(reinterpret_cast<unsigned char*>(iv.data()), iv.size());
-    QByteArray tag;
-    QByteArray payload = evpEncrypt(data, EVP_aes_256_gcm(), iv, tag);
-    if (payload.isEmpty() || tag.isEmpty()) return {};
-    QByteArray out;
-    out.append(MAGIC);
-    out.append(char(VERSION));
-    out.append(char(2)); // alg code
-    out.append(char(0)); // flags
-    out.append(char(iv.size()));
-    out.append(iv);
-    out.append(char(tag.size()));
-    out.append(tag);
-    out.append(payload);
-    return out;
-}
-
-QByteArray EncryptionManager::decryptAES256GCM(const QByteArray &encryptedData) {
-    if (encryptedData.size() < 10) return {};
-    if (QByteArray(encryptedData.constData(), 6) != MAGIC) return {};
-    int ivLen = static_cast<unsigned char>(encryptedData[9]);
-    int offset = 10;
-    if (encryptedData.size() < offset + ivLen + 1) return {};
-    QByteArray iv = encryptedData.mid(offset, ivLen);
-    offset += ivLen;
-    int tagLen = static_cast<unsigned char>(encryptedData[offset++]);
-    if (encryptedData.size() < offset + tagLen) return {};
-    QByteArray tag = encryptedData.mid(offset, tagLen);
-    offset += tagLen;
-    QByteArray payload = encryptedData.mid(offset);
-    bool ok = false;
-    QByteArray plain = evpDecrypt(payload, EVP_aes_256_gcm(), iv, tag, ok);
-    return ok ? plain : QByteArray();
+    return encryptSegmented(data, 2, 0);
 }
 
 QByteArray EncryptionManager::encryptChaCha20Poly1305(const QByteArray &data) {
-    QByteArray iv(12, 0);
-    RAND_bytes(reinterpret_cast<unsigned char*>(iv.data()), iv.size());
-    QByteArray tag;
-    QByteArray payload = evpEncrypt(data, EVP_chacha20_poly1305(), iv, tag);
-    if (payload.isEmpty() || tag.isEmpty()) return {};
-    QByteArray out;
-    out.append(MAGIC);
-    out.append(char(VERSION));
-    out.append(char(3)); // alg code
-    out.append(char(0)); // flags
-    out.append(char(iv.size()));
-    out.append(iv);
-    out.append(char(tag.size()));
-    out.append(tag);
-    out.append(payload);
-    return out;
+    return encryptSegmented(data, 3, 0);
 }
 
-QByteArray EncryptionManager::decryptChaCha20Poly1305(const QByteArray &encryptedData) {
-    if (encryptedData.size() < 10) return {};
-    if (QByteArray(encryptedData.constData(), 6) != MAGIC) return {};
-    int ivLen = static_cast<unsigned char>(encryptedData[9]);
-    int offset = 10;
-    if (encryptedData.size() < offset + ivLen + 1) return {};
-    QByteArray iv = encryptedData.mid(offset, ivLen);
-    offset += ivLen;
-    int tagLen = static_cast<unsigned char>(encryptedData[offset++]);
-    if (encryptedData.size() < offset + tagLen) return {};
-    QByteArray tag = encryptedData.mid(offset, tagLen);
-    offset += tagLen;
-    QByteArray payload = encryptedData.mid(offset);
-    bool ok = false;
-    QByteArray plain = evpDecrypt(payload, EVP_chacha20_poly1305(), iv, tag, ok);
-    return ok ? plain : QByteArray();
+QByteArray EncryptionManager::keyedHash(const QByteArray &data, const QByteArray &domain) {
+    if (!m_keyLoaded) {
+        qWarning() << "EncryptionManager: No key loaded";
+        return {};
+    }
+    // Never use the cipher key directly: derive a per-domain MAC key first
+    unsigned char subkey[EVP_MAX_MD_SIZE];
+    unsigned int subkeyLen = 0;
+    const QByteArray label = QByteArray("SVFS keyed hash:") + domain;
+    if (!HMAC(EVP_sha256(), m_derivedKey.constData(), m_derivedKey.size(),
+              reinterpret_cast<const unsigned char*>(label.constData()), label.size(),
+              subkey, &subkeyLen)) {
+        return {};
+    }
+    QByteArray mac(EVP_MAX_MD_SIZE, 0);
+    unsigned int macLen = 0;
+    const bool ok = HMAC(EVP_sha256(), subkey, subkeyLen,
+                         reinterpret_cast<const unsigned char*>(data.constData()), data.size(),
+                         reinterpret_cast<unsigned char*>(mac.data()), &macLen) != nullptr;
+    OPENSSL_cleanse(subkey, sizeof(subkey));
+    if (!ok) return {};
+    mac.resize(macLen);
+    return mac;
 }
 
 QByteArray EncryptionManager::generateRandomBytes(int size) {
@@ -230,31 +333,119 @@ bool EncryptionManager::verifyChecksum(const QByteArray &data, const QByteArray
 }
 
 bool EncryptionManager::encryptFile(const QString &inputPath, const QString &outputPath, EncryptionAlgorithm algorithm) {
+    if (!m_keyLoaded) {
+        qWarning() << "EncryptionManager: No key loaded";
+        return false;
+    }
     QFile in(inputPath);
     if (!in.open(QIODevice::ReadOnly)) return false;
-    QByteArray plain = in.readAll();
-    in.close();
-    QByteArray enc = encrypt(plain, algorithm);
-    if (enc.isEmpty()) return false;
     QFile out(outputPath);
     if (!out.open(QIODevice::WriteOnly)) return false;
-    qint64 n = out.write(enc);
+
+    if (algorithm == AES_256_CBC) {
+        QByteArray enc = encrypt(in.readAll(), algorithm);
+        return !enc.isEmpty() && out.write(enc) == enc.size();
+    }
+
+    // Segmented format, streamed
+    const unsigned char algCode = algCodeForEnum(algorithm);
+    char header[SEGMENTED_HEADER_SIZE];
+    writeSegmentedHeader(header, algCode, 0);
+    const unsigned char *headerBytes = reinterpret_cast<const unsigned char*>(header);
+
+    // Batches of segments are encrypted in parallel, memory stays at one batch
+    const qint64 unit = SEGMENT_SIZE + SEGMENT_TAG_SIZE;
+    QByteArray encrypted(FILE_BATCH_SEGMENTS * unit, Qt::Uninitialized);
+    bool ok = out.write(header, SEGMENTED_HEADER_SIZE) == SEGMENTED_HEADER_SIZE;
+    qint64 index = 0;
+    bool final = false;
+    while (ok && !final) {
+        const QByteArray plain = in.read(FILE_BATCH_SEGMENTS * SEGMENT_SIZE);
+        final = in.atEnd();
+        if ((plain.isEmpty() && !final) || (!final && plain.size() % SEGMENT_SIZE != 0)) {
+            ok = false; // read error or short read
+            break;
+        }
+
+        const qint64 segments = qMax<qint64>(1, (plain.size() + SEGMENT_SIZE - 1) / SEGMENT_SIZE);
+        const unsigned char *src = reinterpret_cast<const unsigned char*>(plain.constData());
+        unsigned char *dst = reinterpret_cast<unsigned char*>(encrypted.data());
+        ok = forEachSegment(algCode, true, index, index + segments - 1, [&](EVP_CIPHER_CTX *ctx, qint64 i) {
+            const qint64 k = i - index;
+            const int len = int(qMin<qint64>(SEGMENT_SIZE, plain.size() - k * SEGMENT_SIZE));
+            unsigned char *segment = dst + k * unit;
+            return cryptSegment(ctx, true, headerBytes + 10, quint64(i), headerBytes, SEGMENTED_HEADER_SIZE,
+                                final && k == segments - 1, src + k * SEGMENT_SIZE, len, segment, segment + len);
+        });
+        const qint64 bytes = plain.size() + segments * SEGMENT_TAG_SIZE;
+        ok = ok && out.write(encrypted.constData(), bytes) == bytes;
+        index += segments;
+    }
+
     out.close();
-    return n == enc.size();
+    if (!ok) out.remove();
+    return ok;
 }
 
 bool EncryptionManager::decryptFile(const QString &inputPath, const QString &outputPath, EncryptionAlgorithm /*algorithm*/) {
+    if (!m_keyLoaded) {
+        qWarning() << "EncryptionManager: No key loaded";
+        return false;
+    }
     QFile in(inputPath);
     if (!in.open(QIODevice::ReadOnly)) return false;
-    QByteArray enc = in.readAll();
-    in.close();
-    QByteArray plain = decrypt(enc, AES_256_CBC); // alg autodetected in decrypt()
-    if (plain.isEmpty()) return false;
+
+    const QByteArray prefix = in.peek(SEGMENTED_HEADER_SIZE);
+    HeaderView header;
+    if (!parseHeader(prefix.constData(), prefix.size(), header) || header.version != VERSION_SEGMENTED) {
+        // Version 1: single tag over the whole payload
+        QByteArray plain = decrypt(in.readAll(), AES_256_CBC); // alg autodetected in decrypt()
+        if (plain.isEmpty()) return false;
+        QFile out(outputPath);
+        if (!out.open(QIODevice::WriteOnly)) return false;
+        qint64 n = out.write(plain);
+        out.close();
+        return n == plain.size();
+    }
+
     QFile out(outputPath);
     if (!out.open(QIODevice::WriteOnly)) return false;
-    qint64 n = out.write(plain);
+    in.skip(header.headerLen);
+
+    const qint64 unit = qint64(header.segmentSize) + SEGMENT_TAG_SIZE;
+    QByteArray plain(FILE_BATCH_SEGMENTS * header.segmentSize, Qt::Uninitialized);
+    bool ok = true;
+    qint64 index = 0;
+    bool final = false;
+    while (ok && !final) {
+        QByteArray encrypted = in.read(FILE_BATCH_SEGMENTS * unit);
+        final = in.atEnd();
+        const qint64 segments = (encrypted.size() + unit - 1) / unit;
+        const qint64 lastLen = encrypted.size() - (segments - 1) * unit - SEGMENT_TAG_SIZE;
+        // Only the final segment may be short
+        if (segments == 0 || lastLen < 0 || (!final && lastLen != qint64(header.segmentSize))) {
+            ok = false;
+            break;
+        }
+
+        unsigned char *src = reinterpret_cast<unsigned char*>(encrypted.data());
+        unsigned char *dst = reinterpret_cast<unsigned char*>(plain.data());
+        ok = forEachSegment(header.algCode, false, index, index + segments - 1, [&](EVP_CIPHER_CTX *ctx, qint64 i) {
+            const qint64 k = i - index;
+            const int len = k == segments - 1 ? int(lastLen) : int(header.segmentSize);
+            unsigned char *segment = src + k * unit;
+            return cryptSegment(ctx, false, header.iv, quint64(i), header.header, header.headerLen,
+                                final && k == segments - 1, segment, len, dst + k * header.segmentSize, segment + len);
+        });
+        // Plaintext is only written once every segment of the batch authenticated
+        const qint64 bytes = (segments - 1) * header.segmentSize + lastLen;
+        ok = ok && out.write(plain.constData(), bytes) == bytes;
+        index += segments;
+    }
+
     out.close();
-    return n == plain.size();
+    if (!ok) out.remove();
+    return ok;
 }
 
 QString EncryptionManager::getAlgorithmName(EncryptionAlgorithm algorithm) const {
@@ -285,187 +476,233 @@ QByteArray EncryptionManager::encryptWithFlags(const QByteArray &data, Encryptio
         qWarning() << "EncryptionManager: No key loaded";
         return {};
     }
-    
-    // Build header with custom flags
-    const EVP_CIPHER *cipher = nullptr;
-    int ivSize = 12;
-    unsigned char algCode = 0;
-    
-    switch (algorithm) {
-        case AES_256_CBC:
-            cipher = EVP_aes_256_cbc();
-            ivSize = 16;
-            algCode = 1;
-            break;
-        case AES_256_GCM:
-            cipher = EVP_aes_256_gcm();
-            ivSize = 12;
-            algCode = 2;
-            break;
-        case ChaCha20_Poly1305:
-            cipher = EVP_chacha20_poly1305();
-            ivSize = 12;
-            algCode = 3;
-            break;
-        default:
-            cipher = EVP_aes_256_gcm();
-            algCode = 2;
-            ivSize = 12;
-    }
-    
-    QByteArray iv(ivSize, 0);
-    RAND_bytes(reinterpret_cast<unsigned char*>(iv.data()), iv.size());
-    QByteArray tag;
-    QByteArray payload = evpEncrypt(data, cipher, iv, tag);
-    if (payload.isEmpty()) return {};
-    
-    QByteArray out;
-    out.append("SVFENC");           // magic (6)
-    out.append(char(1));            // version
-    out.append(char(algCode));      // algorithm
-    out.append(char(flags));        // FLAGS (bit 0 = compressed)
-    out.append(char(iv.size()));
-    out.append(iv);
-    out.append(char(tag.size()));
-    if (!tag.isEmpty()) out.append(tag);
-    out.append(payload);
-    return out;
+
+    // AEAD ciphers use the segmented format; CBC has no tag to segment and stays on version 1
+    const unsigned char algCode = algCodeForEnum(algorithm);
+    if (algCode != 1) {
+        return encryptSegmented(data, algCode, flags);
+    }
+    return encryptV1(data, algCode, flags);
 }
 
 bool EncryptionManager::decryptAndGetFlags(const QByteArray &encryptedData, QByteArray &plaintext, unsigned char &flags, EncryptionAlgorithm &detectedAlg) {
     plaintext.clear();
     flags = 0;
     detectedAlg = AES_256_GCM;
-    
+
     if (!m_keyLoaded) {
         qWarning() << "EncryptionManager: No key loaded";
         return false;
     }
-    if (encryptedData.size() < 10) return false;
-    if (QByteArray(encryptedData.constData(), 6) != "SVFENC") return false;
-    
-    const char *p = encryptedData.constData();
-    // unsigned char ver = p[6]; // unused for now
-    unsigned char algCode = static_cast<unsigned char>(p[7]);
-    flags = static_cast<unsigned char>(p[8]);
-    int ivLen = static_cast<unsigned char>(p[9]);
-    int offset = 10;
-    
-    if (encryptedData.size() < offset + ivLen + 1) return false;
-    QByteArray iv = encryptedData.mid(offset, ivLen);
-    offset += ivLen;
-    
-    int tagLen = static_cast<unsigned char>(encryptedData[offset++]);
-    QByteArray tag;
-    if (tagLen > 0) {
-        if (encryptedData.size() < offset + tagLen) return false;
-        tag = encryptedData.mid(offset, tagLen);
-        offset += tagLen;
-    }
-    
-    QByteArray payload = encryptedData.mid(offset);
-    
-    const EVP_CIPHER *cipher = nullptr;
-    switch (algCode) {
-        case 1:
-            cipher = EVP_aes_256_cbc();
-            detectedAlg = AES_256_CBC;
-            break;
-        case 2:
-            cipher = EVP_aes_256_gcm();
-            detectedAlg = AES_256_GCM;
-            break;
-        case 3:
-            cipher = EVP_chacha20_poly1305();
-            detectedAlg = ChaCha20_Poly1305;
-            break;
-        default:
-            return false;
+    const qint64 capacity = plaintextCapacity(encryptedData.constData(), encryptedData.size());
+    if (capacity < 0) return false;
+
+    // Single allocation for the plaintext, the blob itself is read in place
+    plaintext.resize(capacity);
+    const qint64 n = decryptInto(encryptedData.constData(), encryptedData.size(), plaintext.data(), capacity, &flags);
+    if (n < 0) {
+        plaintext.clear();
+        return false;
     }
-    
-    bool ok = false;
-    plaintext = evpDecrypt(payload, cipher, iv, tag, ok);
-    return ok && !plaintext.isEmpty();
+    plaintext.resize(n);
+    detectedAlg = enumForAlgCode(static_cast<unsigned char>(encryptedData[7]));
+    return true;
 }
 
-QByteArray EncryptionManager::evpEncrypt(const QByteArray &data, const EVP_CIPHER *cipher, QByteArray &iv, QByteArray &tag) {
-    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
-    if (!ctx) return {};
-    QByteArray key = m_derivedKey.left(EVP_CIPHER_key_length(cipher));
-    if (iv.isEmpty()) {
-        iv.resize(EVP_CIPHER_iv_length(cipher));
-        if (iv.size() > 0) RAND_bytes(reinterpret_cast<unsigned char*>(iv.data()), iv.size());
+bool EncryptionManager::probeHeader(const QByteArray &data, HeaderInfo &info) const {
+    info = HeaderInfo();
+    HeaderView view;
+    if (!parseHeader(data.constData(), data.size(), view)) {
+        return false;
     }
-    if (!EVP_EncryptInit_ex(ctx, cipher, nullptr,
-                            reinterpret_cast<const unsigned char*>(key.constData()),
-                            reinterpret_cast<const unsigned char*>(iv.constData()))) {
-        EVP_CIPHER_CTX_free(ctx);
-        return {};
+    info.version = view.version;
+    info.algorithm = enumForAlgCode(view.algCode);
+    info.flags = view.flags;
+    info.ivLength = view.ivLen;
+    info.tagLength = view.tagLen;
+    return true;
+}
+
+qint64 EncryptionManager::plaintextCapacity(const char *data, qint64 size) const {
+    HeaderView view;
+    if (!parseHeader(data, size, view)) return -1;
+    if (view.version == VERSION_SEGMENTED) {
+        return parseSegmentLayout(view) ? view.plainSize : -1;
     }
+    // Version 1 CBC padding is only known after decryption
+    return view.payloadLen;
+}
 
-    QByteArray out;
-    out.resize(int(data.size()) + EVP_CIPHER_block_size(cipher));
-    int outLen1 = 0;
-    if (!EVP_EncryptUpdate(ctx, reinterpret_cast<unsigned char*>(out.data()), &outLen1,
-                           reinterpret_cast<const unsigned char*>(data.constData()), data.size())) {
-        EVP_CIPHER_CTX_free(ctx);
-        return {};
+qint64 EncryptionManager::decryptInto(const char *data, qint64 size, char *out, qint64 capacity, unsigned char *flags) {
+    if (!m_keyLoaded) {
+        qWarning() << "EncryptionManager: No key loaded";
+        return -1;
     }
+    HeaderView view;
+    if (!parseHeader(data, size, view)) return -1;
+    if (flags) *flags = view.flags;
+    unsigned char *dst = reinterpret_cast<unsigned char*>(out);
+
+    if (view.version == VERSION_SEGMENTED) {
+        if (!parseSegmentLayout(view) || capacity < view.plainSize) return -1;
+        return decryptSegments(view, 0, view.segmentCount - 1, dst) ? view.plainSize : -1;
+    }
+
+    // Version 1: one tag (if any) over the whole payload
+    if (capacity < view.payloadLen || view.payloadLen > INT_MAX) return -1;
+    EVP_CIPHER_CTX *ctx = keyedContext(view.algCode, false);
+    if (!ctx || !EVP_CipherInit_ex(ctx, nullptr, nullptr, nullptr, view.iv, -1)) return -1;
+    if (view.tagLen > 0 &&
+        !EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, view.tagLen, const_cast<unsigned char*>(view.tag))) {
+        return -1;
+    }
+    int outLen1 = 0;
     int outLen2 = 0;
-    if (!EVP_EncryptFinal_ex(ctx, reinterpret_cast<unsigned char*>(out.data() + outLen1), &outLen2)) {
-        EVP_CIPHER_CTX_free(ctx);
-        return {};
+    if (!EVP_CipherUpdate(ctx, dst, &outLen1, view.payload, int(view.payloadLen)) ||
+        !EVP_CipherFinal_ex(ctx, dst + outLen1, &outLen2)) {
+        return -1;
     }
-    out.resize(outLen1 + outLen2);
+    return qint64(outLen1) + outLen2;
+}
 
-    // Fetch tag for AEAD ciphers
-    if (EVP_CIPHER_mode(cipher) == EVP_CIPH_GCM_MODE || cipher == EVP_chacha20_poly1305()) {
-        tag.resize(16);
-        if (!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, tag.size(), tag.data())) {
-            EVP_CIPHER_CTX_free(ctx);
-            return {};
+bool EncryptionManager::decryptRange(const QByteArray &encryptedData, qint64 offset, qint64 length,
+                                     QByteArray &plaintext, qint64 &plaintextOffset) {
+    plaintext.clear();
+    plaintextOffset = 0;
+    if (!m_keyLoaded) {
+        qWarning() << "EncryptionManager: No key loaded";
+        return false;
+    }
+    HeaderView view;
+    if (!parseHeader(encryptedData.constData(), encryptedData.size(), view)) {
+        return false;
+    }
+    if (view.version != VERSION_SEGMENTED) {
+        // Version 1 has a single tag over everything
+        unsigned char flags = 0;
+        EncryptionAlgorithm alg;
+        if (!decryptAndGetFlags(encryptedData, plaintext, flags, alg)) {
+            return false;
         }
+        return offset >= 0 && (length < 0 || offset + length <= plaintext.size());
     }
-    EVP_CIPHER_CTX_free(ctx);
-    return out;
-}
 
-QByteArray EncryptionManager::evpDecrypt(const QByteArray &enc, const EVP_CIPHER *cipher, const QByteArray &iv, const QByteArray &tag, bool &okOut) {
-    okOut = false;
-    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
-    if (!ctx) return {};
-    QByteArray key = m_derivedKey.left(EVP_CIPHER_key_length(cipher));
-    if (!EVP_DecryptInit_ex(ctx, cipher, nullptr,
-                            reinterpret_cast<const unsigned char*>(key.constData()),
-                            reinterpret_cast<const unsigned char*>(iv.constData()))) {
-        EVP_CIPHER_CTX_free(ctx);
-        return {};
+    if (!parseSegmentLayout(view)) {
+        return false;
+    }
+    if (length < 0) {
+        length = view.plainSize - offset;
     }
-    // For AEAD, set expected tag before final
-    if ((EVP_CIPHER_mode(cipher) == EVP_CIPH_GCM_MODE || cipher == EVP_chacha20_poly1305()) && !tag.isEmpty()) {
-        if (!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, tag.size(), const_cast<char*>(tag.constData()))) {
-            EVP_CIPHER_CTX_free(ctx);
-            return {};
+    if (offset < 0 || length < 0 || offset + length > view.plainSize) {
+        return false;
+    }
+
+    // An empty range still authenticates the segment it falls in
+    const qint64 first = qMin(offset / view.segmentSize, view.segmentCount - 1);
+    const qint64 last = length > 0 ? (offset + length - 1) / view.segmentSize : first;
+    const qint64 firstPlain = first * view.segmentSize;
+    const qint64 endPlain = qMin(view.plainSize, (last + 1) * qint64(view.segmentSize));
+
+    plaintext.resize(endPlain - firstPlain);
+    if (!decryptSegments(view, first, last, reinterpret_cast<unsigned char*>(plaintext.data()))) {
+        plaintext.clear();
+        return false;
+    }
+    plaintextOffset = firstPlain;
+    return true;
+}
+
+bool EncryptionManager::forEachSegment(unsigned char algCode, bool encrypt, qint64 first, qint64 last,
+                                       const std::function<bool(EVP_CIPHER_CTX *ctx, qint64 index)> &work) {
+    const qint64 count = last - first + 1;
+    const int tasks = int(qBound<qint64>(1, count / MIN_SEGMENTS_PER_TASK, segmentPool()->maxThreadCount()));
+    std::atomic<bool> ok{true};
+
+    // Contiguous batches on each thread's cached context; batch 0 runs on the calling thread
+    auto runBatch = [&](int task) {
+        EVP_CIPHER_CTX *ctx = keyedContext(algCode, encrypt);
+        bool batchOk = ctx != nullptr;
+        const qint64 begin = first + count * task / tasks;
+        const qint64 end = first + count * (task + 1) / tasks;
+        for (qint64 i = begin; batchOk && i < end && ok.load(std::memory_order_relaxed); ++i) {
+            batchOk = work(ctx, i);
         }
+        if (!batchOk) ok = false;
+    };
+
+    QSemaphore done;
+    for (int task = 1; task < tasks; ++task) {
+        segmentPool()->start([&, task] {
+            runBatch(task);
+            done.release();
+        });
     }
+    runBatch(0);
+    done.acquire(tasks - 1);
+    return ok;
+}
+
+QByteArray EncryptionManager::encryptSegmented(const QByteArray &data, unsigned char algCode, unsigned char flags) {
+    // Header and segments are written straight into the output buffer
+    const qint64 segmentCount = qMax<qint64>(1, (data.size() + SEGMENT_SIZE - 1) / SEGMENT_SIZE);
+    QByteArray out(SEGMENTED_HEADER_SIZE + data.size() + segmentCount * SEGMENT_TAG_SIZE, Qt::Uninitialized);
+    writeSegmentedHeader(out.data(), algCode, flags);
+
+    const unsigned char *header = reinterpret_cast<const unsigned char*>(out.constData());
+    const unsigned char *in = reinterpret_cast<const unsigned char*>(data.constData());
+    unsigned char *payload = reinterpret_cast<unsigned char*>(out.data()) + SEGMENTED_HEADER_SIZE;
+    bool ok = forEachSegment(algCode, true, 0, segmentCount - 1, [&](EVP_CIPHER_CTX *ctx, qint64 i) {
+        const qint64 begin = i * SEGMENT_SIZE;
+        const int len = int(qMin<qint64>(SEGMENT_SIZE, data.size() - begin));
+        unsigned char *dst = payload + i * (SEGMENT_SIZE + SEGMENT_TAG_SIZE);
+        return cryptSegment(ctx, true, header + 10, quint64(i), header, SEGMENTED_HEADER_SIZE,
+                            i == segmentCount - 1, in + begin, len, dst, dst + len);
+    });
+
+    return ok ? out : QByteArray();
+}
+
+bool EncryptionManager::decryptSegments(const HeaderView &view, qint64 first, qint64 last, unsigned char *out) {
+    const qint64 unit = qint64(view.segmentSize) + SEGMENT_TAG_SIZE;
+    return forEachSegment(view.algCode, false, first, last, [&](EVP_CIPHER_CTX *ctx, qint64 i) {
+        const int len = int(qMin<qint64>(view.segmentSize, view.plainSize - i * view.segmentSize));
+        const unsigned char *src = view.payload + i * unit;
+        return cryptSegment(ctx, false, view.iv, quint64(i), view.header, view.headerLen,
+                            i == view.segmentCount - 1, src, len, out + (i - first) * view.segmentSize,
+                            const_cast<unsigned char*>(src + len));
+    });
+}
+
+QByteArray EncryptionManager::encryptV1(const QByteArray &data, unsigned char algCode, unsigned char flags) {
+    const EVP_CIPHER *cipher = cipherForAlgCode(algCode);
+    EVP_CIPHER_CTX *ctx = keyedContext(algCode, true);
+    if (!cipher || !ctx) return {};
+
+    // magic(6) | version | alg | flags | ivLen | iv | tagLen | tag | payload, built in one buffer
+    const int ivLen = EVP_CIPHER_iv_length(cipher);
+    const int tagLen = algCode == 1 ? 0 : SEGMENT_TAG_SIZE;
+    const int headerLen = 11 + ivLen + tagLen;
+    QByteArray out(headerLen + data.size() + EVP_CIPHER_block_size(cipher), Qt::Uninitialized);
+    unsigned char *p = reinterpret_cast<unsigned char*>(out.data());
+    std::memcpy(p, MAGIC, 6);
+    p[6] = VERSION;
+    p[7] = algCode;
+    p[8] = flags;
+    p[9] = static_cast<unsigned char>(ivLen);
+    RAND_bytes(p + 10, ivLen);
+    p[10 + ivLen] = static_cast<unsigned char>(tagLen);
 
-    QByteArray out;
-    out.resize(enc.size());
     int outLen1 = 0;
-    if (!EVP_DecryptUpdate(ctx, reinterpret_cast<unsigned char*>(out.data()), &outLen1,
-                           reinterpret_cast<const unsigned char*>(enc.constData()), enc.size())) {
-        EVP_CIPHER_CTX_free(ctx);
+    int outLen2 = 0;
+    unsigned char *payload = p + headerLen;
+    if (!EVP_CipherInit_ex(ctx, nullptr, nullptr, nullptr, p + 10, -1) ||
+        !EVP_CipherUpdate(ctx, payload, &outLen1, reinterpret_cast<const unsigned char*>(data.constData()), data.size()) ||
+        !EVP_CipherFinal_ex(ctx, payload + outLen1, &outLen2)) {
         return {};
     }
-    int outLen2 = 0;
-    if (!EVP_DecryptFinal_ex(ctx, reinterpret_cast<unsigned char*>(out.data() + outLen1), &outLen2)) {
-        EVP_CIPHER_CTX_free(ctx);
+    if (tagLen > 0 && !EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, tagLen, p + 11 + ivLen)) {
         return {};
     }
-    out.resize(outLen1 + outLen2);
-    EVP_CIPHER_CTX_free(ctx);
-    okOut = true;
+    out.resize(headerLen + outLen1 + outLen2);
     return out;
 }
-
-
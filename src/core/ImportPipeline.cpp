@@ -0,0 +1,361 @@
+#include "ImportPipeline.h"
+#include <QFile>
+#include <QThread>
+#include <QPair>
+#include <QMetaObject>
+#include <QCryptographicHash>
+#include <QDebug>
+#include "ContentChunker.h"
+#include "VFSManager.h"
+
+namespace {
+    constexpr int QUEUE_DEPTH_PER_WORKER = 2; // chunks in flight per CPU worker and queue
+    constexpr int WRITE_BATCH_ITEMS = 256;    // queue items taken per drain before yielding to the event loop
+}
+
+ImportPipeline::ImportPipeline(QObject *parent)
+    : QObject(parent),
+      m_workers(qMax(1, QThread::idealThreadCount())),
+      m_compressQueue(m_workers * QUEUE_DEPTH_PER_WORKER),
+      m_encryptQueue(m_workers * QUEUE_DEPTH_PER_WORKER),
+      m_writeQueue(m_workers * QUEUE_DEPTH_PER_WORKER) {
+    // Reader plus one thread per worker in each of the two CPU stages
+    m_pool.setMaxThreadCount(1 + 2 * m_workers);
+    connect(&m_batch, &BatchWriter::flushed, this, &ImportPipeline::batchFlushed);
+}
+
+ImportPipeline::~ImportPipeline() {
+    cancel();
+    // Nobody drains the writer queue any more: closing it releases blocked workers
+    m_compressQueue.close();
+    m_encryptQueue.close();
+    m_writeQueue.close();
+    m_pool.waitForDone();
+    // Files written in full are kept, the rest go; the last batch is committed either way
+    disconnect(&m_batch, nullptr, this, nullptr);
+    for (auto it = m_open.begin(); it != m_open.end(); ++it) {
+        if (it.value().failed || it.value().cancelled || !m_closing.contains(it.key())) {
+            discardFile(it.value());
+        }
+    }
+    m_batch.flush();
+}
+
+bool ImportPipeline::start(const QList<ImportJob> &jobs, bool encrypt, bool compress) {
+    if (m_started || jobs.isEmpty() || VFSManager::instance().getCurrentUserId() == -1) {
+        return false;
+    }
+    m_started = true;
+    m_running = true;
+    m_jobs = jobs;
+    m_encrypt = encrypt;
+    m_compress = compress;
+    m_inlineThreshold = DatabaseManager::instance().inlineThreshold();
+    m_processing = VFSManager::instance().processing();
+    m_timer.start();
+
+    m_compressWorkers = m_workers;
+    m_pool.start([this] { readFiles(); });
+    for (int i = 0; i < m_workers; ++i) {
+        m_pool.start([this] { compressStage(); });
+        m_pool.start([this] { encryptStage(); });
+    }
+    return true;
+}
+
+void ImportPipeline::cancel() {
+    m_cancelled.store(true);
+}
+
+void ImportPipeline::readFiles() {
+    for (int i = 0; i < m_jobs.size(); ++i) {
+        Item end;
+        end.file = i;
+        end.end = true;
+
+        QFile file(m_jobs.at(i).sourcePath);
+        if (m_cancelled.load()) {
+            end.cancelled = true;
+        } else if (!file.open(QIODevice::ReadOnly)) {
+            qWarning() << "ImportPipeline: Cannot open" << file.fileName() << ":" << file.errorString();
+            end.failed = true;
+        } else {
+            QCryptographicHash hash(QCryptographicHash::Sha256);
+            ContentChunker chunker(file);
+            QByteArray plain;
+            const bool inlined = file.size() > 0 && file.size() <= m_inlineThreshold;
+            if (inlined) {
+                // Small enough for the row: one item, no chunker
+                Item item;
+                item.file = i;
+                item.inlined = true;
+                item.plain = file.read(m_inlineThreshold);
+                hash.addData(item.plain);
+                end.size = item.plain.size();
+                end.chunkCount = 1;
+                end.failed = item.plain.size() != file.size();
+                if (!m_compressQueue.push(std::move(item))) {
+                    return;
+                }
+            }
+            while (!inlined && !m_cancelled.load() && chunker.next(plain)) {
+                Item item;
+                item.file = i;
+                item.chunk.index = end.chunkCount++;
+                item.chunk.plainOffset = end.size;
+                item.chunk.plainSize = plain.size();
+                hash.addData(plain);
+                end.size += plain.size();
+                item.plain = plain;
+                if (!m_compressQueue.push(std::move(item))) {
+                    return; // shutting down
+                }
+            }
+            if (chunker.hasError()) {
+                qWarning() << "ImportPipeline: Failed to read" << file.fileName() << ":" << file.errorString();
+                end.failed = true;
+            }
+            end.cancelled = m_cancelled.load();
+            end.checksum = hash.result();
+        }
+
+        // Straight to the writer: it matches the marker with the chunks by count
+        if (!m_writeQueue.push(std::move(end))) {
+            return;
+        }
+        scheduleDrain();
+    }
+    m_compressQueue.close();
+}
+
+void ImportPipeline::compressStage() {
+    VFSManager &vfs = VFSManager::instance();
+    Item item;
+    while (m_compressQueue.pop(item)) {
+        if (m_cancelled.load()) {
+            item.cancelled = true;
+        } else if (item.inlined) {
+            // Stored in the file's row: no chunk key, nothing to deduplicate
+            item.chunk.data = m_compress ? vfs.compressContent(item.plain, m_processing) : item.plain;
+            item.failed = item.chunk.data.isEmpty();
+        } else {
+            // The key is over the plaintext, so it is taken here before the data changes
+            item.chunk.hash = vfs.chunkKey(item.plain, m_encrypt, m_compress, m_processing);
+            if (item.chunk.hash.isEmpty()) {
+                item.failed = true;
+            } else if (DatabaseManager::instance().hasChunk(item.chunk.hash)) {
+                // Committed already: nothing to compress or encrypt. The plaintext stays
+                // with the item in case the chunk is collected before the writer links it.
+                item.chunk.data.clear();
+            } else {
+                item.chunk.data = m_compress ? vfs.compressContent(item.plain, m_processing) : item.plain;
+                item.failed = item.chunk.data.isEmpty();
+            }
+        }
+        if (!item.chunk.data.isEmpty() || item.failed || item.cancelled) {
+            item.plain.clear();
+        }
+        if (!m_encryptQueue.push(std::move(item))) {
+            break;
+        }
+    }
+    // The last compress worker out ends the encrypt stage's input
+    if (--m_compressWorkers == 0) {
+        m_encryptQueue.close();
+    }
+}
+
+void ImportPipeline::encryptStage() {
+    VFSManager &vfs = VFSManager::instance();
+    Item item;
+    while (m_encryptQueue.pop(item)) {
+        if (m_cancelled.load()) {
+            item.cancelled = true;
+        } else if (m_encrypt && !item.failed && !item.chunk.data.isEmpty()) {
+            item.chunk.data = vfs.encryptContent(item.chunk.data, m_compress, m_processing);
+            item.failed = item.chunk.data.isEmpty();
+        }
+        if (!m_writeQueue.push(std::move(item))) {
+            break;
+        }
+        scheduleDrain();
+    }
+}
+
+void ImportPipeline::scheduleDrain() {
+    // At most one drain queued at a time; it takes whatever has piled up by then
+    if (!m_drainScheduled.exchange(true)) {
+        QMetaObject::invokeMethod(this, [this] { drainWrites(); }, Qt::QueuedConnection);
+    }
+}
+
+void ImportPipeline::drainWrites() {
+    m_drainScheduled.store(false);
+    Item item;
+    int items = 0;
+    while (items < WRITE_BATCH_ITEMS && m_writeQueue.tryPop(item)) {
+        ++items;
+        const int file = item.file;
+        // A write may end the batch and settle files, so no reference into m_open is kept across one
+        auto step = [&](const std::function<bool(OpenFile &)> &work) {
+            const bool ok = m_batch.write([&] {
+                OpenFile &state = m_open[file];
+                const int fileId = state.fileId;
+                m_touched.insert(file);
+                const bool done = work(state);
+                if (!done) {
+                    // The step's rows are rolled back, including a row it created
+                    state.failed = true;
+                    state.fileId = fileId;
+                }
+                return done;
+            });
+            if (!ok && m_open.contains(file)) {
+                m_open[file].failed = true; // the batch could not even be opened
+            }
+        };
+
+        step([&](OpenFile &state) { return writeItem(item, state); });
+        const OpenFile &current = m_open[file];
+        if (current.chunkCount >= 0 && current.chunksSeen == current.chunkCount && !m_closing.contains(file)) {
+            m_closing.append(file);
+            step([&](OpenFile &state) { return closeFile(file, state); });
+        }
+    }
+
+    // Committed before going back to the event loop: an open batch would take in every
+    // other write the GUI makes meanwhile and roll it back with itself if its commit failed.
+    // The group is whatever piled up in the queue since the last drain.
+    const bool done = m_closed + m_closing.size() == m_jobs.size();
+    if (m_batch.pendingRows() > 0) {
+        m_batch.flush();
+    } else if (done) {
+        batchFlushed(0, true);
+    }
+    if (!done && items == WRITE_BATCH_ITEMS) {
+        // More may be waiting; yield to the event loop between batches
+        scheduleDrain();
+    }
+}
+
+void ImportPipeline::batchFlushed(int rows, bool committed) {
+    Q_UNUSED(rows);
+    // Files closed in the batch only count once it is committed
+    for (int file : std::as_const(m_closing)) {
+        const OpenFile state = m_open.take(file);
+        ++m_closed;
+        if (committed && !state.failed && !state.cancelled) {
+            ++m_imported;
+            m_bytes += state.size;
+            emit VFSManager::instance().fileCreated(state.fileId, m_jobs.at(file).filename);
+        } else {
+            if (!committed) {
+                discardFile(state); // the row may predate this batch
+            }
+            if (!state.cancelled) {
+                ++m_failed;
+            }
+        }
+    }
+    m_closing.clear();
+    if (!committed) {
+        qWarning() << "ImportPipeline: Batch commit failed, affected files are dropped";
+        for (int file : std::as_const(m_touched)) {
+            if (m_open.contains(file)) {
+                // The row went with the batch (or goes now, if it predates it); its id
+                // may be handed out again, so it must not be deleted later
+                OpenFile &state = m_open[file];
+                state.failed = true;
+                discardFile(state);
+                state.fileId = -1;
+            }
+        }
+    }
+    m_touched.clear();
+
+    emit progress(m_imported, m_failed, m_jobs.size(), m_bytes);
+
+    if (m_running && m_closed == m_jobs.size()) {
+        m_pool.waitForDone(); // every stage has seen its queue close by now
+        m_running = false;
+        emit finished(m_imported, m_failed, m_bytes, m_timer.elapsed(), m_cancelled.load());
+    }
+}
+
+bool ImportPipeline::writeItem(Item &item, OpenFile &state) {
+    if (item.cancelled) {
+        state.cancelled = true;
+    }
+    if (item.end) {
+        state.chunkCount = item.chunkCount;
+        state.size = item.size;
+        state.checksum = item.checksum;
+        return !item.failed;
+    }
+
+    ++state.chunksSeen;
+    if (item.failed || state.failed || state.cancelled) {
+        return !item.failed;
+    }
+    if (item.inlined) {
+        state.inlined = true;
+        state.inlineData = item.chunk.data;
+        return true;
+    }
+    // The row is created with the first chunk that arrives, whichever index it has
+    if (!createRow(item.file, state)) {
+        return false;
+    }
+    DatabaseManager &db = DatabaseManager::instance();
+    if (item.chunk.data.isEmpty() && !db.hasChunk(item.chunk.hash)) {
+        // Collected since the worker found it; the collector runs on this thread, so
+        // the chunk cannot go again before writeFileChunk() takes its reference
+        item.chunk.data = VFSManager::instance().processContent(item.plain, m_encrypt, m_compress, m_processing);
+        if (item.chunk.data.isEmpty()) {
+            return false;
+        }
+    }
+    item.plain.clear();
+    // A chunk already in the store keeps its stored payload; this one is dropped
+    return db.writeFileChunk(state.fileId, item.chunk);
+}
+
+bool ImportPipeline::createRow(int file, OpenFile &state) {
+    if (state.fileId != -1) {
+        return true;
+    }
+    const ImportJob &job = m_jobs.at(file);
+    FileRecord record = VFSManager::instance().newFileRecord(job.filename, job.vfsPath, m_encrypt, m_compress);
+    if (!DatabaseManager::instance().createFile(record)) {
+        return false;
+    }
+    state.fileId = record.id;
+    return true;
+}
+
+bool ImportPipeline::closeFile(int file, OpenFile &state) {
+    DatabaseManager &db = DatabaseManager::instance();
+    if (state.failed || state.cancelled) {
+        return state.fileId == -1 || db.deleteFile(state.fileId);
+    }
+    if (state.inlined) {
+        const ImportJob &job = m_jobs.at(file);
+        VFSManager &vfs = VFSManager::instance();
+        FileRecord record = vfs.newFileRecord(job.filename, job.vfsPath, m_encrypt, m_compress);
+        vfs.inlineFileRecord(record, state.inlineData, state.size, state.checksum);
+        if (!db.createFile(record)) {
+            return false;
+        }
+        state.fileId = record.id;
+        return true;
+    }
+    // An empty file has no chunk that would have created the row
+    return createRow(file, state) &&
+           db.finishChunkedFile(state.fileId, state.size, state.checksum, m_encrypt, m_compress);
+}
+
+void ImportPipeline::discardFile(const OpenFile &state) {
+    if (state.fileId != -1) {
+        DatabaseManager::instance().deleteFile(state.fileId);
+    }
+}
@@ -0,0 +1,289 @@
+#include "PackStore.h"
+#include <QDir>
+#include <QFileInfo>
+#include <QDebug>
+#include <QtEndian>
+#include <cstring>
+#ifdef Q_OS_WIN
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+    const char PACK_MAGIC[8] = {'S', 'V', 'P', 'A', 'C', 'K', '0', '1'};
+    const char RECORD_MAGIC[4] = {'S', 'V', 'P', 'R'};
+    constexpr qint64 RECORD_HEADER_SIZE = 16; // magic, payload length (LE32), checksum (LE64)
+    const char *PACK_NAME_FILTER = "pack-*.svpk";
+
+    // Pack id from "pack-000042.svpk"; 0 if the name does not match
+    int packIdFromName(const QString &name) {
+        bool ok = false;
+        const int id = name.mid(5, name.size() - 10).toInt(&ok);
+        return ok ? id : 0;
+    }
+
+    bool syncFile(QFile &file) {
+        if (!file.flush()) {
+            return false;
+        }
+#ifdef Q_OS_WIN
+        return ::_commit(file.handle()) == 0;
+#else
+        return ::fsync(file.handle()) == 0;
+#endif
+    }
+}
+
+PackStore::~PackStore() {
+    close();
+}
+
+bool PackStore::open(const QString &directory) {
+    close();
+    QMutexLocker locker(&m_mutex);
+    QDir dir(directory);
+    if (!dir.mkpath(".")) {
+        qWarning() << "PackStore: Cannot create" << directory;
+        return false;
+    }
+    m_directory = dir.absolutePath();
+
+    // Appends continue in the newest pack
+    int newest = 0;
+    const QStringList names = dir.entryList({PACK_NAME_FILTER}, QDir::Files);
+    for (const QString &name : names) {
+        newest = qMax(newest, packIdFromName(name));
+    }
+    if (!openAppendPack(qMax(1, newest))) {
+        m_directory.clear();
+        return false;
+    }
+    return true;
+}
+
+void PackStore::close() {
+    QMutexLocker locker(&m_mutex);
+    if (m_append.isOpen()) {
+        syncFile(m_append);
+        m_append.close();
+    }
+    qDeleteAll(m_readers);
+    m_readers.clear();
+    m_mappings.clear(); // readers still copying keep theirs until they are done
+    m_mapFailed = false;
+    m_directory.clear();
+    m_appendId = 0;
+    m_unflushed = false;
+    m_unsynced = false;
+}
+
+bool PackStore::isOpen() const {
+    QMutexLocker locker(&m_mutex);
+    return m_append.isOpen();
+}
+
+bool PackStore::append(const QByteArray &data, PackLocation &location) {
+    QMutexLocker locker(&m_mutex);
+    if (!m_append.isOpen()) {
+        return false;
+    }
+    const qint64 recordSize = RECORD_HEADER_SIZE + data.size();
+    if (m_append.pos() > qint64(sizeof(PACK_MAGIC)) && m_append.pos() + recordSize > MAX_PACK_BYTES) {
+        // The full pack must be durable before anything in the next one is
+        if (!syncFile(m_append) || !openAppendPack(m_appendId + 1)) {
+            return false;
+        }
+    }
+
+    char header[RECORD_HEADER_SIZE];
+    const quint64 sum = checksum(data.constData(), data.size());
+    std::memcpy(header, RECORD_MAGIC, sizeof(RECORD_MAGIC));
+    qToLittleEndian<quint32>(quint32(data.size()), header + 4);
+    qToLittleEndian<quint64>(sum, header + 8);
+
+    location.packId = m_appendId;
+    location.offset = m_append.pos();
+    location.length = data.size();
+    location.checksum = sum;
+    if (m_append.write(header, RECORD_HEADER_SIZE) != RECORD_HEADER_SIZE || m_append.write(data) != data.size()) {
+        qWarning() << "PackStore: Append failed:" << m_append.errorString();
+        return false;
+    }
+    m_unflushed = true;
+    m_unsynced = true;
+    return true;
+}
+
+bool PackStore::sync() {
+    QMutexLocker locker(&m_mutex);
+    if (!m_unsynced) {
+        return true;
+    }
+    if (!syncFile(m_append)) {
+        qWarning() << "PackStore: Sync failed:" << m_append.errorString();
+        return false;
+    }
+    m_unflushed = false;
+    m_unsynced = false;
+    return true;
+}
+
+bool PackStore::read(const PackLocation &location, QByteArray &data) {
+    QMutexLocker locker(&m_mutex);
+    if (location.packId == m_appendId && m_unflushed) {
+        // Written through the append handle's buffer; make it visible to the reader
+        if (!m_append.flush()) {
+            return false;
+        }
+        m_unflushed = false;
+    }
+
+    char header[RECORD_HEADER_SIZE];
+    if (const std::shared_ptr<Mapping> mapping = mapped(location)) {
+        // Pinned by our reference: the copy (and any page faults) need no lock
+        locker.unlock();
+        const char *record = mapping->base + location.offset;
+        std::memcpy(header, record, RECORD_HEADER_SIZE);
+        data = QByteArray(record + RECORD_HEADER_SIZE, location.length);
+    } else {
+        // The append pack, or a pack that cannot be mapped: through the shared reader
+        QFile *file = reader(location.packId);
+        if (!file || !file->seek(location.offset) || file->read(header, RECORD_HEADER_SIZE) != RECORD_HEADER_SIZE) {
+            return false;
+        }
+        data = file->read(location.length);
+        locker.unlock();
+    }
+    if (std::memcmp(header, RECORD_MAGIC, sizeof(RECORD_MAGIC)) != 0 ||
+        qFromLittleEndian<quint32>(header + 4) != quint64(location.length)) {
+        qWarning() << "PackStore: Bad record in pack" << location.packId << "at" << location.offset;
+        data.clear();
+        return false;
+    }
+    if (data.size() != location.length || checksum(data.constData(), data.size()) != location.checksum) {
+        qWarning() << "PackStore: Checksum mismatch in pack" << location.packId << "at" << location.offset;
+        data.clear();
+        return false;
+    }
+    return true;
+}
+
+QList<int> PackStore::packIds() const {
+    QMutexLocker locker(&m_mutex);
+    QList<int> ids;
+    if (m_directory.isEmpty()) {
+        return ids;
+    }
+    const QStringList names = QDir(m_directory).entryList({PACK_NAME_FILTER}, QDir::Files, QDir::Name);
+    for (const QString &name : names) {
+        if (const int id = packIdFromName(name)) {
+            ids.append(id);
+        }
+    }
+    return ids;
+}
+
+int PackStore::appendPackId() const {
+    QMutexLocker locker(&m_mutex);
+    return m_appendId;
+}
+
+qint64 PackStore::packSize(int packId) const {
+    QMutexLocker locker(&m_mutex);
+    return QFileInfo(packPath(packId)).size();
+}
+
+bool PackStore::removePack(int packId) {
+    QMutexLocker locker(&m_mutex);
+    if (packId == m_appendId) {
+        return false;
+    }
+    delete m_readers.take(packId);
+    m_mappings.remove(packId);
+    return QFile::remove(packPath(packId));
+}
+
+quint64 PackStore::checksum(const char *data, qsizetype size) {
+    // FNV-1a over 64-bit words: catches torn and corrupted records at memory speed.
+    // Tampering is the cipher's job (GCM/Poly1305 tags), not this one's.
+    constexpr quint64 PRIME = 0x100000001B3ULL;
+    quint64 hash = 0xCBF29CE484222325ULL;
+    qsizetype i = 0;
+    for (; i + 8 <= size; i += 8) {
+        quint64 word;
+        std::memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ qFromLittleEndian(word)) * PRIME;
+    }
+    for (; i < size; ++i) {
+        hash = (hash ^ uchar(data[i])) * PRIME;
+    }
+    return hash;
+}
+
+QString PackStore::packPath(int packId) const {
+    return m_directory + QString("/pack-%1.svpk").arg(packId, 6, 10, QChar('0'));
+}
+
+bool PackStore::openAppendPack(int packId) {
+    if (m_append.isOpen()) {
+        m_append.close();
+    }
+    m_append.setFileName(packPath(packId));
+    if (!m_append.open(QIODevice::ReadWrite)) {
+        qWarning() << "PackStore: Cannot open" << m_append.fileName() << ":" << m_append.errorString();
+        return false;
+    }
+    if (m_append.size() == 0) {
+        if (m_append.write(PACK_MAGIC, sizeof(PACK_MAGIC)) != qint64(sizeof(PACK_MAGIC)) || !syncFile(m_append)) {
+            m_append.close();
+            return false;
+        }
+    }
+    // A torn record at the end from a crash is left as it is: nothing references it
+    m_append.seek(m_append.size());
+    m_appendId = packId;
+    m_unflushed = false;
+    m_unsynced = false;
+    return true;
+}
+
+QFile* PackStore::reader(int packId) {
+    if (QFile *file = m_readers.value(packId)) {
+        return file;
+    }
+    auto *file = new QFile(packPath(packId));
+    if (!file->open(QIODevice::ReadOnly)) {
+        qWarning() << "PackStore: Cannot open" << file->fileName() << ":" << file->errorString();
+        delete file;
+        return nullptr;
+    }
+    m_readers.insert(packId, file);
+    return file;
+}
+
+std::shared_ptr<PackStore::Mapping> PackStore::mapped(const PackLocation &location) {
+    // Only sealed packs: mapping the append pack would mean a new mapping every time it grows
+    if (m_mapFailed || location.packId == m_appendId) {
+        return nullptr;
+    }
+    const qint64 end = location.offset + RECORD_HEADER_SIZE + location.length;
+    if (const std::shared_ptr<Mapping> existing = m_mappings.value(location.packId)) {
+        return end <= existing->size ? existing : nullptr;
+    }
+    auto mapping = std::make_shared<Mapping>(packPath(location.packId));
+    const qint64 size = mapping->file.open(QIODevice::ReadOnly) ? mapping->file.size() : 0;
+    uchar *base = end <= size ? mapping->file.map(0, size) : nullptr;
+    if (!base) {
+        if (end <= size) {
+            // e.g. out of address space; reads copy from here on
+            qWarning() << "PackStore: Cannot map" << mapping->file.fileName() << ":" << mapping->file.errorString();
+            m_mapFailed = true;
+        }
+        return nullptr;
+    }
+    mapping->base = reinterpret_cast<const char*>(base);
+    mapping->size = size;
+    m_mappings.insert(location.packId, mapping);
+    return mapping;
+}
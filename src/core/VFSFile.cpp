@@ -0,0 +1,335 @@
+#include "VFSFile.h"
+#include "VFSManager.h"
+#include "ContentChunker.h"
+#include <QBuffer>
+#include <QDebug>
+#include <QTemporaryFile>
+#include <algorithm>
+#include <cstring>
+
+namespace {
+    // Plaintext decrypted per range read of an encrypted, uncompressed chunk,
+    // and bytes fetched per read of a plain single-blob row
+    constexpr qint64 RANGE_WINDOW = 64 * 1024;
+}
+
+VFSFile::VFSFile(int fileId, QObject *parent) : QIODevice(parent), m_fileId(fileId) {
+}
+
+VFSFile::~VFSFile() {
+    close();
+}
+
+bool VFSFile::open(OpenMode mode) {
+    if (isOpen()) {
+        setErrorString("File is already open");
+        return false;
+    }
+    if (mode & (Append | ReadOnly) && mode & WriteOnly) {
+        setErrorString("Only ReadOnly or WriteOnly access is supported");
+        return false;
+    }
+    if (!VFSManager::instance().getFileMeta(m_fileId, m_meta)) {
+        setErrorString("File not found");
+        return false;
+    }
+    
+    DatabaseManager &db = DatabaseManager::instance();
+    reset();
+    
+    if (mode & WriteOnly) {
+        // No transaction until commit(): other writes meanwhile must not end up in it
+        m_staging = std::make_unique<QTemporaryFile>();
+        if (!m_staging->open()) {
+            setErrorString("Could not create staging file");
+            m_staging.reset();
+            return false;
+        }
+        m_writing = true;
+    } else if (m_meta.isChunked) {
+        if (!db.readFileChunkLayout(m_fileId, m_layout)) {
+            setErrorString("Could not read chunk layout");
+            return false;
+        }
+    } else if (m_meta.size > 0) {
+        // Legacy single-blob row behaves like a file with one chunk
+        FileChunk whole;
+        whole.index = 0;
+        whole.plainOffset = 0;
+        whole.plainSize = m_meta.size;
+        m_layout.append(whole);
+    }
+    
+    // Chunk cache already buffers; QIODevice's own buffer would double it
+    return QIODevice::open(mode | Unbuffered);
+}
+
+void VFSFile::close() {
+    if (!isOpen()) {
+        return;
+    }
+    reset(); // drops anything staged
+
+    QIODevice::close();
+}
+
+bool VFSFile::commit() {
+    if (!m_writing) {
+        setErrorString("File is not open for writing");
+        return false;
+    }
+    
+    DatabaseManager &db = DatabaseManager::instance();
+    VFSManager &vfs = VFSManager::instance();
+    const QByteArray checksum = m_hash.result();
+    
+    // Nothing chunked yet and within the inline threshold: stored in the row, as updateFile() would
+    QByteArray small;
+    if (!m_failed && m_staged.isEmpty()) {
+        QBuffer pending(&m_pending);
+        if (pending.open(QIODevice::ReadOnly)) {
+            vfs.takeInlineContent(pending, small);
+        }
+    }
+    const QByteArray stored = small.isEmpty() ? QByteArray() : vfs.processContent(small, m_meta.isEncrypted, m_meta.isCompressed);
+    
+    bool ok = !m_failed && (small.isEmpty() ? flushChunks(true) && m_staging->seek(0) : !stored.isEmpty()) &&
+              db.beginTransaction();
+    if (ok) {
+        if (!small.isEmpty()) {
+            // Every chunk of the previous content goes
+            ok = db.deleteFileChunks(m_fileId) &&
+                 db.collectUnreferencedChunks() >= 0 &&
+                 db.setInlineContent(m_fileId, stored, m_written, checksum, m_meta.isEncrypted, m_meta.isCompressed);
+        } else {
+            // New chunks overwrite the old slots first and surplus slots are dropped after
+            for (int i = 0; ok && i < m_staged.size(); ++i) {
+                FileChunk chunk = m_staged.at(i);
+                chunk.data = m_staging->read(m_stagedSizes.at(i));
+                ok = chunk.data.size() == m_stagedSizes.at(i) && db.writeFileChunk(m_fileId, chunk);
+            }
+            ok = ok && db.deleteFileChunks(m_fileId, m_staged.size()) &&
+                 db.collectUnreferencedChunks() >= 0 &&
+                 db.finishChunkedFile(m_fileId, m_written, checksum, m_meta.isEncrypted, m_meta.isCompressed);
+        }
+        if (ok) {
+            ok = db.commitTransaction();
+        } else {
+            db.rollbackTransaction();
+        }
+    }
+    close();
+    if (!ok) {
+        setErrorString("Failed to store file content");
+        return false;
+    }
+
+    emit VFSManager::instance().fileUpdated(m_fileId);
+    return true;
+}
+
+qint64 VFSFile::size() const {
+    return m_writing ? m_written : m_meta.size;
+}
+
+bool VFSFile::seek(qint64 pos) {
+    if (m_writing && pos != m_written) {
+        setErrorString("Writes are sequential");
+        return false;
+    }
+    return QIODevice::seek(pos);
+}
+
+qint64 VFSFile::readData(char *data, qint64 maxSize) {
+    qint64 position = pos();
+    qint64 copied = 0;
+    
+    while (copied < maxSize && position < m_meta.size) {
+        // Last chunk starting at or before position
+        auto it = std::upper_bound(m_layout.cbegin(), m_layout.cend(), position,
+                                   [](qint64 value, const FileChunk &chunk) { return value < chunk.plainOffset; });
+        const int index = int(it - m_layout.cbegin()) - 1;
+        if (index < 0) {
+            return copied > 0 ? copied : -1;
+        }
+        
+        const FileChunk &chunk = m_layout.at(index);
+        const qint64 inChunk = position - chunk.plainOffset;
+        if (!loadWindow(index, inChunk)) {
+            return copied > 0 ? copied : -1;
+        }
+        
+        const qint64 inWindow = inChunk - m_cachedBegin;
+        const qint64 n = qMin(maxSize - copied, qint64(m_cached.size()) - inWindow);
+        if (n <= 0) {
+            break;
+        }
+        std::memcpy(data + copied, m_cached.constData() + inWindow, size_t(n));
+        copied += n;
+        position += n;
+    }
+    
+    return copied;
+}
+
+qint64 VFSFile::writeData(const char *data, qint64 maxSize) {
+    if (m_failed) {
+        return -1;
+    }
+    m_pending.append(data, maxSize);
+    m_hash.addData(QByteArray::fromRawData(data, maxSize));
+    m_written += maxSize;
+    if (!flushChunks(false)) {
+        m_failed = true;
+        return -1;
+    }
+    return maxSize;
+}
+
+bool VFSFile::loadWindow(int layoutIndex, qint64 inChunk) {
+    if (m_failed) {
+        return false;
+    }
+    if (layoutIndex == m_cachedIndex && inChunk >= m_cachedBegin && inChunk < m_cachedBegin + m_cached.size()) {
+        return true;
+    }
+    
+    DatabaseManager &db = DatabaseManager::instance();
+    const FileChunk &entry = m_layout.at(layoutIndex);
+    if (!m_meta.isChunked && !m_meta.isEncrypted && !m_meta.isCompressed && BlobStream::isAvailable()) {
+        // Plain single-blob row: the stored bytes are the content, read just the window.
+        // Only with incremental I/O: the substr() fallback loads the whole value per window.
+        const qint64 begin = inChunk - inChunk % RANGE_WINDOW;
+        m_cachedIndex = -1;
+        if (!db.getFileBlobRange(m_fileId, begin, RANGE_WINDOW, m_cached) ||
+            m_cached.isEmpty() || begin + m_cached.size() > entry.plainSize) {
+            setErrorString("Missing file content");
+            return false;
+        }
+        m_cachedBegin = begin;
+        if (!hashWindow(begin)) {
+            return false;
+        }
+        m_cachedIndex = layoutIndex;
+        return true;
+    }
+    if (layoutIndex != m_storedIndex) {
+        m_stored.clear();
+        m_storedIndex = -1;
+        if (m_meta.isChunked) {
+            QList<FileChunk> chunks;
+            if (!db.readFileChunks(m_fileId, entry.index, 1, chunks) || chunks.isEmpty()) {
+                setErrorString(QString("Missing chunk %1").arg(entry.index));
+                return false;
+            }
+            m_stored = chunks.first().data;
+        } else if (!db.getFileBlob(m_fileId, m_stored)) {
+            setErrorString("Missing file content");
+            return false;
+        }
+        m_storedIndex = layoutIndex;
+    }
+    
+    m_cachedIndex = -1;
+    if (m_meta.isEncrypted && !m_meta.isCompressed) {
+        // Segmented ciphertext: authenticate and decrypt only the segments around inChunk
+        const qint64 begin = inChunk - inChunk % RANGE_WINDOW;
+        const qint64 length = qMin(RANGE_WINDOW, entry.plainSize - begin);
+        if (!EncryptionManager::instance().decryptRange(m_stored, begin, length, m_cached, m_cachedBegin) ||
+            m_cachedBegin > inChunk || m_cachedBegin + m_cached.size() > entry.plainSize) {
+            setErrorString(QString("Chunk %1 failed to decrypt").arg(entry.index));
+            return false;
+        }
+        if (m_cachedBegin == 0 && m_cached.size() == entry.plainSize) {
+            // Version 1 blobs decrypt whole; nothing left to fetch from the stored copy
+            m_stored.clear();
+            m_storedIndex = -1;
+        }
+    } else {
+        m_cached = VFSManager::instance().unprocessContent(m_stored, m_meta.isEncrypted, m_meta.isCompressed);
+        m_cachedBegin = 0;
+        if (m_cached.size() != entry.plainSize) {
+            setErrorString(QString("Chunk %1 failed to decode").arg(entry.index));
+            return false;
+        }
+        // Fully decoded; the stored bytes are not needed again
+        m_stored.clear();
+        m_storedIndex = -1;
+    }
+    
+    if (!hashWindow(entry.plainOffset + m_cachedBegin)) {
+        return false;
+    }
+    m_cachedIndex = layoutIndex;
+    return true;
+}
+
+bool VFSFile::hashWindow(qint64 fileOffset) {
+    // Extend the checksum while windows arrive in file order
+    const qint64 end = fileOffset + m_cached.size();
+    if (fileOffset > m_hashedBytes || end <= m_hashedBytes) {
+        return true;
+    }
+    m_hash.addData(QByteArray::fromRawData(m_cached.constData() + (m_hashedBytes - fileOffset), end - m_hashedBytes));
+    m_hashedBytes = end;
+    if (m_hashedBytes == m_meta.size && m_hash.result() != m_meta.checksum) {
+        qWarning() << "VFSFile: Checksum mismatch for file" << m_fileId;
+        setErrorString("Checksum mismatch");
+        m_failed = true;
+        return false;
+    }
+    return true;
+}
+
+bool VFSFile::flushChunks(bool final) {
+    // Without final, keep enough bytes buffered that every cut point is the
+    // one ContentChunker would pick for the same stream
+    VFSManager &vfs = VFSManager::instance();
+    const qsizetype keep = final ? 0 : ContentChunker::MAX_CHUNK_SIZE - 1;
+    qsizetype offset = 0;
+    
+    while (m_pending.size() - offset > keep) {
+        const uchar *data = reinterpret_cast<const uchar*>(m_pending.constData()) + offset;
+        const qsizetype length = ContentChunker::findBoundary(data, m_pending.size() - offset);
+        
+        // Processed now, so commit() only has to copy; always with its payload, since a
+        // chunk stored elsewhere today may be collected before the commit
+        FileChunk chunk;
+        chunk.index = m_staged.size();
+        chunk.plainOffset = m_flushed;
+        chunk.plainSize = length;
+        const QByteArray plain = m_pending.mid(offset, length);
+        chunk.hash = vfs.chunkKey(plain, m_meta.isEncrypted, m_meta.isCompressed);
+        const QByteArray stored = chunk.hash.isEmpty() ? QByteArray() : vfs.processContent(plain, m_meta.isEncrypted, m_meta.isCompressed);
+        if (stored.isEmpty() || m_staging->write(stored) != stored.size()) {
+            setErrorString("Failed to stage chunk");
+            return false;
+        }
+        m_staged.append(chunk);
+        m_stagedSizes.append(stored.size());
+        m_flushed += length;
+        offset += length;
+    }
+    
+    m_pending.remove(0, offset);
+    return true;
+}
+
+void VFSFile::reset() {
+    m_layout.clear();
+    m_cached.clear();
+    m_cachedIndex = -1;
+    m_cachedBegin = 0;
+    m_stored.clear();
+    m_storedIndex = -1;
+    m_hash.reset();
+    m_hashedBytes = 0;
+    m_failed = false;
+    m_writing = false;
+    m_pending.clear();
+    m_written = 0;
+    m_flushed = 0;
+    m_staging.reset();
+    m_staged.clear();
+    m_stagedSizes.clear();
+}
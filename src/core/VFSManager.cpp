@@ -6,8 +6,26 @@
 #include <QDebug>
 #include <QMimeDatabase>
 #include <QMimeType>
+#include <QBuffer>
+#include <QCryptographicHash>
+#include <QtEndian>
+#include <cstring>
+#include "ContentChunker.h"
+#include "VFSFile.h"
+
+namespace {
+    constexpr int CHUNK_GC_DELAY_MS = 2000; // idle time after a delete before reclaiming starts
+    constexpr int CHUNK_GC_BATCH = 256;     // chunks removed per event-loop turn
+    const char RAW_EXPORT_MAGIC[8] = {'S', 'V', 'F', 'S', 'R', 'A', 'W', '1'};
+    constexpr char RAW_EXPORT_ENCRYPTED = 0x01;
+    constexpr char RAW_EXPORT_COMPRESSED = 0x02;
+}
 
 VFSManager::VFSManager() : QObject() {
+    // Chunk reclamation runs in small batches on this (the writer's) thread, between
+    // UI events, instead of inside the delete that released the chunks
+    m_chunkCollector.setSingleShot(true);
+    connect(&m_chunkCollector, &QTimer::timeout, this, [this] { collectChunks(); });
 }
 
 VFSManager::~VFSManager() = default;
@@ -45,75 +63,155 @@ int VFSManager::getCurrentUserId() const {
 
 bool VFSManager::createFile(const QString &filename, const QString &path, const QByteArray &content, 
                            bool encrypt, bool compress) {
+    QBuffer buffer;
+    buffer.setData(content);
+    buffer.open(QIODevice::ReadOnly);
+    return createFile(filename, path, buffer, encrypt, compress);
+}
+
+bool VFSManager::createFile(const QString &filename, const QString &path, QIODevice &source,
+                           bool encrypt, bool compress) {
     if (m_currentUserId == -1) return false;
     
+    FileRecord file = newFileRecord(filename, path, encrypt, compress);
+    DatabaseManager &db = DatabaseManager::instance();
+    
+    // Small content goes inline in the row, where one read returns everything
+    QByteArray small;
+    if (takeInlineContent(source, small)) {
+        const QByteArray stored = processContent(small, encrypt, compress);
+        if (stored.isEmpty()) {
+            return false;
+        }
+        inlineFileRecord(file, stored, small.size(), EncryptionManager::instance().calculateChecksum(small));
+        if (!db.createFile(file)) {
+            return false;
+        }
+        emit fileCreated(file.id, filename);
+        return true;
+    }
+    
+    // Row, chunks and final size/checksum are written atomically
+    if (!db.beginTransaction()) {
+        return false;
+    }
+    
+    qint64 size = 0;
+    QByteArray checksum;
+    int chunkCount = 0;
+    if (!db.createFile(file) ||
+        !storeChunks(file.id, source, encrypt, compress, size, checksum, chunkCount) ||
+        !db.finishChunkedFile(file.id, size, checksum, encrypt, compress)) {
+        db.rollbackTransaction();
+        return false;
+    }
+    
+    if (!db.commitTransaction()) {
+        return false;
+    }
+    
+    emit fileCreated(file.id, filename);
+    return true;
+}
+
+FileRecord VFSManager::newFileRecord(const QString &filename, const QString &path, bool encrypt, bool compress) {
     FileRecord file;
     file.filename = filename;
     file.path = path;
+    if (!DatabaseManager::instance().findDirectory(m_currentUserId, path, file.dirId)) {
+        file.dirId = -1; // refused by DatabaseManager::createFile
+    }
     file.mimeType = getMimeType(filename);
-    file.size = content.size();
+    file.size = 0;
     file.userId = m_currentUserId;
     file.isEncrypted = encrypt;
     file.isCompressed = compress;
+    file.isChunked = true;
     file.createdAt = QDateTime::currentDateTime();
     file.modifiedAt = QDateTime::currentDateTime();
-    
-    // Process content (encrypt/compress)
-    QByteArray processedContent = processContent(content, encrypt, compress);
-    if (processedContent.isEmpty()) {
+    return file;
+}
+
+void VFSManager::inlineFileRecord(FileRecord &file, const QByteArray &stored, qint64 size, const QByteArray &checksum) {
+    file.isChunked = false;
+    file.size = size;
+    file.checksum = checksum;
+    (file.isEncrypted ? file.encryptedContent : file.content) = stored;
+}
+
+bool VFSManager::takeInlineContent(QIODevice &source, QByteArray &content) {
+    // Only where the end is known: a short peek on a sequential device may just be early.
+    // Empty content stays on the chunked path (no chunks at all).
+    const qint64 threshold = DatabaseManager::instance().inlineThreshold();
+    if (threshold <= 0 || source.isSequential()) {
         return false;
     }
-    
-    if (encrypt) {
-        file.encryptedContent = processedContent;
-        file.content.clear();
-    } else {
-        file.content = processedContent;
-        file.encryptedContent.clear();
+    const QByteArray head = source.peek(threshold + 1);
+    if (head.isEmpty() || head.size() > threshold) {
+        return false;
     }
+    content = source.read(head.size());
+    return content.size() == head.size();
+}
+
+bool VFSManager::updateFile(int fileId, const QByteArray &content) {
+    if (m_currentUserId == -1) return false;
     
-    // Calculate checksum
-    file.checksum = EncryptionManager::instance().calculateChecksum(content);
+    FileMeta file;
+    if (!getFileMeta(fileId, file)) {
+        return false;
+    }
     
-    if (DatabaseManager::instance().createFile(file)) {
-        emit fileCreated(file.id, filename);
+    QBuffer buffer;
+    buffer.setData(content);
+    buffer.open(QIODevice::ReadOnly);
+    if (rewriteContent(file, buffer, file.isEncrypted, file.isCompressed)) {
+        emit fileUpdated(fileId);
         return true;
     }
     
     return false;
 }
 
-bool VFSManager::updateFile(int fileId, const QByteArray &content) {
+bool VFSManager::deleteFile(int fileId) {
     if (m_currentUserId == -1) return false;
     
-    FileRecord file;
-    if (!DatabaseManager::instance().getFile(fileId, file)) {
-        return false;
+    FileMeta file;
+    if (!getFileMeta(fileId, file)) {
+        return false; // Missing or owned by another user
     }
     
-    if (file.userId != m_currentUserId) {
-        return false; // Security check
+    if (DatabaseManager::instance().deleteFile(fileId, false)) {
+        scheduleChunkCollection();
+        emit fileDeleted(fileId);
+        return true;
     }
     
-    // Process content
-    QByteArray processedContent = processContent(content, file.isEncrypted, file.isCompressed);
-    if (processedContent.isEmpty()) {
+    return false;
+}
+
+bool VFSManager::renameFile(int fileId, const QString &newName) {
+    FileMeta file;
+    if (newName.isEmpty() || newName.contains('/') || !getFileMeta(fileId, file)) {
         return false;
     }
     
-    if (file.isEncrypted) {
-        file.encryptedContent = processedContent;
-        file.content.clear();
-    } else {
-        file.content = processedContent;
-        file.encryptedContent.clear();
+    if (DatabaseManager::instance().moveFile(fileId, file.dirId, newName)) {
+        emit fileUpdated(fileId);
+        return true;
     }
     
-    file.size = content.size();
-    file.modifiedAt = QDateTime::currentDateTime();
-    file.checksum = EncryptionManager::instance().calculateChecksum(content);
+    return false;
+}
+
+bool VFSManager::moveFile(int fileId, const QString &destPath) {
+    FileMeta file;
+    int dirId = 0;
+    if (!getFileMeta(fileId, file) || !findDirectory(destPath, dirId)) {
+        return false;
+    }
     
-    if (DatabaseManager::instance().updateFile(file)) {
+    if (DatabaseManager::instance().moveFile(fileId, dirId, file.filename)) {
         emit fileUpdated(fileId);
         return true;
     }
@@ -121,20 +219,17 @@ bool VFSManager::updateFile(int fileId, const QByteArray &content) {
     return false;
 }
 
-bool VFSManager::deleteFile(int fileId) {
-    if (m_currentUserId == -1) return false;
-    
-    FileRecord file;
-    if (!DatabaseManager::instance().getFile(fileId, file)) {
+bool VFSManager::copyFile(int fileId, const QString &destPath) {
+    FileMeta file;
+    int dirId = 0;
+    if (!getFileMeta(fileId, file) || !findDirectory(destPath, dirId)) {
         return false;
     }
     
-    if (file.userId != m_currentUserId) {
-        return false; // Security check
-    }
-    
-    if (DatabaseManager::instance().deleteFile(fileId)) {
-        emit fileDeleted(fileId);
+    const QString name = availableName(dirId, file.filename);
+    int newFileId = -1;
+    if (DatabaseManager::instance().copyFile(fileId, dirId, name, newFileId)) {
+        emit fileCreated(newFileId, name);
         return true;
     }
     
@@ -144,23 +239,36 @@ bool VFSManager::deleteFile(int fileId) {
 bool VFSManager::getFileContent(int fileId, QByteArray &content) {
     if (m_currentUserId == -1) return false;
     
-    FileRecord file;
-    if (!DatabaseManager::instance().getFile(fileId, file)) {
+    FileMeta file;
+    if (!getFileMeta(fileId, file)) {
         return false;
     }
     
-    if (file.userId != m_currentUserId) {
-        return false; // Security check
+    QByteArray calculatedChecksum;
+    if (file.isChunked) {
+        QCryptographicHash hash(QCryptographicHash::Sha256);
+        content.clear();
+        content.reserve(file.size);
+        bool ok = forEachPlainChunk(file, [&](const QByteArray &plain) {
+            hash.addData(plain);
+            content.append(plain);
+            return true;
+        });
+        if (!ok) {
+            return false;
+        }
+        calculatedChecksum = hash.result();
+    } else {
+        // Legacy single-blob row
+        QByteArray processedContent;
+        if (!DatabaseManager::instance().getFileBlob(fileId, processedContent)) {
+            return false;
+        }
+        content = unprocessContent(processedContent, file.isEncrypted, file.isCompressed);
+        calculatedChecksum = EncryptionManager::instance().calculateChecksum(content);
     }
     
-    // Get the appropriate content
-    QByteArray processedContent = file.isEncrypted ? file.encryptedContent : file.content;
-    
-    // Unprocess content (decrypt/decompress)
-    content = unprocessContent(processedContent, file.isEncrypted, file.isCompressed);
-    
     // Verify checksum
-    QByteArray calculatedChecksum = EncryptionManager::instance().calculateChecksum(content);
     if (calculatedChecksum != file.checksum) {
         qDebug() << "Checksum verification failed for file" << fileId;
         return false;
@@ -170,21 +278,52 @@ bool VFSManager::getFileContent(int fileId, QByteArray &content) {
 }
 
 QList<FileRecord> VFSManager::getFilesInDirectory(const QString &path) {
-    if (m_currentUserId == -1) return QList<FileRecord>();
+    int dirId = 0;
+    if (!findDirectory(path, dirId)) return QList<FileRecord>();
     
-    return DatabaseManager::instance().getFilesInDirectory(path, m_currentUserId);
+    return DatabaseManager::instance().getFilesInDirectory(dirId, m_currentUserId);
 }
 
-QList<FileRecord> VFSManager::searchFiles(const QString &query) {
+QList<FileRecord> VFSManager::searchFiles(const QString &query, int limit) {
     if (m_currentUserId == -1) return QList<FileRecord>();
     
-    return DatabaseManager::instance().searchFiles(query, m_currentUserId);
+    return DatabaseManager::instance().searchFiles(query, m_currentUserId, limit);
 }
 
-bool VFSManager::createDirectory(const QString &name, const QString &path) {
+bool VFSManager::getFileMeta(int fileId, FileMeta &meta) {
     if (m_currentUserId == -1) return false;
     
+    if (!DatabaseManager::instance().getFileMeta(fileId, meta)) {
+        return false;
+    }
+    
+    return meta.userId == m_currentUserId; // Security check
+}
+
+QList<FileMeta> VFSManager::listDirectory(const QString &path) {
+    int dirId = 0;
+    if (!findDirectory(path, dirId)) return QList<FileMeta>();
+    
+    return DatabaseManager::instance().getFileMetaInDirectory(dirId, m_currentUserId);
+}
+
+QList<FileMeta> VFSManager::searchFileMeta(const QString &query, int limit) {
+    if (m_currentUserId == -1) return QList<FileMeta>();
+    
+    return DatabaseManager::instance().searchFileMeta(query, m_currentUserId, limit);
+}
+
+bool VFSManager::createDirectory(const QString &name, const QString &path) {
+    if (name.isEmpty() || name.contains('/')) return false;
+    
     DirectoryRecord dir;
+    if (!findDirectory(path, dir.parentId)) {
+        return false;
+    }
+    if (DatabaseManager::instance().isNameTaken(m_currentUserId, dir.parentId, name)) {
+        return false; // a file or folder of that name exists
+    }
+    
     dir.name = name;
     dir.path = path;
     dir.userId = m_currentUserId;
@@ -212,6 +351,7 @@ bool VFSManager::deleteDirectory(int dirId) {
     }
     
     if (DatabaseManager::instance().deleteDirectory(dirId)) {
+        scheduleChunkCollection();
         emit directoryDeleted(dirId);
         return true;
     }
@@ -219,10 +359,109 @@ bool VFSManager::deleteDirectory(int dirId) {
     return false;
 }
 
+void VFSManager::scheduleChunkCollection() {
+    m_chunkCollector.start(CHUNK_GC_DELAY_MS);
+}
+
+void VFSManager::collectChunks() {
+    const int removed = DatabaseManager::instance().collectUnreferencedChunks(CHUNK_GC_BATCH);
+    if (removed == CHUNK_GC_BATCH) {
+        m_chunkCollector.start(0); // more to do; let pending events run first
+    }
+}
+
+bool VFSManager::renameDirectory(int dirId, const QString &newName) {
+    if (m_currentUserId == -1 || newName.isEmpty() || newName.contains('/')) return false;
+    
+    DirectoryRecord dir;
+    if (!DatabaseManager::instance().getDirectory(dirId, dir) || dir.userId != m_currentUserId) {
+        return false; // Security check
+    }
+    
+    if (DatabaseManager::instance().moveDirectory(dirId, dir.parentId, newName)) {
+        emit directoryUpdated(dirId);
+        return true;
+    }
+    
+    return false;
+}
+
+bool VFSManager::moveDirectory(int dirId, const QString &destPath) {
+    if (m_currentUserId == -1) return false;
+    
+    DirectoryRecord dir;
+    int parentId = 0;
+    if (!DatabaseManager::instance().getDirectory(dirId, dir) || dir.userId != m_currentUserId ||
+        !findDirectory(destPath, parentId)) {
+        return false;
+    }
+    
+    if (DatabaseManager::instance().moveDirectory(dirId, parentId, dir.name)) {
+        emit directoryUpdated(dirId);
+        return true;
+    }
+    
+    return false;
+}
+
+bool VFSManager::copyDirectory(int dirId, const QString &destPath) {
+    if (m_currentUserId == -1) return false;
+    
+    DirectoryRecord dir;
+    int parentId = 0;
+    if (!DatabaseManager::instance().getDirectory(dirId, dir) || dir.userId != m_currentUserId ||
+        !findDirectory(destPath, parentId)) {
+        return false;
+    }
+    
+    const QString name = availableName(parentId, dir.name);
+    int newDirId = -1;
+    if (DatabaseManager::instance().copyDirectory(dirId, parentId, name, newDirId)) {
+        emit directoryCreated(newDirId, name);
+        return true;
+    }
+    
+    return false;
+}
+
+QString VFSManager::availableName(int dirId, const QString &name) {
+    // "report.txt" -> "report (copy).txt", "report (copy 2).txt", ...
+    DatabaseManager &db = DatabaseManager::instance();
+    if (!db.isNameTaken(m_currentUserId, dirId, name)) {
+        return name;
+    }
+    const int dot = name.lastIndexOf('.');
+    const QString base = dot > 0 ? name.left(dot) : name;
+    const QString suffix = dot > 0 ? name.mid(dot) : QString();
+    QString candidate = base + " (copy)" + suffix;
+    for (int n = 2; db.isNameTaken(m_currentUserId, dirId, candidate); ++n) {
+        candidate = QString("%1 (copy %2)%3").arg(base).arg(n).arg(suffix);
+    }
+    return candidate;
+}
+
 QList<DirectoryRecord> VFSManager::getDirectoriesInPath(const QString &path) {
-    if (m_currentUserId == -1) return QList<DirectoryRecord>();
+    int dirId = 0;
+    if (!findDirectory(path, dirId)) return QList<DirectoryRecord>();
     
-    return DatabaseManager::instance().getDirectoriesInPath(path, m_currentUserId);
+    return DatabaseManager::instance().getSubdirectories(dirId, m_currentUserId);
+}
+
+bool VFSManager::findDirectory(const QString &path, int &dirId) {
+    if (m_currentUserId == -1) return false;
+    
+    return DatabaseManager::instance().findDirectory(m_currentUserId, path, dirId);
+}
+
+bool VFSManager::getDirectoryStats(int dirId, UserStats &stats) {
+    stats = UserStats();
+    if (m_currentUserId == -1) return false;
+    
+    DirectoryRecord dir;
+    if (dirId != 0 && (!DatabaseManager::instance().getDirectory(dirId, dir) || dir.userId != m_currentUserId)) {
+        return false; // Security check
+    }
+    return DatabaseManager::instance().getSubtreeStats(dirId, m_currentUserId, stats);
 }
 
 bool VFSManager::importFile(const QString &localPath, const QString &vfsPath, bool encrypt, bool compress) {
@@ -231,18 +470,15 @@ bool VFSManager::importFile(const QString &localPath, const QString &vfsPath, bo
         return false;
     }
     
-    QByteArray content = file.readAll();
-    file.close();
-    
     QFileInfo fileInfo(localPath);
     QString filename = fileInfo.fileName();
     
-    return createFile(filename, vfsPath, content, encrypt, compress);
+    return createFile(filename, vfsPath, file, encrypt, compress);
 }
 
 bool VFSManager::exportFile(int fileId, const QString &localPath) {
-    QByteArray content;
-    if (!getFileContent(fileId, content)) {
+    VFSFile source(fileId);
+    if (!source.open(QIODevice::ReadOnly)) {
         return false;
     }
     
@@ -251,10 +487,129 @@ bool VFSManager::exportFile(int fileId, const QString &localPath) {
         return false;
     }
     
-    qint64 bytesWritten = file.write(content);
+    // One chunk in memory at a time; VFSFile verifies the checksum on the last chunk
+    bool ok = true;
+    while (ok && !source.atEnd()) {
+        QByteArray block = source.read(ContentChunker::MAX_CHUNK_SIZE);
+        ok = !block.isEmpty() && file.write(block) == block.size();
+    }
     file.close();
     
-    return bytesWritten == content.size();
+    if (!ok) {
+        qDebug() << "Export failed for file" << fileId << ":" << source.errorString();
+        file.remove();
+        return false;
+    }
+    
+    return true;
+}
+
+bool VFSManager::exportRawFile(int fileId, const QString &localPath) {
+    FileMeta meta;
+    if (!getFileMeta(fileId, meta)) {
+        return false;
+    }
+    QFile file(localPath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    
+    bool ok = true;
+    if (!meta.isChunked) {
+        // Already one stored blob, readable by the decrypt/decompress tools as it is
+        ok = readStoredBlocks(fileId, [&](const QByteArray &block) {
+            ok = file.write(block) == block.size();
+            return ok;
+        }) && ok;
+    } else {
+        // Each chunk was processed on its own; the container keeps their boundaries
+        DatabaseManager &db = DatabaseManager::instance();
+        const int chunkCount = db.getFileChunkCount(fileId);
+        char header[sizeof(RAW_EXPORT_MAGIC) + 13];
+        std::memcpy(header, RAW_EXPORT_MAGIC, sizeof(RAW_EXPORT_MAGIC));
+        header[8] = char((meta.isEncrypted ? RAW_EXPORT_ENCRYPTED : 0) | (meta.isCompressed ? RAW_EXPORT_COMPRESSED : 0));
+        qToLittleEndian<quint32>(quint32(qMax(0, chunkCount)), header + 9);
+        qToLittleEndian<quint64>(quint64(meta.size), header + 13);
+        ok = chunkCount >= 0 && file.write(header, sizeof(header)) == qint64(sizeof(header));
+        for (int i = 0; ok && i < chunkCount; ++i) {
+            QList<FileChunk> chunks;
+            ok = db.readFileChunks(fileId, i, 1, chunks) && !chunks.isEmpty();
+            if (!ok) {
+                break;
+            }
+            const FileChunk &chunk = chunks.first();
+            char lengths[8];
+            qToLittleEndian<quint32>(quint32(chunk.plainSize), lengths);
+            qToLittleEndian<quint32>(quint32(chunk.data.size()), lengths + 4);
+            ok = file.write(lengths, sizeof(lengths)) == qint64(sizeof(lengths)) &&
+                 file.write(chunk.data) == chunk.data.size();
+        }
+    }
+    file.close();
+    
+    if (!ok) {
+        qDebug() << "Raw export failed for file" << fileId;
+        file.remove();
+        return false;
+    }
+    return true;
+}
+
+bool VFSManager::readStoredBlocks(int fileId, const std::function<bool(const QByteArray &block)> &consumer) {
+    FileMeta meta;
+    if (!getFileMeta(fileId, meta)) {
+        return false;
+    }
+    
+    DatabaseManager &db = DatabaseManager::instance();
+    if (!meta.isChunked && !BlobStream::isAvailable()) {
+        // Without incremental I/O every range read loads the whole value: load it once
+        QByteArray blob;
+        if (!db.getFileBlob(fileId, blob)) {
+            return false;
+        }
+        consumer(blob);
+        return true;
+    }
+    if (!meta.isChunked) {
+        // Block by block, so a large single-blob row never has to fit in memory
+        for (qint64 offset = 0;; offset += ContentChunker::MAX_CHUNK_SIZE) {
+            QByteArray block;
+            if (!db.getFileBlobRange(fileId, offset, ContentChunker::MAX_CHUNK_SIZE, block)) {
+                return false;
+            }
+            if ((block.isEmpty() && offset > 0) || !consumer(block) || block.size() < ContentChunker::MAX_CHUNK_SIZE) {
+                return true;
+            }
+        }
+    }
+    
+    int chunkCount = db.getFileChunkCount(fileId);
+    for (int i = 0; i < chunkCount; ++i) {
+        QList<FileChunk> chunks;
+        if (!db.readFileChunks(fileId, i, 1, chunks) || chunks.isEmpty()) {
+            return false;
+        }
+        if (!consumer(chunks.first().data)) {
+            break;
+        }
+    }
+    return true;
+}
+
+bool VFSManager::readStoredPrefix(int fileId, int maxBytes, QByteArray &prefix) {
+    FileMeta meta;
+    if (!getFileMeta(fileId, meta)) {
+        return false;
+    }
+    return DatabaseManager::instance().getFileBlobPrefix(fileId, maxBytes, prefix);
+}
+
+bool VFSManager::getUserStats(UserStats &stats) {
+    stats = UserStats();
+    if (m_currentUserId == -1) return false;
+    
+    return DatabaseManager::instance().getUserStats(m_currentUserId, stats);
 }
 
 qint64 VFSManager::getTotalStorageUsed() {
@@ -298,12 +653,12 @@ QString VFSManager::getMimeType(const QString &filename) {
     return mimeType.name();
 }
 
-QByteArray VFSManager::processContent(const QByteArray &content, bool encrypt, bool compress) {
+QByteArray VFSManager::processContent(const QByteArray &content, bool encrypt, bool compress, const Processing &settings) {
     QByteArray processedContent = content;
     
     // First compress if needed
     if (compress) {
-        processedContent = CompressionManager::instance().compress(processedContent, m_defaultCompAlg, m_compLevel);
+        processedContent = compressContent(processedContent, settings);
         if (processedContent.isEmpty()) {
             return QByteArray();
         }
@@ -311,22 +666,7 @@ QByteArray VFSManager::processContent(const QByteArray &content, bool encrypt, b
     
     // Then encrypt if needed (with compression flag in header)
     if (encrypt) {
-        // bit0 = compressed; bits2-3 = compression algorithm (0=zlib,1=lz4,2=zstd)
-        unsigned char flags = compress ? 0x01 : 0x00;
-        if (compress) {
-            unsigned char compCode = 0;
-            switch (m_defaultCompAlg) {
-                case CompressionManager::ZLIB: compCode = 0; break;
-                case CompressionManager::LZ4: compCode = 1; break;
-                case CompressionManager::ZSTD: compCode = 2; break;
-                case CompressionManager::GZIP: compCode = 0; break;
-            }
-            flags |= (compCode & 0x03) << 2;
-        }
-        processedContent = EncryptionManager::instance().encryptWithFlags(
-            processedContent,
-            m_defaultEncAlg,
-            flags);
+        processedContent = encryptContent(processedContent, compress, settings);
         if (processedContent.isEmpty()) {
             return QByteArray();
         }
@@ -335,6 +675,26 @@ QByteArray VFSManager::processContent(const QByteArray &content, bool encrypt, b
     return processedContent;
 }
 
+QByteArray VFSManager::compressContent(const QByteArray &content, const Processing &settings) {
+    return CompressionManager::instance().compressFramed(content, settings.compression, settings.level);
+}
+
+QByteArray VFSManager::encryptContent(const QByteArray &content, bool compressed, const Processing &settings) {
+    // bit0 = compressed; bits2-3 = compression algorithm (0=zlib,1=lz4,2=zstd)
+    unsigned char flags = compressed ? 0x01 : 0x00;
+    if (compressed) {
+        unsigned char compCode = 0;
+        switch (settings.compression) {
+            case CompressionManager::ZLIB: compCode = 0; break;
+            case CompressionManager::LZ4: compCode = 1; break;
+            case CompressionManager::ZSTD: compCode = 2; break;
+            case CompressionManager::GZIP: compCode = 0; break;
+        }
+        flags |= (compCode & 0x03) << 2;
+    }
+    return EncryptionManager::instance().encryptWithFlags(content, settings.encryption, flags);
+}
+
 QByteArray VFSManager::unprocessContent(const QByteArray &processedContent, bool isEncrypted, bool isCompressed) {
     QByteArray content = processedContent;
     
@@ -349,27 +709,27 @@ QByteArray VFSManager::unprocessContent(const QByteArray &processedContent, bool
         // Check if content was compressed (bit 0 of flags)
         bool wasCompressed = (flags & 0x01) != 0;
         if (wasCompressed || isCompressed) {
-            // Determine compression algorithm from flags if present
-            CompressionManager::CompressionAlgorithm compAlg = CompressionManager::ZLIB;
+            // The compression frame names its algorithm; the flags only matter for unframed legacy data
+            CompressionManager::CompressionAlgorithm legacyAlg = CompressionManager::ZLIB;
             if (wasCompressed) {
                 unsigned char compCode = (flags >> 2) & 0x03;
                 switch (compCode) {
-                    case 0: compAlg = CompressionManager::ZLIB; break;
-                    case 1: compAlg = CompressionManager::LZ4; break;
-                    case 2: compAlg = CompressionManager::ZSTD; break;
-                    default: compAlg = CompressionManager::ZLIB; break;
+                    case 0: legacyAlg = CompressionManager::ZLIB; break;
+                    case 1: legacyAlg = CompressionManager::LZ4; break;
+                    case 2: legacyAlg = CompressionManager::ZSTD; break;
+                    default: legacyAlg = CompressionManager::ZLIB; break;
                 }
             }
-            content = CompressionManager::instance().decompress(content, compAlg);
-            if (content.isEmpty()) {
+            QByteArray compressed = content;
+            if (!CompressionManager::instance().decompressFramed(compressed, content, legacyAlg)) {
                 qWarning() << "VFSManager: Decompression failed";
                 return QByteArray();
             }
         }
     } else if (isCompressed) {
         // Not encrypted but compressed
-        content = CompressionManager::instance().decompress(content, CompressionManager::ZLIB);
-        if (content.isEmpty()) {
+        if (!CompressionManager::instance().decompressFramed(processedContent, content)) {
+            qWarning() << "VFSManager: Decompression failed";
             return QByteArray();
         }
     }
@@ -377,38 +737,181 @@ QByteArray VFSManager::unprocessContent(const QByteArray &processedContent, bool
     return content;
 }
 
-bool VFSManager::reprocessFile(int fileId, bool encrypt, bool compress) {
-    if (m_currentUserId == -1) return false;
-    FileRecord file;
-    if (!DatabaseManager::instance().getFile(fileId, file)) return false;
-    if (file.userId != m_currentUserId) return false;
+QByteArray VFSManager::chunkKey(const QByteArray &plain, bool encrypt, bool compress, const Processing &settings) const {
+    // Processing settings are part of the key: the same plaintext stored with a
+    // different cipher or compressor is a different stored chunk
+    QByteArray domain("chunk-v1:");
+    domain.append(char(encrypt ? 1 + settings.encryption : 0));
+    domain.append(char(compress ? 1 + settings.compression : 0));
+    
+    if (encrypt) {
+        // Keyed by the user's key: equal chunks are only found within the same key,
+        // and the hash reveals nothing about the plaintext to other users
+        return EncryptionManager::instance().keyedHash(plain, domain);
+    }
+    
+    // Unencrypted chunks are stored in the clear anyway, so they are shared vault-wide
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    hash.addData(domain);
+    hash.addData(plain);
+    return hash.result();
+}
 
-    // Obtain current plaintext regardless of existing transformations
-    QByteArray plain;
-    if (!getFileContent(fileId, plain)) {
-        qWarning() << "VFSManager: reprocessFile failed to obtain plaintext";
+bool VFSManager::storeChunk(int fileId, FileChunk &chunk, const QByteArray &plain, bool encrypt, bool compress) {
+    DatabaseManager &db = DatabaseManager::instance();
+    chunk.hash = chunkKey(plain, encrypt, compress);
+    if (chunk.hash.isEmpty()) {
         return false;
     }
+    
+    // Only compress/encrypt chunks the store has not seen yet
+    chunk.data.clear();
+    if (!db.hasChunk(chunk.hash)) {
+        chunk.data = processContent(plain, encrypt, compress);
+        if (chunk.data.isEmpty()) {
+            return false;
+        }
+    }
+    
+    return db.writeFileChunk(fileId, chunk);
+}
 
-    QByteArray processed = processContent(plain, encrypt, compress);
-    if (processed.isEmpty()) return false;
+bool VFSManager::storeChunks(int fileId, QIODevice &source, bool encrypt, bool compress,
+                             qint64 &size, QByteArray &checksum, int &chunkCount) {
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    ContentChunker chunker(source);
+    QByteArray plain;
+    size = 0;
+    chunkCount = 0;
+    
+    while (chunker.next(plain)) {
+        FileChunk chunk;
+        chunk.index = chunkCount++;
+        chunk.plainOffset = size;
+        chunk.plainSize = plain.size();
+        if (!storeChunk(fileId, chunk, plain, encrypt, compress)) {
+            return false;
+        }
+        
+        hash.addData(plain);
+        size += plain.size();
+    }
+    
+    if (chunker.hasError()) {
+        qWarning() << "VFSManager: Failed to read source:" << source.errorString();
+        return false;
+    }
+    
+    checksum = hash.result();
+    return true;
+}
 
-    file.isEncrypted = encrypt;
-    file.isCompressed = compress;
-    file.size = plain.size();
-    file.modifiedAt = QDateTime::currentDateTime();
-    file.checksum = EncryptionManager::instance().calculateChecksum(plain);
-    if (encrypt) {
-        file.encryptedContent = processed;
-        file.content.clear();
+bool VFSManager::rewriteContent(const FileMeta &file, QIODevice &source, bool encrypt, bool compress) {
+    DatabaseManager &db = DatabaseManager::instance();
+    if (!db.beginTransaction()) {
+        return false;
+    }
+    
+    bool ok = false;
+    QByteArray small;
+    if (takeInlineContent(source, small)) {
+        // Now small enough to live in the row: every chunk goes
+        const QByteArray stored = processContent(small, encrypt, compress);
+        ok = !stored.isEmpty() &&
+             db.deleteFileChunks(file.id) &&
+             db.collectUnreferencedChunks() >= 0 &&
+             db.setInlineContent(file.id, stored, small.size(), EncryptionManager::instance().calculateChecksum(small), encrypt, compress);
     } else {
-        file.content = processed;
-        file.encryptedContent.clear();
+        // New chunks overwrite the old slots first and surplus slots are dropped after,
+        // so chunks shared with the previous content are re-referenced rather than rewritten
+        qint64 size = 0;
+        QByteArray checksum;
+        int chunkCount = 0;
+        ok = storeChunks(file.id, source, encrypt, compress, size, checksum, chunkCount) &&
+             db.deleteFileChunks(file.id, chunkCount) &&
+             db.collectUnreferencedChunks() >= 0 &&
+             db.finishChunkedFile(file.id, size, checksum, encrypt, compress);
+    }
+    if (!ok) {
+        db.rollbackTransaction();
+        return false;
     }
+    
+    return db.commitTransaction();
+}
 
-    if (DatabaseManager::instance().updateFile(file)) {
+bool VFSManager::forEachPlainChunk(const FileMeta &file, const std::function<bool(const QByteArray &plain)> &consumer) {
+    DatabaseManager &db = DatabaseManager::instance();
+    int chunkCount = db.getFileChunkCount(file.id);
+    
+    for (int i = 0; i < chunkCount; ++i) {
+        QList<FileChunk> chunks;
+        if (!db.readFileChunks(file.id, i, 1, chunks) || chunks.isEmpty()) {
+            qWarning() << "VFSManager: Missing chunk" << i << "of file" << file.id;
+            return false;
+        }
+        
+        const FileChunk &chunk = chunks.first();
+        QByteArray plain = unprocessContent(chunk.data, file.isEncrypted, file.isCompressed);
+        if (plain.size() != chunk.plainSize) {
+            qWarning() << "VFSManager: Chunk" << i << "of file" << file.id << "failed to decode";
+            return false;
+        }
+        if (!consumer(plain)) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+bool VFSManager::reprocessFile(int fileId, bool encrypt, bool compress) {
+    if (m_currentUserId == -1) return false;
+    FileMeta file;
+    if (!getFileMeta(fileId, file)) return false;
+
+    if (!file.isChunked) {
+        // Legacy single-blob row: decode once and rewrite as chunks
+        QByteArray plain;
+        if (!getFileContent(fileId, plain)) {
+            qWarning() << "VFSManager: reprocessFile failed to obtain plaintext";
+            return false;
+        }
+        QBuffer buffer;
+        buffer.setData(plain);
+        buffer.open(QIODevice::ReadOnly);
+        if (!rewriteContent(file, buffer, encrypt, compress)) return false;
         emit fileUpdated(fileId);
         return true;
     }
-    return false;
-}
\ No newline at end of file
+
+    // Chunk boundaries do not depend on processing, so each chunk is transformed in place
+    DatabaseManager &db = DatabaseManager::instance();
+    if (!db.beginTransaction()) return false;
+
+    int index = 0;
+    qint64 offset = 0;
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    bool ok = forEachPlainChunk(file, [&](const QByteArray &plain) {
+        hash.addData(plain);
+        FileChunk chunk;
+        chunk.index = index++;
+        chunk.plainOffset = offset;
+        chunk.plainSize = plain.size();
+        offset += plain.size();
+        return storeChunk(fileId, chunk, plain, encrypt, compress);
+    });
+    if (!ok || hash.result() != file.checksum) {
+        qWarning() << "VFSManager: reprocessFile failed for file" << fileId;
+        db.rollbackTransaction();
+        return false;
+    }
+    if (db.collectUnreferencedChunks() < 0 ||
+        !db.finishChunkedFile(fileId, file.size, file.checksum, encrypt, compress) || !db.commitTransaction()) {
+        db.rollbackTransaction();
+        return false;
+    }
+
+    emit fileUpdated(fileId);
+    return true;
+}
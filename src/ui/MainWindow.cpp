@@ -3,9 +3,11 @@
 //
 #include "MainWindow.h"
 #include "VFSManager.h"
+#include "VFSFile.h"
 #include "DatabaseManager.h"
 #include "LoginDialog.h"
 #include "FileSystemScanner.h"
+#include "ImportPipeline.h"
 #include <QTreeWidget>
 #include <QTreeWidgetItem>
 #include <QTextEdit>
@@ -49,6 +51,11 @@
 #include <QDialog>
 #include <QDialogButtonBox>
 
+namespace {
+    // Views that only show the head of a file read at most this many bytes
+    constexpr qint64 PREVIEW_BYTES = 256 * 1024;
+}
+
 MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
     setWindowTitle("Secure Virtual File System - SVFS");
     resize(1200, 800);
@@ -159,8 +166,15 @@ void MainWindow::setupUI() {
             QString itemType = item->data(0, Qt::UserRole + 1).toString();
             if (itemType == "file") {
                 int fileId = item->data(0, Qt::UserRole).toInt();
-                FileRecord file;
-                if (DatabaseManager::instance().getFile(fileId, file)) {
+                FileMeta file;
+                if (DatabaseManager::instance().getFileMeta(fileId, file)) {
+                    QString encrypted = file.isEncrypted ? "Yes" : "No";
+                    QByteArray header; EncryptionManager::HeaderInfo info;
+                    if (file.isEncrypted &&
+                        VFSManager::instance().readStoredPrefix(fileId, EncryptionManager::HEADER_PROBE_SIZE, header) &&
+                        EncryptionManager::instance().probeHeader(header, info)) {
+                        encrypted = QString("Yes (%1)").arg(EncryptionManager::instance().getAlgorithmName(info.algorithm));
+                    }
                     QString props = QString(
                         "<b>File Properties</b><br><br>"
                         "<b>Name:</b> %1<br>"
@@ -174,7 +188,7 @@ void MainWindow::setupUI() {
                     ).arg(file.filename, file.path, formatFileSize(file.size), file.mimeType,
                           file.createdAt.toString("yyyy-MM-dd HH:mm:ss"), 
                           file.modifiedAt.toString("yyyy-MM-dd HH:mm:ss"),
-                          file.isEncrypted ? "Yes" : "No",
+                          encrypted,
                           file.isCompressed ? "Yes" : "No");
                     m_propertiesLabel->setText(props);
                 }
@@ -335,6 +349,13 @@ void MainWindow::setupMenuBar() {
     toolsMenu->addSeparator();
     toolsMenu->addAction(m_scanAction);
     toolsMenu->addAction(m_cancelScanAction);
+    toolsMenu->addSeparator();
+    QAction *recomputeStatsAction = new QAction("Recompute &Statistics", this);
+    recomputeStatsAction->setStatusTip("Recount files, folders and sizes from the vault contents");
+    toolsMenu->addAction(recomputeStatsAction);
+    m_compactStorageAction = new QAction("&Compact Storage", this);
+    m_compactStorageAction->setStatusTip("Reclaim space of deleted content in pack files");
+    toolsMenu->addAction(m_compactStorageAction);
     
     // Help menu
     QMenu *helpMenu = menuBar()->addMenu("&Help");
@@ -367,6 +388,24 @@ void MainWindow::setupMenuBar() {
     connect(settingsAction, &QAction::triggered, this, [this]() { showSettings(); });
     connect(m_scanAction, &QAction::triggered, this, [this]() { scanDrive(); });
     connect(m_cancelScanAction, &QAction::triggered, this, [this]() { cancelScan(); });
+    connect(recomputeStatsAction, &QAction::triggered, this, [this]() {
+        if (!DatabaseManager::instance().recomputeUserStats()) {
+            QMessageBox::warning(this, "Statistics", "Failed to recompute statistics");
+        }
+        loadFileTree();
+    });
+    connect(m_compactStorageAction, &QAction::triggered, this, [this]() {
+        if (m_importPipeline) {
+            QMessageBox::information(this, "Compact Storage", "Wait for the import to finish.");
+            return;
+        }
+        const qint64 reclaimed = DatabaseManager::instance().compactPacks();
+        if (reclaimed < 0) {
+            QMessageBox::warning(this, "Compact Storage", "Failed to compact pack files");
+            return;
+        }
+        m_statusLabel->setText(QString("Storage compacted, %1 reclaimed").arg(formatFileSize(reclaimed)));
+    });
     connect(exitAction, &QAction::triggered, this, &MainWindow::close);
     connect(proofAction, &QAction::triggered, this, &MainWindow::showEncryptionProof);
     connect(aboutAction, &QAction::triggered, this, [this]() { showAbout(); });
@@ -491,7 +530,7 @@ void MainWindow::loadFileTree(const QString &path) {
     }
     
     // Load files from VFS
-    QList<FileRecord> files = VFSManager::instance().getFilesInDirectory(path);
+    QList<FileMeta> files = VFSManager::instance().listDirectory(path);
     for (const auto &file : files) {
         QString sizeStr = formatFileSize(file.size);
         QString typeStr = file.isEncrypted ? "Encrypted" : (file.isCompressed ? "Compressed" : "Normal");
@@ -514,14 +553,14 @@ void MainWindow::loadFileTree(const QString &path) {
     fileTree->expandAll();
     
     // Update status with stats
-    int fileCount = VFSManager::instance().getFileCount();
-    int dirCount = VFSManager::instance().getDirectoryCount();
-    qint64 totalSize = VFSManager::instance().getTotalStorageUsed();
-    m_statusLabel->setText(QString("VFS: %1 | Files: %2 | Folders: %3 | Size: %4")
+    UserStats stats;
+    VFSManager::instance().getUserStats(stats);
+    m_statusLabel->setText(QString("VFS: %1 | Files: %2 (%3 inline) | Folders: %4 | Size: %5 (stored: %6)")
         .arg(QFileInfo(m_currentVfsPath).fileName())
-        .arg(fileCount)
-        .arg(dirCount)
-        .arg(formatFileSize(totalSize)));
+        .arg(stats.fileCount)
+        .arg(stats.inlineFileCount)
+        .arg(stats.directoryCount)
+        .arg(formatFileSize(stats.logicalBytes), formatFileSize(stats.storedBytes)));
 }
 
 QString MainWindow::formatFileSize(qint64 bytes) {
@@ -576,12 +615,22 @@ void MainWindow::openFile() {
     m_statusLabel->setText(QString("Opening %1...").arg(fileName));
     
     // Get file record to check encryption status
-    FileRecord fileRecord;
-    bool hasFileRecord = DatabaseManager::instance().getFile(fileId, fileRecord);
-    
-    // Get file content from VFS
+    FileMeta fileRecord;
+    bool hasFileRecord = DatabaseManager::instance().getFileMeta(fileId, fileRecord);
+    
+    // Text preview needs only the head of the file; binaries need no content at all
+    const bool isText = fileName.endsWith(".txt") || fileName.endsWith(".md") || fileName.endsWith(".cpp") || 
+        fileName.endsWith(".h") || fileName.endsWith(".json") || fileName.endsWith(".xml") ||
+        fileName.endsWith(".log") || fileName.endsWith(".csv");
+    VFSFile file(fileId);
     QByteArray content;
-    if (VFSManager::instance().getFileContent(fileId, content)) {
+    bool readOk = file.open(QIODevice::ReadOnly);
+    if (readOk && isText) {
+        content = file.read(PREVIEW_BYTES);
+        readOk = file.size() == 0 || !content.isEmpty();
+    }
+    
+    if (readOk) {
         QString displayText;
         
         // Add encryption/compression banner if applicable
@@ -597,17 +646,19 @@ void MainWindow::openFile() {
             displayText += "╚════════════════════════════════════════════════════════╝\n\n";
         }
         
-        if (fileName.endsWith(".txt") || fileName.endsWith(".md") || fileName.endsWith(".cpp") || 
-            fileName.endsWith(".h") || fileName.endsWith(".json") || fileName.endsWith(".xml") ||
-            fileName.endsWith(".log") || fileName.endsWith(".csv")) {
+        if (isText) {
             displayText += QString::fromUtf8(content);
+            if (file.size() > content.size()) {
+                displayText += QString("\n\n[Preview truncated: showing %1 of %2. Use Edit or Export for the full file.]")
+                    .arg(formatFileSize(content.size())).arg(formatFileSize(file.size()));
+            }
             filePreview->setText(displayText);
         } else {
             displayText += QString("File: %1\nSize: %2 bytes\nType: Binary\n\nBinary file - content not displayed as text.\n\nUse 'Export' to save this file to disk.")
-                .arg(fileName).arg(content.size());
+                .arg(fileName).arg(file.size());
             filePreview->setText(displayText);
         }
-        m_statusLabel->setText(QString("Opened: %1 (%2)").arg(fileName).arg(formatFileSize(content.size())));
+        m_statusLabel->setText(QString("Opened: %1 (%2)").arg(fileName).arg(formatFileSize(file.size())));
     } else {
         filePreview->setText(QString("Error: Could not read file %1\n\nThe file may be corrupted or encryption key is invalid.").arg(fileName));
         m_statusLabel->setText("Error opening file");
@@ -726,7 +777,7 @@ void MainWindow::createNewFolder() {
     QString folderName = QInputDialog::getText(this, "New Folder", "Enter folder name:", 
                                              QLineEdit::Normal, "New Folder", &ok);
     if (ok && !folderName.isEmpty()) {
-        if (VFSManager::instance().createDirectory(folderName, "/")) {
+        if (VFSManager::instance().createDirectory(folderName, m_currentPath)) {
             m_statusLabel->setText(QString("Created folder: %1").arg(folderName));
             refreshFileTree();
         } else {
@@ -771,7 +822,7 @@ void MainWindow::importFile() {
         connect(cancelButton, &QPushButton::clicked, &optionsDialog, &QDialog::reject);
         
         if (optionsDialog.exec() == QDialog::Accepted) {
-            if (VFSManager::instance().importFile(fileName, "/", encryptCheck->isChecked(), compressCheck->isChecked())) {
+            if (VFSManager::instance().importFile(fileName, m_currentPath, encryptCheck->isChecked(), compressCheck->isChecked())) {
                 m_statusLabel->setText(QString("Imported file: %1").arg(vfsFileName));
                 refreshFileTree();
             } else {
@@ -789,9 +840,14 @@ void MainWindow::deleteSelected() {
     }
     
     QString itemNames;
+    bool hasFolders = false;
     for (auto item : selected) {
         if (!itemNames.isEmpty()) itemNames += ", ";
         itemNames += item->text(0);
+        hasFolders = hasFolders || item->data(0, Qt::UserRole + 1).toString() == "directory";
+    }
+    if (hasFolders) {
+        itemNames += "\n\nFolders are deleted with everything in them.";
     }
     
     int ret = QMessageBox::question(this, "Delete Items", 
@@ -828,9 +884,21 @@ void MainWindow::renameSelected() {
     QString newName = QInputDialog::getText(this, "Rename", "Enter new name:", 
                                           QLineEdit::Normal, oldName, &ok);
     if (ok && !newName.isEmpty() && newName != oldName) {
-        // TODO: Implement rename functionality in VFS
-        item->setText(0, newName);
-        m_statusLabel->setText(QString("Renamed %1 to %2").arg(oldName, newName));
+        QString itemType = item->data(0, Qt::UserRole + 1).toString();
+        int itemId = item->data(0, Qt::UserRole).toInt();
+        bool renamed = false;
+        if (itemType == "file") {
+            renamed = VFSManager::instance().renameFile(itemId, newName);
+        } else if (itemType == "directory") {
+            renamed = VFSManager::instance().renameDirectory(itemId, newName);
+        }
+        
+        if (renamed) {
+            item->setText(0, newName);
+            m_statusLabel->setText(QString("Renamed %1 to %2").arg(oldName, newName));
+        } else {
+            QMessageBox::warning(this, "Error", "Failed to rename. The name may be invalid or already in use.");
+        }
     }
 }
 
@@ -848,7 +916,7 @@ void MainWindow::searchFiles(const QString &searchText) {
     fileTree->clear();
     
     // Search files in VFS
-    QList<FileRecord> files = VFSManager::instance().searchFiles(searchText);
+    QList<FileMeta> files = VFSManager::instance().searchFileMeta(searchText);
     for (const auto &file : files) {
         QString sizeStr = formatFileSize(file.size);
         QString typeStr = file.isEncrypted ? "Encrypted" : (file.isCompressed ? "Compressed" : "Normal");
@@ -859,6 +927,11 @@ void MainWindow::searchFiles(const QString &searchText) {
         fileItem->setData(0, Qt::UserRole, file.id);
         fileItem->setData(0, Qt::UserRole + 1, "file");
     }
+    if (files.size() >= DatabaseManager::DEFAULT_SEARCH_LIMIT) {
+        m_statusLabel->setText(QString("Showing the best %1 matches - refine the search for more").arg(files.size()));
+    } else {
+        m_statusLabel->setText(QString("%1 match(es)").arg(files.size()));
+    }
 }
 
 void MainWindow::showFileProperties() {
@@ -873,15 +946,17 @@ void MainWindow::showFileProperties() {
     int itemId = item->data(0, Qt::UserRole).toInt();
     
     if (itemType == "file") {
-        FileRecord file;
-        if (DatabaseManager::instance().getFile(itemId, file)) {
+        FileMeta file;
+        if (DatabaseManager::instance().getFileMeta(itemId, file)) {
             QString algName = "-";
             QString compressedStr = file.isCompressed ? "Yes" : "No";
-            if (file.isEncrypted && !file.encryptedContent.isEmpty()) {
-                QByteArray plainTmp; unsigned char flags = 0; EncryptionManager::EncryptionAlgorithm detAlg;
-                if (EncryptionManager::instance().decryptAndGetFlags(file.encryptedContent, plainTmp, flags, detAlg)) {
-                    algName = EncryptionManager::instance().getAlgorithmName(detAlg);
-                    if (flags & 0x01) compressedStr = "Yes (inside encrypted)";
+            if (file.isEncrypted) {
+                // Header bytes only; every chunk of a file carries the same header
+                QByteArray header; EncryptionManager::HeaderInfo info;
+                if (VFSManager::instance().readStoredPrefix(itemId, EncryptionManager::HEADER_PROBE_SIZE, header) &&
+                    EncryptionManager::instance().probeHeader(header, info)) {
+                    algName = EncryptionManager::instance().getAlgorithmName(info.algorithm);
+                    if (info.flags & 0x01) compressedStr = "Yes (inside encrypted)";
                 } else {
                     algName = "Unknown/Invalid";
                 }
@@ -901,11 +976,29 @@ void MainWindow::showFileProperties() {
                   file.createdAt.toString(), file.modifiedAt.toString(),
                   file.isEncrypted ? "Yes" : "No", algName, compressedStr,
                   QString::number(file.userId));
+            properties += QString("\nStored Size: %1").arg(formatFileSize(file.storedSize));
             
             QMessageBox::information(this, "File Properties", properties);
         }
-    } else {
-        QMessageBox::information(this, "Properties", "Directory properties not implemented yet.");
+    } else if (itemType == "directory") {
+        UserStats stats;
+        if (VFSManager::instance().getDirectoryStats(itemId, stats)) {
+            QString properties = QString(
+                "Name: %1\n"
+                "Location: %2\n"
+                "Contains: %3 file(s), %4 folder(s)\n"
+                "Size: %5\n"
+                "Stored Size: %6\n"
+                "Stored inline: %7 file(s), %8"
+            ).arg(item->text(0), m_currentPath)
+             .arg(stats.fileCount)
+             .arg(stats.directoryCount)
+             .arg(formatFileSize(stats.logicalBytes), formatFileSize(stats.storedBytes))
+             .arg(stats.inlineFileCount)
+             .arg(formatFileSize(stats.inlineBytes));
+            
+            QMessageBox::information(this, "Folder Properties", properties);
+        }
     }
 }
 
@@ -991,8 +1084,39 @@ void MainWindow::showSettings() {
     securityLayout->addWidget(compressionGroup);
     securityLayout->addStretch();
     
+    // Storage tab (per vault)
+    QWidget *storageTab = new QWidget();
+    QVBoxLayout *storageLayout = new QVBoxLayout(storageTab);
+    
+    QGroupBox *packGroup = new QGroupBox("Content Storage");
+    QFormLayout *packLayout = new QFormLayout(packGroup);
+    
+    // Combo index follows BlobStore::Kind
+    QComboBox *blobStoreCombo = new QComboBox();
+    blobStoreCombo->addItems({"SQLite (inline)", "SQLite (incremental I/O)", "Pack files next to the vault"});
+    for (BlobStore::Kind kind : {BlobStore::Inline, BlobStore::Incremental, BlobStore::Pack}) {
+        if (!DatabaseManager::instance().isBlobStoreAvailable(kind)) {
+            blobStoreCombo->setItemData(kind, 0, Qt::UserRole - 1); // disables the item
+        }
+    }
+    blobStoreCombo->setCurrentIndex(VFSManager::instance().blobStoreKind());
+    blobStoreCombo->setToolTip("Where new content is stored; existing content stays where it is");
+    packLayout->addRow("Store new content in:", blobStoreCombo);
+    
+    QSpinBox *inlineThresholdSpin = new QSpinBox();
+    inlineThresholdSpin->setRange(0, 1024);
+    inlineThresholdSpin->setSuffix(" KB");
+    inlineThresholdSpin->setSpecialValueText("Never");
+    inlineThresholdSpin->setValue(int(VFSManager::instance().inlineThreshold() / 1024));
+    inlineThresholdSpin->setToolTip("Files up to this size keep their content in the file's row instead of chunks");
+    packLayout->addRow("Store files inline up to:", inlineThresholdSpin);
+    
+    storageLayout->addWidget(packGroup);
+    storageLayout->addStretch();
+    
     tabWidget->addTab(generalTab, "General");
     tabWidget->addTab(securityTab, "Security");
+    tabWidget->addTab(storageTab, "Storage");
     
     QPushButton *okButton = new QPushButton("OK");
     QPushButton *cancelButton = new QPushButton("Cancel");
@@ -1022,6 +1146,16 @@ void MainWindow::showSettings() {
         switch (compressionAlgoCombo->currentIndex()) { case 1: compAlg = CompressionManager::LZ4; break; case 2: compAlg = CompressionManager::ZSTD; break; default: compAlg = CompressionManager::ZLIB; }
         VFSManager::instance().setDefaultCompressionAlgorithm(compAlg);
         VFSManager::instance().setCompressionLevel(compressionLevelSpin->value());
+        const auto blobStoreKind = BlobStore::Kind(blobStoreCombo->currentIndex());
+        if (blobStoreKind != VFSManager::instance().blobStoreKind() &&
+            !VFSManager::instance().setBlobStore(blobStoreKind)) {
+            QMessageBox::warning(this, "Settings", "Failed to change the content storage");
+        }
+        const qint64 inlineThreshold = qint64(inlineThresholdSpin->value()) * 1024;
+        if (inlineThreshold != VFSManager::instance().inlineThreshold() &&
+            !VFSManager::instance().setInlineThreshold(inlineThreshold)) {
+            QMessageBox::warning(this, "Settings", "Failed to change the inline size limit");
+        }
         m_statusLabel->setText("Settings applied");
     }
 }
@@ -1088,8 +1222,8 @@ void MainWindow::showContextMenu(const QPoint &pos) {
         if (isFile) {
             // Check file properties
             int fileId = item->data(0, Qt::UserRole).toInt();
-            FileRecord file;
-            if (DatabaseManager::instance().getFile(fileId, file)) {
+            FileMeta file;
+            if (DatabaseManager::instance().getFileMeta(fileId, file)) {
                 isEncrypted = file.isEncrypted;
                 isCompressed = file.isCompressed;
             }
@@ -1169,26 +1303,65 @@ void MainWindow::showContextMenu(const QPoint &pos) {
 void MainWindow::copyFile() {
     QList<QTreeWidgetItem*> selected = fileTree->selectedItems();
     if (!selected.isEmpty()) {
-        QString fileName = selected.first()->text(0);
+        QTreeWidgetItem *item = selected.first();
+        QString fileName = item->text(0);
         QApplication::clipboard()->setText(fileName);
+        QString itemType = item->data(0, Qt::UserRole + 1).toString();
+        if (itemType == "file" || itemType == "directory") {
+            m_clipboardFileId = item->data(0, Qt::UserRole).toInt();
+            m_clipboardIsDirectory = itemType == "directory";
+            m_cutMode = false;
+        }
         m_statusLabel->setText(QString("Copied %1 to clipboard").arg(fileName));
     }
 }
 
 void MainWindow::pasteFile() {
-    QString clipboardText = QApplication::clipboard()->text();
-    if (!clipboardText.isEmpty()) {
-        // TODO: Implement paste functionality with VFS
-        m_statusLabel->setText(QString("Paste operation not yet implemented"));
+    if (m_clipboardFileId == -1) {
+        return;
+    }
+    if (!m_cutMode) {
+        // Shares the stored content, so even large folders copy in one metadata transaction
+        bool copied = m_clipboardIsDirectory
+            ? VFSManager::instance().copyDirectory(m_clipboardFileId, m_currentPath)
+            : VFSManager::instance().copyFile(m_clipboardFileId, m_currentPath);
+        if (copied) {
+            m_statusLabel->setText(QString("Pasted into %1").arg(m_currentPath));
+            refreshFileTree();
+        } else {
+            QMessageBox::warning(this, "Error", "Failed to paste here. A folder cannot be copied into itself.");
+        }
+        return;
+    }
+    
+    // Cut + paste is a move: metadata only, however large the folder
+    bool moved = m_clipboardIsDirectory
+        ? VFSManager::instance().moveDirectory(m_clipboardFileId, m_currentPath)
+        : VFSManager::instance().moveFile(m_clipboardFileId, m_currentPath);
+    if (moved) {
+        m_clipboardFileId = -1;
+        m_cutMode = false;
+        m_statusLabel->setText(QString("Moved to %1").arg(m_currentPath));
+        refreshFileTree();
+    } else {
+        QMessageBox::warning(this, "Error", "Failed to move here. A folder cannot be moved into itself or onto an existing name.");
     }
 }
 
 void MainWindow::cutFile() {
     QList<QTreeWidgetItem*> selected = fileTree->selectedItems();
     if (!selected.isEmpty()) {
-        QString fileName = selected.first()->text(0);
+        QTreeWidgetItem *item = selected.first();
+        QString itemType = item->data(0, Qt::UserRole + 1).toString();
+        if (itemType != "file" && itemType != "directory") {
+            return;
+        }
+        QString fileName = item->text(0);
         QApplication::clipboard()->setText(fileName);
-        m_statusLabel->setText(QString("Cut %1 (paste not yet implemented)").arg(fileName));
+        m_clipboardFileId = item->data(0, Qt::UserRole).toInt();
+        m_clipboardIsDirectory = itemType == "directory";
+        m_cutMode = true;
+        m_statusLabel->setText(QString("Cut %1 - open the destination folder and paste").arg(fileName));
     }
 }
 
@@ -1233,8 +1406,8 @@ void MainWindow::showEncryptionProof() {
     QString fileName = item->text(0);
     
     // Get file record directly from database
-    FileRecord file;
-    if (!DatabaseManager::instance().getFile(fileId, file)) {
+    FileMeta file;
+    if (!DatabaseManager::instance().getFileMeta(fileId, file)) {
         QMessageBox::critical(this, "Error", "Failed to get file information!");
         return;
     }
@@ -1267,10 +1440,11 @@ void MainWindow::showEncryptionProof() {
     rawView->setFontFamily("Courier New");
     rawView->setStyleSheet("background: #1e1e1e; color: #00ff00;");
     
-    QByteArray rawData = file.isEncrypted ? file.encryptedContent : file.content;
+    QByteArray rawData;
+    VFSManager::instance().readStoredPrefix(fileId, 1024, rawData);
     QString hexDump;
     hexDump += "=== RAW DATABASE STORAGE (First 1024 bytes) ===\n\n";
-    hexDump += QString("Total stored bytes: %1\n\n").arg(rawData.size());
+    hexDump += QString("Total stored bytes: %1\n\n").arg(file.storedSize);
     
     int bytesToShow = qMin(1024, rawData.size());
     for (int i = 0; i < bytesToShow; i += 16) {
@@ -1292,7 +1466,10 @@ void MainWindow::showEncryptionProof() {
     
     if (file.isEncrypted) {
         hexDump += "\n\n☠☠☠ THIS IS ENCRYPTED DATA - UNREADABLE! ☠☠☠\n";
-        hexDump += "The above bytes are AES-256 encrypted.\n";
+        EncryptionManager::HeaderInfo info;
+        const QString algName = EncryptionManager::instance().probeHeader(rawData, info)
+            ? EncryptionManager::instance().getAlgorithmName(info.algorithm) : QString("AES-256");
+        hexDump += QString("The above bytes are %1 encrypted.\n").arg(algName);
         hexDump += "Without the decryption key, this data is secure.\n";
     }
     
@@ -1304,9 +1481,19 @@ void MainWindow::showEncryptionProof() {
     decryptedView->setReadOnly(true);
     decryptedView->setFontFamily("Courier New");
     
+    // Only the head is shown, so only the chunks covering it are decrypted
+    VFSFile plainFile(fileId);
     QByteArray decryptedData;
-    if (VFSManager::instance().getFileContent(fileId, decryptedData)) {
+    bool readOk = plainFile.open(QIODevice::ReadOnly);
+    if (readOk) {
+        decryptedData = plainFile.read(PREVIEW_BYTES);
+        readOk = plainFile.size() == 0 || !decryptedData.isEmpty();
+    }
+    if (readOk) {
         QString content = QString::fromUtf8(decryptedData);
+        if (plainFile.size() > decryptedData.size()) {
+            content += QString("\n\n[... %1 more]").arg(formatFileSize(plainFile.size() - decryptedData.size()));
+        }
         decryptedView->setText("=== DECRYPTED/DECOMPRESSED CONTENT ===\n\n" + content);
         decryptedView->setStyleSheet("background: #ecf0f1; color: #2c3e50;");
     } else {
@@ -1345,10 +1532,10 @@ void MainWindow::exportFile() {
     QString fileName = item->text(0);
     
     // Check if file is encrypted
-    FileRecord fileRecord;
+    FileMeta fileRecord;
     bool isEncrypted = false;
     bool isCompressed = false;
-    if (DatabaseManager::instance().getFile(fileId, fileRecord)) {
+    if (DatabaseManager::instance().getFileMeta(fileId, fileRecord)) {
         isEncrypted = fileRecord.isEncrypted;
         isCompressed = fileRecord.isCompressed;
     }
@@ -1394,20 +1581,8 @@ void MainWindow::exportFile() {
     // Export based on user choice
     bool success = false;
     if (exportRaw && (isEncrypted || isCompressed)) {
-        // Export raw encrypted/compressed data
-        QByteArray rawData;
-        if (isEncrypted) {
-            rawData = fileRecord.encryptedContent;
-        } else {
-            rawData = fileRecord.content;
-        }
-        
-        QFile file(savePath);
-        if (file.open(QIODevice::WriteOnly)) {
-            qint64 written = file.write(rawData);
-            file.close();
-            success = (written == rawData.size());
-        }
+        // Export raw encrypted/compressed data as stored (chunked content in a container)
+        success = VFSManager::instance().exportRawFile(fileId, savePath);
     } else {
         // Export decrypted/decompressed data
         success = VFSManager::instance().exportFile(fileId, savePath);
@@ -1471,8 +1646,8 @@ void MainWindow::encryptFile() {
     QString fileName = item->text(0);
     
     // Get file record
-    FileRecord file;
-    if (!DatabaseManager::instance().getFile(fileId, file)) {
+    FileMeta file;
+    if (!DatabaseManager::instance().getFileMeta(fileId, file)) {
         QMessageBox::critical(this, "Error", "Failed to get file information!");
         return;
     }
@@ -1517,8 +1692,8 @@ void MainWindow::decryptFile() {
     QString fileName = item->text(0);
     
     // Get file record
-    FileRecord file;
-    if (!DatabaseManager::instance().getFile(fileId, file)) {
+    FileMeta file;
+    if (!DatabaseManager::instance().getFileMeta(fileId, file)) {
         QMessageBox::critical(this, "Error", "Failed to get file information!");
         return;
     }
@@ -1563,8 +1738,8 @@ void MainWindow::compressFile() {
     QString fileName = item->text(0);
     
     // Get file record
-    FileRecord file;
-    if (!DatabaseManager::instance().getFile(fileId, file)) {
+    FileMeta file;
+    if (!DatabaseManager::instance().getFileMeta(fileId, file)) {
         QMessageBox::critical(this, "Error", "Failed to get file information!");
         return;
     }
@@ -1633,8 +1808,8 @@ void MainWindow::decompressFile() {
     QString fileName = item->text(0);
     
     // Get file record
-    FileRecord file;
-    if (!DatabaseManager::instance().getFile(fileId, file)) {
+    FileMeta file;
+    if (!DatabaseManager::instance().getFileMeta(fileId, file)) {
         QMessageBox::critical(this, "Error", "Failed to get file information!");
         return;
     }
@@ -1878,6 +2053,10 @@ void MainWindow::togglePreviewPanel() {
 }
 
 void MainWindow::importSelectedToVFS() {
+    if (m_importPipeline) {
+        QMessageBox::information(this, "Import", "An import is already in progress.");
+        return;
+    }
     QList<QTreeWidgetItem*> selected = fileTree->selectedItems();
     if (selected.isEmpty()) {
         QMessageBox::information(this, "Import", "Select files/folders from scan results to import.");
@@ -1908,9 +2087,7 @@ void MainWindow::importSelectedToVFS() {
     bool doEncrypt = encryptCheck->isChecked();
     bool doCompress = compressCheck->isChecked();
     
-    int imported = 0;
-    int failed = 0;
-    
+    QList<ImportJob> jobs;
     for (auto *item : selected) {
         QString type = item->data(0, Qt::UserRole + 1).toString();
         if (!type.startsWith("scan_")) continue; // skip VFS items
@@ -1918,27 +2095,50 @@ void MainWindow::importSelectedToVFS() {
         bool isDir = (type == "scan_dir");
         if (isDir) continue; // skip directories for now (could recursively import later)
         
-        QString realPath = item->toolTip(0);
-        QString filename = item->text(0);
-        
-        QFile f(realPath);
-        if (!f.open(QIODevice::ReadOnly)) {
-            failed++;
-            continue;
-        }
-        QByteArray content = f.readAll();
-        f.close();
-        
-        if (VFSManager::instance().createFile(filename, m_currentPath, content, doEncrypt, doCompress)) {
-            imported++;
-        } else {
-            failed++;
-        }
+        jobs.append({item->toolTip(0), item->text(0), m_currentPath});
+    }
+    if (jobs.isEmpty()) {
+        QMessageBox::information(this, "Import", "No files selected to import.");
+        return;
     }
     
-    loadFileTree();
-    QMessageBox::information(this, "Import Complete", 
-        QString("Imported %1 file(s). Failed: %2").arg(imported).arg(failed));
+    // Reading, compression, encryption and the database writes overlap across threads;
+    // the pipeline reports back here and the GUI stays responsive meanwhile
+    m_importPipeline = new ImportPipeline(this);
+    connect(m_importPipeline, &ImportPipeline::progress, this, [this](int imported, int failed, int totalFiles, qint64 bytesImported) {
+        m_progressBar->setMaximum(totalFiles);
+        m_progressBar->setValue(imported + failed);
+        m_statusLabel->setText(QString("Importing... %1/%2 file(s), %3")
+            .arg(imported + failed)
+            .arg(totalFiles)
+            .arg(formatFileSize(bytesImported)));
+    });
+    connect(m_importPipeline, &ImportPipeline::finished, this, [this](int imported, int failed, qint64 bytesImported, qint64 elapsedMs, bool cancelled) {
+        m_importPipeline->deleteLater();
+        m_importPipeline = nullptr;
+        m_compactStorageAction->setEnabled(true);
+        m_progressBar->setVisible(false);
+        loadFileTree();
+        m_statusLabel->setText(QString("Import %1 - %2 in %3 ms")
+            .arg(cancelled ? "cancelled" : "complete")
+            .arg(formatFileSize(bytesImported))
+            .arg(elapsedMs));
+        QMessageBox::information(this, "Import Complete", 
+            QString("Imported %1 file(s). Failed: %2").arg(imported).arg(failed));
+    });
+    
+    if (!m_importPipeline->start(jobs, doEncrypt, doCompress)) {
+        delete m_importPipeline;
+        m_importPipeline = nullptr;
+        QMessageBox::warning(this, "Import", "Could not start the import.");
+        return;
+    }
+    // Its batches hold a transaction open between commits
+    m_compactStorageAction->setEnabled(false);
+    m_progressBar->setVisible(true);
+    m_progressBar->setMaximum(jobs.size());
+    m_progressBar->setValue(0);
+    m_statusLabel->setText(QString("Importing %1 file(s)...").arg(jobs.size()));
 }
 
 void MainWindow::batchEncryptCompress() {